@@ -0,0 +1,161 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include "piface_autofocus.h"
+
+PiFaceAutofocus::PiFaceAutofocus()
+{
+	count = 0;
+	taken = 0;
+	approach = 1;
+	overshoot = 0;
+	min_position = 0;
+	max_position = 0;
+	running = false;
+}
+int PiFaceAutofocus::Clamp(int position)
+{
+	if (position < min_position)
+		return min_position;
+	if (position > max_position)
+		return max_position;
+	return position;
+}
+bool PiFaceAutofocus::Start(int center, int samples, int step, int direction, int overshoot_steps, int min, int max)
+{
+	if (samples < 3 || samples > AUTOFOCUS_MAX_SAMPLES || step < 1 || (long) (samples - 1) * step > max - min)
+		return false;
+
+	count = samples;
+	taken = 0;
+	approach = direction < 0 ? -1 : 1;
+	overshoot = overshoot_steps;
+	min_position = min;
+	max_position = max;
+
+	// centered on the current position, shifted to fit the travel
+	int first = center - (samples - 1) * step / 2;
+	if (first < min)
+		first = min;
+	if (first + (samples - 1) * step > max)
+		first = max - (samples - 1) * step;
+
+	// ordered in the approach direction
+	for (int i = 0; i < count; i++)
+		positions[i] = approach > 0 ? first + i * step : first + (count - 1 - i) * step;
+
+	running = true;
+	return true;
+}
+void PiFaceAutofocus::Stop()
+{
+	running = false;
+}
+bool PiFaceAutofocus::Running()
+{
+	return running;
+}
+int PiFaceAutofocus::Count()
+{
+	return count;
+}
+int PiFaceAutofocus::Taken()
+{
+	return taken;
+}
+int PiFaceAutofocus::Target()
+{
+	return positions[taken < count ? taken : count - 1];
+}
+int PiFaceAutofocus::Approach(int from, int to)
+{
+	// moving against the approach direction overshoots first
+	if ((to - from) * approach < 0 || from == to)
+		return Clamp(to - approach * overshoot);
+
+	return to;
+}
+void PiFaceAutofocus::Sample(double value)
+{
+	if (taken < count)
+		samples[taken++] = value;
+}
+bool PiFaceAutofocus::Done()
+{
+	return taken >= count;
+}
+bool PiFaceAutofocus::Fit(int *best, double *value, double *minimum)
+{
+	// least squares parabola on positions scaled around the sweep center
+	double center = (positions[0] + positions[count - 1]) / 2.0;
+	double scale = (positions[0] - positions[count - 1]) / 2.0;
+	if (scale < 0)
+		scale = -scale;
+
+	double s[5] = {0, 0, 0, 0, 0};
+	double t[3] = {0, 0, 0};
+	int valid = 0;
+	int lowest = -1;
+
+	for (int i = 0; i < taken; i++)
+	{
+		// no stars, no measurement
+		if (samples[i] <= 0)
+			continue;
+
+		double u = (positions[i] - center) / scale;
+		double p = 1;
+		for (int k = 0; k < 5; k++)
+		{
+			s[k] += p;
+			if (k < 3)
+				t[k] += p * samples[i];
+			p *= u;
+		}
+		if (lowest == -1 || samples[i] < samples[lowest])
+			lowest = i;
+		valid++;
+	}
+
+	if (valid < 3)
+		return false;
+
+	*minimum = samples[lowest];
+
+	// normal equations, Cramer's rule for c + b u + a u^2
+	double det = s[0] * (s[2] * s[4] - s[3] * s[3]) - s[1] * (s[1] * s[4] - s[3] * s[2]) + s[2] * (s[1] * s[3] - s[2] * s[2]);
+	if (det == 0)
+		return false;
+
+	double c = (t[0] * (s[2] * s[4] - s[3] * s[3]) - s[1] * (t[1] * s[4] - s[3] * t[2]) + s[2] * (t[1] * s[3] - s[2] * t[2])) / det;
+	double b = (s[0] * (t[1] * s[4] - s[3] * t[2]) - t[0] * (s[1] * s[4] - s[3] * s[2]) + s[2] * (s[1] * t[2] - t[1] * s[2])) / det;
+	double a = (s[0] * (s[2] * t[2] - t[1] * s[3]) - s[1] * (s[1] * t[2] - t[1] * s[2]) + t[0] * (s[1] * s[3] - s[2] * s[2])) / det;
+
+	// no minimum inside the sweep, fall back to the best sample
+	double u = a > 0 ? -b / (2 * a) : 2;
+	if (u < -1 || u > 1)
+	{
+		*best = positions[lowest];
+		*value = samples[lowest];
+		return true;
+	}
+
+	*best = Clamp((int) (center + u * scale + (u < 0 ? -0.5 : 0.5)));
+	*value = c + b * u + a * u * u;
+	return true;
+}
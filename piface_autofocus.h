@@ -0,0 +1,59 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACEAUTOFOCUS_H
+#define PIFACEAUTOFOCUS_H
+
+#define AUTOFOCUS_MAX_SAMPLES 64
+
+// V-curve sweep planner and fit.
+// The sweep visits its positions in the approach direction only, so the
+// focuser backlash is taken up once before the first sample and every
+// sample is reached the same way. Samples are HFR or FWHM values, smaller
+// is better; a parabola fitted through them gives the best position.
+class PiFaceAutofocus
+{
+private:
+	int positions[AUTOFOCUS_MAX_SAMPLES];
+	double samples[AUTOFOCUS_MAX_SAMPLES];
+	int count;
+	int taken;
+	int approach;
+	int overshoot;
+	int min_position;
+	int max_position;
+	bool running;
+	int Clamp(int position);
+public:
+	PiFaceAutofocus();
+
+	bool Start(int center, int samples, int step, int direction, int overshoot_steps, int min, int max);
+	void Stop();
+	bool Running();
+
+	int Count();
+	int Taken();
+	int Target();
+	int Approach(int from, int to);
+	void Sample(double value);
+	bool Done();
+
+	bool Fit(int *best, double *value, double *minimum);
+};
+
+#endif
@@ -0,0 +1,87 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// Combined indi_piface driver.
+// Relay and focuser devices live in one process with one event loop and
+// one spidev handle; the entry points below route requests by device name.
+// Focuser moves step on their motion threads and finish on the loop, so
+// relay requests and timers keep running while a focuser moves.
+
+#include <memory>
+#include <string.h>
+
+#include "piface_relay.h"
+#include "piface_focuser.h"
+#include "piface_recorder.h"
+
+std::unique_ptr<IndiPiFaceRelay> indiPiFaceRelay(new IndiPiFaceRelay);
+std::unique_ptr<IndiPiFaceFocuser1> indiPiFaceFocuser1(new IndiPiFaceFocuser1);
+std::unique_ptr<IndiPiFaceFocuser2> indiPiFaceFocuser2(new IndiPiFaceFocuser2);
+
+void ISGetProperties(const char *dev)
+{
+        indiPiFaceRelay->ISGetProperties(dev);
+        indiPiFaceFocuser1->ISGetProperties(dev);
+        indiPiFaceFocuser2->ISGetProperties(dev);
+}
+
+void ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int num)
+{
+		PiFaceRecorder::Switch(dev, name, states, names, num);
+		if (!strcmp(dev, indiPiFaceRelay->getDeviceName()))
+			indiPiFaceRelay->ISNewSwitch(dev, name, states, names, num);
+		else if (!strcmp(dev, indiPiFaceFocuser1->getDeviceName()))
+			indiPiFaceFocuser1->ISNewSwitch(dev, name, states, names, num);
+		else if (!strcmp(dev, indiPiFaceFocuser2->getDeviceName()))
+			indiPiFaceFocuser2->ISNewSwitch(dev, name, states, names, num);
+}
+
+void ISNewText(	const char *dev, const char *name, char *texts[], char *names[], int num)
+{
+		PiFaceRecorder::Text(dev, name, texts, names, num);
+		if (!strcmp(dev, indiPiFaceRelay->getDeviceName()))
+			indiPiFaceRelay->ISNewText(dev, name, texts, names, num);
+		else if (!strcmp(dev, indiPiFaceFocuser1->getDeviceName()))
+			indiPiFaceFocuser1->ISNewText(dev, name, texts, names, num);
+		else if (!strcmp(dev, indiPiFaceFocuser2->getDeviceName()))
+			indiPiFaceFocuser2->ISNewText(dev, name, texts, names, num);
+}
+
+void ISNewNumber(const char *dev, const char *name, double values[], char *names[], int num)
+{
+		PiFaceRecorder::Number(dev, name, values, names, num);
+		if (!strcmp(dev, indiPiFaceRelay->getDeviceName()))
+			indiPiFaceRelay->ISNewNumber(dev, name, values, names, num);
+		else if (!strcmp(dev, indiPiFaceFocuser1->getDeviceName()))
+			indiPiFaceFocuser1->ISNewNumber(dev, name, values, names, num);
+		else if (!strcmp(dev, indiPiFaceFocuser2->getDeviceName()))
+			indiPiFaceFocuser2->ISNewNumber(dev, name, values, names, num);
+}
+
+void ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int n)
+{
+		if (!strcmp(dev, indiPiFaceRelay->getDeviceName()))
+			indiPiFaceRelay->ISNewBLOB(dev, name, sizes, blobsizes, blobs, formats, names, n);
+}
+
+void ISSnoopDevice (XMLEle *root)
+{
+	indiPiFaceRelay->ISSnoopDevice(root);
+	indiPiFaceFocuser1->ISSnoopDevice(root);
+	indiPiFaceFocuser2->ISSnoopDevice(root);
+}
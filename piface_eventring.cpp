@@ -0,0 +1,153 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "piface_eventring.h"
+
+// binary export header, followed by count events
+struct PiFaceEventHeader
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t event_size;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+PiFaceEventRing::PiFaceEventRing()
+{
+	memset(events, 0, sizeof(events));
+	head.store(0);
+}
+void PiFaceEventRing::Record(uint16_t type, uint16_t id, int32_t value)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	uint64_t index = head.load(std::memory_order_relaxed);
+	PiFaceEvent *event = &events[index & (EVENT_RING_SIZE - 1)];
+	event->time = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	event->type = type;
+	event->id = id;
+	event->value = value;
+
+	// publish
+	head.store(index + 1, std::memory_order_release);
+}
+int PiFaceEventRing::Snapshot(PiFaceEvent *out, int max)
+{
+	uint64_t end = head.load(std::memory_order_acquire);
+	uint64_t start = end > EVENT_RING_SIZE ? end - EVENT_RING_SIZE : 0;
+
+	if (end - start > (uint64_t) max)
+		start = end - max;
+
+	for (uint64_t i = start; i < end; i++)
+		out[i - start] = events[i & (EVENT_RING_SIZE - 1)];
+
+	// entries the producer reached while copying are stale
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t now = head.load(std::memory_order_relaxed);
+	uint64_t valid = now >= EVENT_RING_SIZE ? now - EVENT_RING_SIZE + 1 : 0;
+
+	if (valid <= start)
+		return (int) (end - start);
+	if (valid >= end)
+		return 0;
+
+	memmove(out, out + (valid - start), (end - valid) * sizeof(PiFaceEvent));
+	return (int) (end - valid);
+}
+char *PiFaceEventRing::Export(int format, int *size)
+{
+	PiFaceEvent *snapshot = (PiFaceEvent *) malloc(EVENT_RING_SIZE * sizeof(PiFaceEvent));
+	if (snapshot == NULL)
+		return NULL;
+
+	int count = Snapshot(snapshot, EVENT_RING_SIZE);
+	char *buffer;
+
+	if (format == EXPORT_CSV)
+	{
+		// widest line is well below 80 characters
+		int length = 32 + count * 80;
+		buffer = (char *) malloc(length);
+		if (buffer != NULL)
+		{
+			int n = snprintf(buffer, length, "time_ns,event,id,value\n");
+			for (int i = 0; i < count; i++)
+				n += snprintf(buffer + n, length - n, "%llu,%s,%u,%d\n", (unsigned long long) snapshot[i].time, TypeName(snapshot[i].type), snapshot[i].id, snapshot[i].value);
+			*size = n;
+		}
+	}
+	else
+	{
+		PiFaceEventHeader header;
+		memcpy(header.magic, EVENT_EXPORT_MAGIC, 4);
+		header.version = EVENT_EXPORT_VERSION;
+		header.event_size = sizeof(PiFaceEvent);
+		header.count = count;
+		header.reserved = 0;
+
+		*size = sizeof(header) + count * sizeof(PiFaceEvent);
+		buffer = (char *) malloc(*size);
+		if (buffer != NULL)
+		{
+			memcpy(buffer, &header, sizeof(header));
+			memcpy(buffer + sizeof(header), snapshot, count * sizeof(PiFaceEvent));
+		}
+	}
+
+	free(snapshot);
+	return buffer;
+}
+void PiFaceEventRing::Clear()
+{
+	// producer side only
+	head.store(0, std::memory_order_release);
+}
+const char *PiFaceEventRing::TypeName(uint16_t type)
+{
+	switch (type)
+	{
+	case EVENT_MOVE_START:
+		return "move_start";
+	case EVENT_MOVE_END:
+		return "move_end";
+	case EVENT_STEP_BATCH:
+		return "step_batch";
+	case EVENT_RELAY_WRITE:
+		return "relay_write";
+	case EVENT_WRITE_RETRY:
+		return "write_retry";
+	case EVENT_SPI_ERROR:
+		return "spi_error";
+	case EVENT_HOME:
+		return "home";
+	case EVENT_AUTOFOCUS:
+		return "autofocus";
+	case EVENT_STALL:
+		return "stall";
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,77 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACEEVENTRING_H
+#define PIFACEEVENTRING_H
+
+#include <stdint.h>
+#include <atomic>
+
+// power of two
+#define EVENT_RING_SIZE 4096
+
+#define EVENT_EXPORT_MAGIC "PFEV"
+#define EVENT_EXPORT_VERSION 1
+
+struct PiFaceEvent
+{
+	uint64_t time;		// CLOCK_MONOTONIC, ns
+	uint16_t type;
+	uint16_t id;
+	int32_t value;
+};
+
+// Flight recorder for hot-path events.
+// One producer appends to a preallocated ring and overwrites the oldest
+// entries; readers take a snapshot without stopping the producer and drop
+// any entry that was overwritten while it was being copied. Recording is a
+// clock read and a 16 byte store, nothing runs while the driver is idle.
+class PiFaceEventRing
+{
+private:
+	PiFaceEvent events[EVENT_RING_SIZE];
+	std::atomic<uint64_t> head;
+public:
+	enum
+	{
+		EVENT_MOVE_START = 1,
+		EVENT_MOVE_END,
+		EVENT_STEP_BATCH,
+		EVENT_RELAY_WRITE,
+		EVENT_WRITE_RETRY,
+		EVENT_SPI_ERROR,
+		EVENT_HOME,
+		EVENT_AUTOFOCUS,
+		EVENT_STALL
+	};
+	enum
+	{
+		EXPORT_BINARY,
+		EXPORT_CSV
+	};
+
+	PiFaceEventRing();
+
+	void Record(uint16_t type, uint16_t id, int32_t value);
+	int Snapshot(PiFaceEvent *out, int max);
+	char *Export(int format, int *size);
+	void Clear();
+	static const char *TypeName(uint16_t type);
+};
+
+#endif
@@ -20,7 +20,8 @@
 #include <unistd.h>
 #include <memory>
 #include <string.h>
-#include <mcp23s17.h>
+#include <time.h>
+#include <errno.h>
 
 #include "piface_focuser.h"
 
@@ -32,59 +33,41 @@
 
 #define CHECK_BIT(var,pos) (((var)>>(pos)) & 1)
 #define MAX_STEPS 20000
+#define DIAGNOSTICS_TAB "Diagnostics"
+#define AUTOFOCUS_TAB "Autofocus"
+#define IMAGING_TAB "Imaging"
 
-// We declare a pointer to indiPiFaceFocuser.
-std::unique_ptr<IndiPiFaceFocuser1> indiPiFaceFocuser1(new IndiPiFaceFocuser1);
-std::unique_ptr<IndiPiFaceFocuser2> indiPiFaceFocuser2(new IndiPiFaceFocuser2);
+// position updates for clients while the motion thread steps
+#define MOTION_PUBLISH_MS 250
 
-void ISPoll(void *p);
-void ISGetProperties(const char *dev)
+// monotonic clock in nanoseconds
+static long long MonotonicNs()
 {
-        indiPiFaceFocuser1->ISGetProperties(dev);
-        indiPiFaceFocuser2->ISGetProperties(dev);
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
-void ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int num)
+// sleep to the next absolute step deadline, returns how late the wakeup was
+static long long SleepUntil(struct timespec *deadline, long long period_ns)
 {
-		if (!strcmp(dev, indiPiFaceFocuser1->getDeviceName()))
-			indiPiFaceFocuser1->ISNewSwitch(dev, name, states, names, num);
-		else if (!strcmp(dev, indiPiFaceFocuser2->getDeviceName()))
-			indiPiFaceFocuser2->ISNewSwitch(dev, name, states, names, num);
-}
+	long long next = (long long) deadline->tv_sec * 1000000000LL + deadline->tv_nsec + period_ns;
+	deadline->tv_sec = next / 1000000000LL;
+	deadline->tv_nsec = next % 1000000000LL;
 
-void ISNewText(	const char *dev, const char *name, char *texts[], char *names[], int num)
-{
-		if (!strcmp(dev, indiPiFaceFocuser1->getDeviceName()))
-			indiPiFaceFocuser1->ISNewText(dev, name, texts, names, num);
-		else if (!strcmp(dev, indiPiFaceFocuser2->getDeviceName()))
-			indiPiFaceFocuser2->ISNewText(dev, name, texts, names, num);
-}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR)
+		;
 
-void ISNewNumber(const char *dev, const char *name, double values[], char *names[], int num)
-{
-		if (!strcmp(dev, indiPiFaceFocuser1->getDeviceName()))
-			indiPiFaceFocuser1->ISNewNumber(dev, name, values, names, num);
-		else if (!strcmp(dev, indiPiFaceFocuser2->getDeviceName()))
-			indiPiFaceFocuser2->ISNewNumber(dev, name, values, names, num);
-}
+	// fell behind by a whole step, restart from now instead of bursting
+	long long late = MonotonicNs() - next;
+	if (late > period_ns)
+		clock_gettime(CLOCK_MONOTONIC, deadline);
 
-void ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int n)
-{
-  INDI_UNUSED(dev);
-  INDI_UNUSED(name);
-  INDI_UNUSED(sizes);
-  INDI_UNUSED(blobsizes);
-  INDI_UNUSED(blobs);
-  INDI_UNUSED(formats);
-  INDI_UNUSED(names);
-  INDI_UNUSED(n);
+	return late;
 }
 
-void ISSnoopDevice (XMLEle *root)
-{
-	indiPiFaceFocuser1->ISSnoopDevice(root);
-	indiPiFaceFocuser2->ISSnoopDevice(root);
-}
+// half step sequence, walked forward or backward
+static const int step_sequence[8] = {0xa, 0x2, 0x6, 0x4, 0x5, 0x1, 0x9, 0x8};
 
 /************************************************************************************
 *
@@ -95,6 +78,31 @@ void ISSnoopDevice (XMLEle *root)
 IndiPiFaceFocuser1::IndiPiFaceFocuser1()
 {
 	setVersion(MAJOR_VERSION,MINOR_VERSION);
+	step_count = 0;
+	move_count = 0;
+	move_ns_total = 0;
+	last_move_ns = 0;
+	last_move_steps = 0;
+	last_move_late_ns = 0;
+	autofocus_start = 0;
+	autofocus_skip = 0;
+	autofocus_timer = -1;
+	exposing = false;
+	deferred_target = -1;
+	defer_timer = -1;
+	filter_slot = 0;
+	home_phase = HOME_IDLE;
+	home_left = 0;
+	home_timer = -1;
+	home_limit = 0;
+	motion_done = 0;
+	motion_abort = false;
+	motion_active = false;
+	motion_start = 0;
+	motion_next = -1;
+	motion_timer = -1;
+	motion_cb = -1;
+	motion_begin = 0;
         setFocuserConnection(CONNECTION_NONE);
 }
 
@@ -111,29 +119,37 @@ const char * IndiPiFaceFocuser1::getDefaultName()
 bool IndiPiFaceFocuser1::Connect()
 {
 	// open device
-	mcp23s17_fd = mcp23s17_open(0,0);
-
-	if(mcp23s17_fd == -1)
+	if(!bus.Open(0, 0, isSimulation(), (uint32_t) (SpiClockN[0].value * 1000000)))
 	{
 		IDMessage(getDeviceName(), "PiFace Focuser 1 device is not available.");
 		return false;
 	}
 
-	// config register
+	// config register, interrupt bits are left to input capture
 	const uint8_t ioconfig = BANK_OFF | \
-                             INT_MIRROR_OFF | \
-                             SEQOP_OFF | \
+                             SEQOP_ON | \
                              DISSLW_OFF | \
-                             HAEN_ON | \
-                             ODR_OFF | \
-                             INTPOL_LOW;
-	mcp23s17_write_reg(ioconfig, IOCON, 0, mcp23s17_fd);
+                             HAEN_ON;
+	bus.WriteBits(ioconfig, IOCON_BUS_MASK, IOCON, 0);
 
-	// I/O direction
-	mcp23s17_write_reg(0x00, IODIRB, 0, mcp23s17_fd);
+	// I/O direction, lower nibble only
+	bus.WriteBits(0x00, 0x0f, IODIRB, 0);
 
 	// pull ups
-	mcp23s17_write_reg(0x00, GPPUB, 0, mcp23s17_fd);
+	bus.WriteBits(0x00, 0x0f, GPPUB, 0);
+
+	// moves are completed on the event loop when the motion thread is done
+	if (realtime.DoneFd() == -1)
+	{
+		IDMessage(getDeviceName(), "PiFace Focuser 1 motion thread is not available.");
+		bus.Close();
+		return false;
+	}
+	motion_cb = IEAddCallback(realtime.DoneFd(), MotionDone, this);
+
+	// position is written on a debounce timer, not per move
+	if (!persist.Open(getDeviceName(), WriteConfig, this))
+		IDMessage(getDeviceName(), "PiFace Focuser 1 config persistence is not available.");
 
 	IDMessage(getDeviceName(), "PiFace Focuser 1 connected successfully.");
 	return true;
@@ -141,15 +157,44 @@ bool IndiPiFaceFocuser1::Connect()
 
 bool IndiPiFaceFocuser1::Disconnect()
 {
+	// no sweep without the motor
+	if (autofocus.Running())
+		AbortAutofocus("disconnected", false);
+
+	// queued move is dropped, a running one stops at the next step
+	CancelDeferred();
+	StopMove();
+	WaitMove();
+
+	// homing steps stop with the bus
+	if (home_phase != HOME_IDLE)
+		FinishHome("homing aborted");
+
 	// park focuser
 	if ( FocusParkingS[0].s == ISS_ON )
 	{
 		IDMessage(getDeviceName(), "PiFace Focuser 1 is parking...");
-		MoveAbsFocuser(FocusAbsPosN[0].min);
+		if (MoveAbsFocuser(FocusAbsPosN[0].min) == IPS_BUSY)
+			WaitMove();
+	}
+
+	if (motion_cb != -1)
+	{
+		IERmCallback(motion_cb);
+		motion_cb = -1;
 	}
 
+	// parked position and pending changes reach the card
+	persist.Close();
+
+	// stop metrics endpoint
+	metrics.Stop();
+
+	// back to normal scheduling
+	realtime.Release();
+
 	// close device
-	close(mcp23s17_fd);
+	bus.Close();
 
 	IDMessage(getDeviceName(), "PiFace Focuser 1 disconnected successfully.");
 	return true;
@@ -177,6 +222,116 @@ bool IndiPiFaceFocuser1::initProperties()
 	IUFillSwitch(&FocusResetS[0],"FOCUS_RESET","Reset",ISS_OFF);
 	IUFillSwitchVector(&FocusResetSP,FocusResetS,1,getDeviceName(),"FOCUS_RESET","Position Reset",OPTIONS_TAB,IP_RW,ISR_1OFMANY,60,IPS_OK);
 
+	IUFillSwitch(&FocusHomeS[0],"FOCUS_HOME","Home",ISS_OFF);
+	IUFillSwitchVector(&FocusHomeSP,FocusHomeS,1,getDeviceName(),"FOCUS_HOME","Homing",MAIN_CONTROL_TAB,IP_RW,ISR_ATMOST1,60,IPS_IDLE);
+
+	IUFillNumber(&HomeConfigN[0],"HOME_INPUT","Limit Input","%0.0f",1,INPUT_COUNT,1,1);
+	IUFillNumber(&HomeConfigN[1],"HOME_FAST_DELAY","Fast Delay (ms)","%0.0f",1,100,1,1);
+	IUFillNumber(&HomeConfigN[2],"HOME_SLOW_DELAY","Slow Delay (ms)","%0.0f",1,100,1,5);
+	IUFillNumber(&HomeConfigN[3],"HOME_BACKOFF","Backoff (steps)","%0.0f",1,2000,10,200);
+	IUFillNumberVector(&HomeConfigNP,HomeConfigN,4,getDeviceName(),"HOME_CONFIG","Homing",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillText(&MetricsT[0],"ENDPOINT","Endpoint","");
+	IUFillTextVector(&MetricsTP,MetricsT,1,getDeviceName(),"METRICS_ENDPOINT","Metrics",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillNumber(&SpiClockN[0],"SPI_SPEED","Clock (MHz)","%0.1f",0.1,10,0.1,10);
+	IUFillNumberVector(&SpiClockNP,SpiClockN,1,getDeviceName(),"SPI_CLOCK","SPI",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillNumber(&RealtimeN[0],"RT_PRIORITY","FIFO Priority (0 off)","%0.0f",0,99,1,0);
+	IUFillNumber(&RealtimeN[1],"RT_CPU","CPU (-1 any)","%0.0f",-1,63,1,-1);
+	IUFillNumberVector(&RealtimeNP,RealtimeN,2,getDeviceName(),"REALTIME_CONFIG","Real Time",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillSwitch(&RealtimeS[0],"RT_MLOCK","Lock Memory",ISS_OFF);
+	IUFillSwitch(&RealtimeS[1],"RT_PREFAULT","Prefault Stack",ISS_OFF);
+	IUFillSwitchVector(&RealtimeSP,RealtimeS,2,getDeviceName(),"REALTIME_OPTIONS","Real Time Memory",OPTIONS_TAB,IP_RW,ISR_NOFMANY,0,IPS_IDLE);
+
+	IUFillText(&RealtimeStatusT[0],"RT_ACTIVE","Active","off");
+	IUFillTextVector(&RealtimeStatusTP,RealtimeStatusT,1,getDeviceName(),"REALTIME_STATUS","Real Time Status",OPTIONS_TAB,IP_RO,0,IPS_IDLE);
+
+	// autofocus tab
+	IUFillSwitch(&AutofocusS[0],"AF_START","Start",ISS_OFF);
+	IUFillSwitch(&AutofocusS[1],"AF_ABORT","Abort",ISS_OFF);
+	IUFillSwitchVector(&AutofocusSP,AutofocusS,2,getDeviceName(),"AUTOFOCUS","Sweep",AUTOFOCUS_TAB,IP_RW,ISR_ATMOST1,0,IPS_IDLE);
+
+	IUFillNumber(&AutofocusN[0],"AF_SAMPLES","Positions","%0.0f",3,AUTOFOCUS_MAX_SAMPLES,1,9);
+	IUFillNumber(&AutofocusN[1],"AF_STEP","Step Size","%0.0f",1,2000,10,50);
+	IUFillNumber(&AutofocusN[2],"AF_OVERSHOOT","Backlash Overshoot","%0.0f",0,2000,10,100);
+	IUFillNumber(&AutofocusN[3],"AF_SKIP","Frames Skipped","%0.0f",0,5,1,1);
+	IUFillNumber(&AutofocusN[4],"AF_TIMEOUT","Sample Timeout (sec)","%0.0f",5,600,5,60);
+	IUFillNumberVector(&AutofocusNP,AutofocusN,5,getDeviceName(),"AUTOFOCUS_CONFIG","Settings",AUTOFOCUS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillSwitch(&AutofocusDirS[0],"AF_OUTWARD","Outward",ISS_ON);
+	IUFillSwitch(&AutofocusDirS[1],"AF_INWARD","Inward",ISS_OFF);
+	IUFillSwitchVector(&AutofocusDirSP,AutofocusDirS,2,getDeviceName(),"AUTOFOCUS_APPROACH","Approach",AUTOFOCUS_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+	IUFillText(&AutofocusSnoopT[0],"AF_DEVICE","Camera","CCD Simulator");
+	IUFillText(&AutofocusSnoopT[1],"AF_PROPERTY","Property","CCD_HFR");
+	IUFillText(&AutofocusSnoopT[2],"AF_ELEMENT","Element","HFR");
+	IUFillTextVector(&AutofocusSnoopTP,AutofocusSnoopT,3,getDeviceName(),"AUTOFOCUS_SOURCE","HFR Source",AUTOFOCUS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillNumber(&AutofocusResultN[0],"AF_SAMPLE","Sample","%0.0f",0,AUTOFOCUS_MAX_SAMPLES,1,0);
+	IUFillNumber(&AutofocusResultN[1],"AF_BEST","Best Position","%0.0f",0,MAX_STEPS,1,0);
+	IUFillNumber(&AutofocusResultN[2],"AF_FIT","Fitted HFR","%0.2f",0,100,0,0);
+	IUFillNumber(&AutofocusResultN[3],"AF_MIN","Lowest HFR","%0.2f",0,100,0,0);
+	IUFillNumberVector(&AutofocusResultNP,AutofocusResultN,4,getDeviceName(),"AUTOFOCUS_RESULT","Result",AUTOFOCUS_TAB,IP_RO,0,IPS_IDLE);
+
+	// imaging tab
+	IUFillSwitch(&DeferS[0],"DEFER_ENABLE","Enable",ISS_OFF);
+	IUFillSwitch(&DeferS[1],"DEFER_DISABLE","Disable",ISS_ON);
+	IUFillSwitchVector(&DeferSP,DeferS,2,getDeviceName(),"MOVE_DEFERRAL","Defer Moves",IMAGING_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+	IUFillText(&DeferT[0],"DEFER_DEVICE","Camera","CCD Simulator");
+	IUFillTextVector(&DeferTP,DeferT,1,getDeviceName(),"DEFER_CAMERA","Exposing Camera",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillNumber(&DeferN[0],"DEFER_GUARD","Max Wait (sec)","%0.0f",10,3600,10,600);
+	IUFillNumberVector(&DeferNP,DeferN,1,getDeviceName(),"DEFER_CONFIG","Deferral",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillSwitch(&FilterOffsetS[0],"FILTER_OFFSET_ENABLE","Enable",ISS_OFF);
+	IUFillSwitch(&FilterOffsetS[1],"FILTER_OFFSET_DISABLE","Disable",ISS_ON);
+	IUFillSwitchVector(&FilterOffsetSP,FilterOffsetS,2,getDeviceName(),"FILTER_OFFSET_MODE","Filter Offsets",IMAGING_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+	IUFillText(&FilterWheelT[0],"FILTER_DEVICE","Filter Wheel","Filter Simulator");
+	IUFillTextVector(&FilterWheelTP,FilterWheelT,1,getDeviceName(),"FILTER_WHEEL","Filter Wheel",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+
+	for (int i = 0; i < MAX_FILTERS; i++)
+	{
+		char name[MAXINDINAME], label[MAXINDILABEL];
+		snprintf(name, sizeof(name), "OFFSET_%d", i + 1);
+		snprintf(label, sizeof(label), "Filter %d", i + 1);
+		IUFillNumber(&FilterOffsetN[i],name,label,"%0.0f",-MAX_STEPS/10,MAX_STEPS/10,10,0);
+	}
+	IUFillNumberVector(&FilterOffsetNP,FilterOffsetN,MAX_FILTERS,getDeviceName(),"FILTER_OFFSETS","Offsets (steps)",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillSwitch(&TempCompS[0],"TC_ENABLE","Enable",ISS_OFF);
+	IUFillSwitch(&TempCompS[1],"TC_DISABLE","Disable",ISS_ON);
+	IUFillSwitchVector(&TempCompSP,TempCompS,2,getDeviceName(),"TEMP_COMPENSATION","Temp. Compensation",IMAGING_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+	IUFillText(&TempSourceT[0],"TC_DEVICE","Device","Weather Simulator");
+	IUFillText(&TempSourceT[1],"TC_PROPERTY","Property","WEATHER_PARAMETERS");
+	IUFillText(&TempSourceT[2],"TC_ELEMENT","Element","WEATHER_TEMPERATURE");
+	IUFillTextVector(&TempSourceTP,TempSourceT,3,getDeviceName(),"TEMP_SOURCE","Temperature Source",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillNumber(&TempCompN[0],"TC_COEFFICIENT","Steps per C","%0.1f",-1000,1000,1,0);
+	IUFillNumber(&TempCompN[1],"TC_THRESHOLD","Hysteresis (steps)","%0.0f",1,1000,1,10);
+	IUFillNumberVector(&TempCompNP,TempCompN,2,getDeviceName(),"TEMP_COMP_CONFIG","Compensation",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+	tempcomp.Configure(TempCompN[0].value, (int) TempCompN[1].value);
+
+	IUFillNumber(&TempStatusN[0],"TC_TEMPERATURE","Temperature (C)","%0.2f",-100,100,0,0);
+	IUFillNumber(&TempStatusN[1],"TC_REFERENCE","Reference (C)","%0.2f",-100,100,0,0);
+	IUFillNumber(&TempStatusN[2],"TC_PENDING","Pending (steps)","%0.1f",-MAX_STEPS,MAX_STEPS,0,0);
+	IUFillNumberVector(&TempStatusNP,TempStatusN,3,getDeviceName(),"TEMP_COMP_STATUS","Compensation Status",IMAGING_TAB,IP_RO,0,IPS_IDLE);
+
+	IUFillSwitch(&TempResetS[0],"TC_RESET","Reset Reference",ISS_OFF);
+	IUFillSwitchVector(&TempResetSP,TempResetS,1,getDeviceName(),"TEMP_COMP_RESET","Reference",IMAGING_TAB,IP_RW,ISR_ATMOST1,0,IPS_IDLE);
+
+	// diagnostics tab
+	IUFillSwitch(&EventExportS[0],"EXPORT_BINARY","Binary",ISS_OFF);
+	IUFillSwitch(&EventExportS[1],"EXPORT_CSV","CSV",ISS_OFF);
+	IUFillSwitchVector(&EventExportSP,EventExportS,2,getDeviceName(),"EVENT_EXPORT","Export Events",DIAGNOSTICS_TAB,IP_RW,ISR_ATMOST1,0,IPS_IDLE);
+
+	IUFillBLOB(&EventLogB[0],"EVENTS","Events","");
+	IUFillBLOBVector(&EventLogBP,EventLogB,1,getDeviceName(),"EVENT_LOG","Event Log",DIAGNOSTICS_TAB,IP_RO,60,IPS_IDLE);
+
 	// main tab
 	IUFillSwitch(&FocusMotionS[0],"FOCUS_INWARD","Focus In",ISS_OFF);
 	IUFillSwitch(&FocusMotionS[1],"FOCUS_OUTWARD","Focus Out",ISS_ON);
@@ -201,6 +356,8 @@ bool IndiPiFaceFocuser1::initProperties()
 	// set capabilities
 	SetFocuserCapability(FOCUSER_CAN_ABS_MOVE | FOCUSER_CAN_REL_MOVE);
 
+	addSimulationControl();
+
 	// set default values
 	dir = FOCUS_OUTWARD;
 	step_index = 0;
@@ -233,6 +390,33 @@ bool IndiPiFaceFocuser1::updateProperties()
 		defineSwitch(&FocusResetSP);
                 defineSwitch(&MotorDirSP);
                 defineNumber(&MotorDelayNP);
+                defineSwitch(&FocusHomeSP);
+                defineNumber(&HomeConfigNP);
+                defineNumber(&SpiClockNP);
+                defineNumber(&RealtimeNP);
+                defineSwitch(&RealtimeSP);
+                defineText(&RealtimeStatusTP);
+                ApplyRealtime();
+                defineSwitch(&EventExportSP);
+                defineBLOB(&EventLogBP);
+                defineText(&MetricsTP);
+                defineSwitch(&AutofocusSP);
+                defineNumber(&AutofocusNP);
+                defineSwitch(&AutofocusDirSP);
+                defineText(&AutofocusSnoopTP);
+                defineNumber(&AutofocusResultNP);
+                defineSwitch(&DeferSP);
+                defineText(&DeferTP);
+                defineNumber(&DeferNP);
+                defineSwitch(&FilterOffsetSP);
+                defineText(&FilterWheelTP);
+                defineNumber(&FilterOffsetNP);
+                defineSwitch(&TempCompSP);
+                defineText(&TempSourceTP);
+                defineNumber(&TempCompNP);
+                defineNumber(&TempStatusNP);
+                defineSwitch(&TempResetSP);
+                StartMetrics();
                 // defineNumber(&FocusBacklashNP);
     }
     else
@@ -244,6 +428,31 @@ bool IndiPiFaceFocuser1::updateProperties()
 		deleteProperty(FocusResetSP.name);
                 deleteProperty(MotorDirSP.name);
                 deleteProperty(MotorDelayNP.name);
+                deleteProperty(FocusHomeSP.name);
+                deleteProperty(HomeConfigNP.name);
+                deleteProperty(SpiClockNP.name);
+                deleteProperty(RealtimeNP.name);
+                deleteProperty(RealtimeSP.name);
+                deleteProperty(RealtimeStatusTP.name);
+                deleteProperty(EventExportSP.name);
+                deleteProperty(EventLogBP.name);
+                deleteProperty(MetricsTP.name);
+                deleteProperty(AutofocusSP.name);
+                deleteProperty(AutofocusNP.name);
+                deleteProperty(AutofocusDirSP.name);
+                deleteProperty(AutofocusSnoopTP.name);
+                deleteProperty(AutofocusResultNP.name);
+                deleteProperty(DeferSP.name);
+                deleteProperty(DeferTP.name);
+                deleteProperty(DeferNP.name);
+                deleteProperty(FilterOffsetSP.name);
+                deleteProperty(FilterWheelTP.name);
+                deleteProperty(FilterOffsetNP.name);
+                deleteProperty(TempCompSP.name);
+                deleteProperty(TempSourceTP.name);
+                deleteProperty(TempCompNP.name);
+                deleteProperty(TempStatusNP.name);
+                deleteProperty(TempResetSP.name);
     }
 
     return true;
@@ -255,10 +464,77 @@ bool IndiPiFaceFocuser1::ISNewNumber (const char *dev, const char *name, double
 	if(strcmp(dev,getDeviceName())==0)
 	{
 
+        // handle spi clock, applies to the next transfer
+        if (!strcmp(name, SpiClockNP.name))
+        {
+			IUUpdateNumber(&SpiClockNP,values,names,n);
+			bus.SetSpeed((uint32_t) (SpiClockN[0].value * 1000000));
+			SpiClockN[0].value = bus.Speed() / 1e6;
+			SpiClockNP.s = IPS_OK;
+			IDSetNumber(&SpiClockNP, NULL);
+			return true;
+        }
+
+        // a manual move ends a running sweep and sets the compensation reference
+        if (!strcmp(name, FocusAbsPosNP.name) || !strcmp(name, FocusRelPosNP.name))
+        {
+			if (autofocus.Running())
+				AbortAutofocus("manual move", false);
+			tempcomp.Reset();
+        }
+
+        // handle compensation coefficient and hysteresis
+        if (!strcmp(name, TempCompNP.name))
+        {
+			IUUpdateNumber(&TempCompNP,values,names,n);
+			tempcomp.Configure(TempCompN[0].value, (int) TempCompN[1].value);
+			TempCompNP.s = IPS_OK;
+			IDSetNumber(&TempCompNP, NULL);
+			PublishTempComp();
+			return true;
+        }
+
+        // handle filter offset table
+        if (!strcmp(name, FilterOffsetNP.name))
+        {
+			IUUpdateNumber(&FilterOffsetNP,values,names,n);
+			FilterOffsetNP.s = IPS_OK;
+			IDSetNumber(&FilterOffsetNP, NULL);
+			return true;
+        }
+
+        // handle deferral guard
+        if (!strcmp(name, DeferNP.name))
+        {
+			IUUpdateNumber(&DeferNP,values,names,n);
+			DeferNP.s = IPS_OK;
+			IDSetNumber(&DeferNP, NULL);
+			return true;
+        }
+
+        // handle autofocus settings
+        if (!strcmp(name, AutofocusNP.name))
+        {
+			IUUpdateNumber(&AutofocusNP,values,names,n);
+			AutofocusNP.s = IPS_OK;
+			IDSetNumber(&AutofocusNP, NULL);
+			return true;
+        }
+
+        // handle real time priority and cpu
+        if (!strcmp(name, RealtimeNP.name))
+        {
+			IUUpdateNumber(&RealtimeNP,values,names,n);
+			ApplyRealtime();
+			return true;
+        }
+
         // handle focus absolute position
         if (!strcmp(name, FocusAbsPosNP.name))
         {
 			int newPos = (int) values[0];
+            if (DeferMove(newPos))
+                return true;
             if ( MoveAbsFocuser(newPos) == IPS_OK )
             {
                IUUpdateNumber(&FocusAbsPosNP,values,names,n);
@@ -275,6 +551,12 @@ bool IndiPiFaceFocuser1::ISNewNumber (const char *dev, const char *name, double
 			FocusRelPosNP.s=IPS_OK;
 			IDSetNumber(&FocusRelPosNP, NULL);
 
+			// queued as an absolute target while the camera exposes, relative
+			// requests add up on a move that is already queued
+			int base = PlannedTarget();
+			if (DeferMove(base + (int) FocusRelPosN[0].value * (FocusMotionS[0].s == ISS_ON ? -1 : 1)))
+				return true;
+
 			//FOCUS_INWARD
             if ( FocusMotionS[0].s == ISS_ON )
 				MoveRelFocuser(FOCUS_INWARD, FocusRelPosN[0].value);
@@ -295,6 +577,15 @@ bool IndiPiFaceFocuser1::ISNewNumber (const char *dev, const char *name, double
             return true;
         }
 
+        // handle homing configuration
+        if (!strcmp(name, HomeConfigNP.name))
+        {
+            IUUpdateNumber(&HomeConfigNP,values,names,n);
+            HomeConfigNP.s=IPS_OK;
+            IDSetNumber(&HomeConfigNP, NULL);
+            return true;
+        }
+
         // handle focus backlash
         if (!strcmp(name, FocusBacklashNP.name))
         {
@@ -320,15 +611,18 @@ bool IndiPiFaceFocuser1::ISNewSwitch (const char *dev, const char *name, ISState
 
 			//Preset 1
             if ( PresetGotoS[0].s == ISS_ON )
-				MoveAbsFocuser(PresetN[0].value);
+				if (!DeferMove(PresetN[0].value))
+					MoveAbsFocuser(PresetN[0].value);
 
 			//Preset 2
             if ( PresetGotoS[1].s == ISS_ON )
-				MoveAbsFocuser(PresetN[1].value);
+				if (!DeferMove(PresetN[1].value))
+					MoveAbsFocuser(PresetN[1].value);
 
 			//Preset 2
             if ( PresetGotoS[2].s == ISS_ON )
-				MoveAbsFocuser(PresetN[2].value);
+				if (!DeferMove(PresetN[2].value))
+					MoveAbsFocuser(PresetN[2].value);
 
 			PresetGotoS[0].s = ISS_OFF;
 			PresetGotoS[1].s = ISS_OFF;
@@ -354,6 +648,114 @@ bool IndiPiFaceFocuser1::ISNewSwitch (const char *dev, const char *name, ISState
 			return true;
 		}
 
+        // handle autofocus sweep
+        if(!strcmp(name, AutofocusSP.name))
+        {
+			IUUpdateSwitch(&AutofocusSP, states, names, n);
+			if (AutofocusS[0].s == ISS_ON && !autofocus.Running())
+				StartAutofocus();
+			else if (AutofocusS[1].s == ISS_ON && autofocus.Running())
+				AbortAutofocus("aborted", true);
+			IUResetSwitch(&AutofocusSP);
+			IDSetSwitch(&AutofocusSP, NULL);
+			return true;
+		}
+
+        // handle temperature compensation
+        if(!strcmp(name, TempCompSP.name))
+        {
+			IUUpdateSwitch(&TempCompSP, states, names, n);
+			if (TempCompS[0].s == ISS_ON)
+			{
+				// compensation starts from the focus found at the current temperature
+				tempcomp.Reset();
+				IDSnoopDevice(TempSourceT[0].text, TempSourceT[1].text);
+				IDSnoopDevice(DeferT[0].text, "CCD_EXPOSURE");
+			}
+			TempCompSP.s = IPS_OK;
+			IDSetSwitch(&TempCompSP, NULL);
+			PublishTempComp();
+			return true;
+		}
+
+        // handle compensation reference reset
+        if(!strcmp(name, TempResetSP.name))
+        {
+			tempcomp.Reset();
+			IUResetSwitch(&TempResetSP);
+			TempResetSP.s = IPS_OK;
+			IDSetSwitch(&TempResetSP, NULL);
+			PublishTempComp();
+			return true;
+		}
+
+        // handle filter offsets
+        if(!strcmp(name, FilterOffsetSP.name))
+        {
+			IUUpdateSwitch(&FilterOffsetSP, states, names, n);
+			if (FilterOffsetS[0].s == ISS_ON)
+				IDSnoopDevice(FilterWheelT[0].text, "FILTER_SLOT");
+			FilterOffsetSP.s = IPS_OK;
+			IDSetSwitch(&FilterOffsetSP, NULL);
+			return true;
+		}
+
+        // handle move deferral
+        if(!strcmp(name, DeferSP.name))
+        {
+			IUUpdateSwitch(&DeferSP, states, names, n);
+			if (DeferS[0].s == ISS_ON)
+				IDSnoopDevice(DeferT[0].text, "CCD_EXPOSURE");
+			else if (deferred_target != -1)
+				RunDeferred();
+			DeferSP.s = IPS_OK;
+			IDSetSwitch(&DeferSP, NULL);
+			return true;
+		}
+
+        // handle autofocus approach direction
+        if(!strcmp(name, AutofocusDirSP.name))
+        {
+			IUUpdateSwitch(&AutofocusDirSP, states, names, n);
+			AutofocusDirSP.s = IPS_OK;
+			IDSetSwitch(&AutofocusDirSP, NULL);
+			return true;
+		}
+
+        // handle real time memory options
+        if(!strcmp(name, RealtimeSP.name))
+        {
+			IUUpdateSwitch(&RealtimeSP, states, names, n);
+			ApplyRealtime();
+			return true;
+		}
+
+        // handle event export
+        if(!strcmp(name, EventExportSP.name))
+        {
+			IUUpdateSwitch(&EventExportSP, states, names, n);
+			ExportEvents(EventExportS[1].s == ISS_ON ? PiFaceEventRing::EXPORT_CSV : PiFaceEventRing::EXPORT_BINARY);
+			IUResetSwitch(&EventExportSP);
+			EventExportSP.s = IPS_IDLE;
+			IDSetSwitch(&EventExportSP, NULL);
+			return true;
+		}
+
+        // handle homing
+        if(!strcmp(name, FocusHomeSP.name))
+        {
+			IUUpdateSwitch(&FocusHomeSP, states, names, n);
+
+            if ( FocusHomeS[0].s == ISS_ON )
+            {
+				// stays busy until the homing steps finish
+				FocusHomeSP.s = HomeFocuser() ? IPS_BUSY : IPS_ALERT;
+			}
+            FocusHomeS[0].s = ISS_OFF;
+            IDSetSwitch(&FocusHomeSP, NULL);
+			return true;
+		}
+
         // handle parking mode
         if(!strcmp(name, FocusParkingSP.name))
         {
@@ -409,6 +811,23 @@ bool IndiPiFaceFocuser1::saveConfigItems(FILE *fp)
 	IUSaveConfigNumber(fp, &FocusBacklashNP);
 	IUSaveConfigSwitch(fp, &FocusParkingSP);
 	IUSaveConfigSwitch(fp, &MotorDirSP);
+	IUSaveConfigNumber(fp, &HomeConfigNP);
+	IUSaveConfigNumber(fp, &SpiClockNP);
+	IUSaveConfigNumber(fp, &RealtimeNP);
+	IUSaveConfigSwitch(fp, &RealtimeSP);
+	IUSaveConfigText(fp, &MetricsTP);
+	IUSaveConfigNumber(fp, &AutofocusNP);
+	IUSaveConfigSwitch(fp, &AutofocusDirSP);
+	IUSaveConfigText(fp, &AutofocusSnoopTP);
+	IUSaveConfigSwitch(fp, &DeferSP);
+	IUSaveConfigText(fp, &DeferTP);
+	IUSaveConfigNumber(fp, &DeferNP);
+	IUSaveConfigSwitch(fp, &FilterOffsetSP);
+	IUSaveConfigText(fp, &FilterWheelTP);
+	IUSaveConfigNumber(fp, &FilterOffsetNP);
+	IUSaveConfigSwitch(fp, &TempCompSP);
+	IUSaveConfigText(fp, &TempSourceTP);
+	IUSaveConfigNumber(fp, &TempCompNP);
 
 	if ( FocusParkingS[0].s == ISS_ON )
 		IUSaveConfigNumber(fp, &FocusAbsPosNP);
@@ -425,18 +844,33 @@ IPState IndiPiFaceFocuser1::MoveFocuser(FocusDirection direction, int speed, int
 
 IPState IndiPiFaceFocuser1::MoveRelFocuser(FocusDirection direction, int ticks)
 {
-	int targetTicks = FocusAbsPosN[0].value + (ticks * (direction == FOCUS_INWARD ? -1 : 1));
+	// relative to where running and queued moves end
+	int targetTicks = PlannedTarget() + (ticks * (direction == FOCUS_INWARD ? -1 : 1));
 	return MoveAbsFocuser(targetTicks);
 }
 
 IPState IndiPiFaceFocuser1::MoveAbsFocuser(int targetTicks)
 {
+	// homing owns the motor until it finishes
+	if (home_phase != HOME_IDLE)
+	{
+		IDMessage(getDeviceName(), "PiFace Focuser 1 is homing.");
+		return IPS_ALERT;
+	}
+
     if (targetTicks < FocusAbsPosN[0].min || targetTicks > FocusAbsPosN[0].max)
     {
         IDMessage(getDeviceName(), "Requested position is out of range.");
         return IPS_ALERT;
     }
 
+	// a running move finishes first, the latest target waits for it
+	if (motion_active)
+	{
+		motion_next = targetTicks;
+		return IPS_BUSY;
+	}
+
     if (targetTicks == FocusAbsPosN[0].value)
     {
         // IDMessage(getDeviceName(), "PiFace Focuser 1 already in the requested position.");
@@ -463,194 +897,1080 @@ IPState IndiPiFaceFocuser1::MoveAbsFocuser(int targetTicks)
     }
 
 	// if direction changed do backlash adjustment - TO DO
+	// the backlash is taken up by the first steps of the run
 	if ( lastdir != dir && FocusAbsPosN[0].value != 0 && FocusBacklashN[0].value != 0 )
-	{
 		IDMessage(getDeviceName() , "PiFace Focuser 1 backlash compensation by %0.0f steps...", FocusBacklashN[0].value);
-		StepperMotor(FocusBacklashN[0].value, dir);
-	}
 
 	// process targetTicks
 	int ticks = abs(targetTicks - FocusAbsPosN[0].value);
 
-	// GO
+	// GO, FinishMove completes the move
+	events.Record(PiFaceEventRing::EVENT_MOVE_START, 0, targetTicks);
 	StepperMotor(ticks, dir);
 
-	// update abspos value and status
-	IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 1 moved to position %0.0f", FocusAbsPosN[0].value );
-	FocusAbsPosNP.s = IPS_OK;
-	IDSetNumber(&FocusAbsPosNP, NULL);
-
-    return IPS_OK;
+    return IPS_BUSY;
 }
 
 int IndiPiFaceFocuser1::StepperMotor(int steps, FocusDirection direction)
 {
-    int step_states[8];
-    int value;
-    int payload = 0x00;
+	// steps run on the motion thread, the event loop stays free and
+	// publishes the position from a timer until MotionDone
+	motion_start = FocusAbsPosN[0].value;
+	motion_dir = direction;
+	motion_steps = steps;
+	motion_period = (long long) (MotorDelayN[0].value * 1000000);
+	motion_done = 0;
+	motion_abort = false;
+	motion_active = true;
+	motion_begin = MonotonicNs();
+	motion_timer = IEAddTimer(MOTION_PUBLISH_MS, MotionTimer, this);
+
+	// busy until FinishMove, whichever request started the move
+	FocusAbsPosNP.s = IPS_BUSY;
+	IDSetNumber(&FocusAbsPosNP, NULL);
 
-	if(direction == FOCUS_OUTWARD)
-	{
-		if ( MotorDirS[1].s == ISS_ON )
-		{
-			//clockwise out
-			int step_states[8] = {0xa, 0x2, 0x6, 0x4, 0x5, 0x1, 0x9, 0x8};
-		}
-		else
-		{
-			//clockwise in
-			int step_states[8] = {0x8, 0x9, 0x1, 0x5, 0x4, 0x6, 0x2, 0xa};
-		}
-	}
-	else
+	realtime.Start(MotionJob, this);
+
+	return 0;
+}
+void IndiPiFaceFocuser1::MotionJob(void *p)
+{
+	IndiPiFaceFocuser1 *focuser = static_cast<IndiPiFaceFocuser1 *>(p);
+	long long late = 0;
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	// an abort stops the run at the next step
+	for (int i = 0; i < focuser->motion_steps && !focuser->motion_abort; i++)
 	{
-		if ( MotorDirS[1].s == ISS_ON )
-		{
-			//clockwise in
-			int step_states[8] = {0x8, 0x9, 0x1, 0x5, 0x4, 0x6, 0x2, 0xa};
-		}
-		else
-		{
-			//clockwise out
-			int step_states[8] = {0xa, 0x2, 0x6, 0x4, 0x5, 0x1, 0x9, 0x8};
-		}
+		focuser->Coils(focuser->motion_dir);
+		focuser->motion_done = i + 1;
+
+		// steps keep their period, a late wakeup does not push the next one
+		long long over = SleepUntil(&deadline, focuser->motion_period);
+		if (over > late)
+			late = over;
 	}
 
-    for (int i = 0; i < steps; i++)
-    {
-	// update position for a client
-
-        if ( dir == FOCUS_INWARD )
-        	FocusAbsPosN[0].value -= 1;
-        if ( dir == FOCUS_OUTWARD )
-        	FocusAbsPosN[0].value += 1;
-        IDSetNumber(&FocusAbsPosNP, NULL);
-
-		if(step_index == (sizeof(step_states)/sizeof(int)))
-			step_index = 0;
-		value = step_states[step_index];
-		step_index++;
-
-		// GPIOB lower nibble, polarity reversed
-		payload = payload & 0xf0;
-		payload = payload | ((value & 0xf) ^ 0xf);
-
-		// make step
-		mcp23s17_write_reg(payload, GPIOB, 0, mcp23s17_fd);
-		usleep(MotorDelayN[0].value * 1000);
-		}
+	focuser->last_move_late_ns = late;
+}
+void IndiPiFaceFocuser1::MotionTimer(void *p)
+{
+	IndiPiFaceFocuser1 *focuser = static_cast<IndiPiFaceFocuser1 *>(p);
+	focuser->motion_timer = -1;
+	if (!focuser->motion_active)
+		return;
 
-		// Coast motors
-		mcp23s17_write_reg(0x00, GPIOB, 0, mcp23s17_fd);
+	int sign = focuser->motion_dir == FOCUS_INWARD ? -1 : 1;
+	focuser->FocusAbsPosN[0].value = focuser->motion_start + sign * focuser->motion_done;
+	IDSetNumber(&focuser->FocusAbsPosNP, NULL);
+	focuser->motion_timer = IEAddTimer(MOTION_PUBLISH_MS, MotionTimer, focuser);
+}
+void IndiPiFaceFocuser1::MotionDone(int fd, void *p)
+{
+	INDI_UNUSED(fd);
+	IndiPiFaceFocuser1 *focuser = static_cast<IndiPiFaceFocuser1 *>(p);
 
-		return 0;
+	// the thread signals after the last step
+	if (focuser->realtime.Done() && focuser->motion_active && focuser->realtime.Wait(0))
+		focuser->FinishMove();
 }
-bool IndiPiFaceFocuser1::AbortFocuser()
+void IndiPiFaceFocuser1::FinishMove()
 {
-	IDMessage(getDeviceName() , "PiFace Focuser 1 aborted");
+	if (motion_timer != -1)
+		IERmTimer(motion_timer);
+	motion_timer = -1;
+	motion_active = false;
+
+	int done = motion_done;
+	int sign = motion_dir == FOCUS_INWARD ? -1 : 1;
+	FocusAbsPosN[0].value = motion_start + sign * done;
+
+	// Coast motors
+	bus.WriteBits(0x00, 0x0f, GPIOB, 0);
+
+	events.Record(PiFaceEventRing::EVENT_STEP_BATCH, motion_dir, done);
+	last_move_ns = MonotonicNs() - motion_begin;
+	last_move_steps = done;
+	move_ns_total += last_move_ns;
+	move_count++;
+	events.Record(PiFaceEventRing::EVENT_MOVE_END, 0, FocusAbsPosN[0].value);
+
+	// parked position is part of the config
+	if ( FocusParkingS[0].s == ISS_ON )
+		persist.MarkDirty();
 
-	// Brake
-	mcp23s17_write_reg(0xff, GPIOB, 0, mcp23s17_fd);
+	if (metrics.IsStarted())
+		UpdateMetrics();
 
-	// Cost
-	mcp23s17_write_reg(0x00, GPIOB, 0, mcp23s17_fd);
+	if (motion_abort)
+	{
+		FocusAbsPosNP.s = IPS_IDLE;
+		IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 1 stopped at position %0.0f", FocusAbsPosN[0].value);
+		return;
+	}
 
-	return true;
-}
+	// chained or newer target
+	if (motion_next != -1)
+	{
+		int next = motion_next;
+		motion_next = -1;
+		IPState state = MoveAbsFocuser(next);
+		if (state == IPS_BUSY)
+			return;
+		if (state == IPS_ALERT)
+		{
+			tempcomp.Dequeue();
+			FocusAbsPosNP.s = IPS_ALERT;
+			IDSetNumber(&FocusAbsPosNP, NULL);
+			return;
+		}
+	}
 
-/************************************************************************************
-*
-*               Seconf Focuser (IndiPiFaceFocuser2)
-*
-*************************************************************************************/
+	// compensation counts once the focuser is there, unless part of it
+	// still waits for the readout
+	if (deferred_target == -1)
+		tempcomp.Applied(tempcomp.Dequeue());
 
-IndiPiFaceFocuser2::IndiPiFaceFocuser2()
+	FocusAbsPosNP.s = IPS_OK;
+	IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 1 moved to position %0.0f", FocusAbsPosN[0].value);
+}
+void IndiPiFaceFocuser1::StopMove()
 {
-	setVersion(MAJOR_VERSION,MINOR_VERSION);
-	setFocuserConnection(CONNECTION_NONE);
+	// queued targets are dropped, their compensation is pending again
+	motion_next = -1;
+	tempcomp.Dequeue();
+	if (motion_active)
+		motion_abort = true;
 }
-
-IndiPiFaceFocuser2::~IndiPiFaceFocuser2()
+void IndiPiFaceFocuser1::WaitMove()
 {
-
+	// disconnect only, the bus closes after the last step
+	while (motion_active)
+	{
+		while (!realtime.Wait(MOTION_PUBLISH_MS))
+			;
+		realtime.Done();
+		FinishMove();
+	}
 }
-
-const char * IndiPiFaceFocuser2::getDefaultName()
+int IndiPiFaceFocuser1::PlannedTarget()
 {
-	return FOCUSNAMEF2;
+	// where the focuser ends once deferred, queued and running moves are done
+	if (deferred_target != -1)
+		return deferred_target;
+	if (motion_next != -1)
+		return motion_next;
+	if (motion_active)
+		return motion_start + (motion_dir == FOCUS_INWARD ? -motion_steps : motion_steps);
+	return (int) FocusAbsPosN[0].value;
 }
+void IndiPiFaceFocuser1::Step(FocusDirection direction)
+{
+	Coils(direction);
 
-bool IndiPiFaceFocuser2::Connect()
+	if ( direction == FOCUS_INWARD )
+		FocusAbsPosN[0].value -= 1;
+	else
+		FocusAbsPosN[0].value += 1;
+}
+unsigned long IndiPiFaceFocuser1::SpiReads()
 {
-	// open device
-	mcp23s17_fd = mcp23s17_open(0,0);
+	return bus.Reads();
+}
+unsigned long IndiPiFaceFocuser1::SpiWrites()
+{
+	return bus.Writes();
+}
+void IndiPiFaceFocuser1::Coils(FocusDirection direction)
+{
+	// reversed motor walks the sequence the other way
+	bool forward = (direction == FOCUS_OUTWARD) == (MotorDirS[1].s == ISS_ON);
+	step_index = (step_index + (forward ? 1 : 7)) % 8;
+	step_count++;
+	int value = step_sequence[step_index];
+
+	// GPIOB lower nibble, polarity reversed
+	bus.WriteBits((value & 0xf) ^ 0xf, 0x0f, GPIOB, 0);
+}
+bool IndiPiFaceFocuser1::HomeFocuser()
+{
+	if (home_phase != HOME_IDLE)
+		return true;
 
-	if(mcp23s17_fd == -1)
+	// a running move owns the motor
+	if (motion_active)
 	{
-		IDMessage(getDeviceName(), "PiFace Focuser 2 device is not available.");
+		IDMessage(getDeviceName(), "PiFace Focuser 1 is moving.");
 		return false;
 	}
 
-	// config register
-	const uint8_t ioconfig = BANK_OFF | \
-                             INT_MIRROR_OFF | \
-                             SEQOP_OFF | \
-                             DISSLW_OFF | \
-                             HAEN_ON | \
-                             ODR_OFF | \
-                             INTPOL_LOW;
-	mcp23s17_write_reg(ioconfig, IOCON, 0, mcp23s17_fd);
+	home_limit = 1 << (INPUT_SHIFT + (int) HomeConfigN[0].value - 1);
 
-	// I/O direction
-	mcp23s17_write_reg(0x00, IODIRA, 0, mcp23s17_fd);
+	// limit switch on interrupt, polled when the line is owned by another driver
+	if (!inputs.Start(&bus, INPUT_CHIP, INPUT_PORT, home_limit, NULL, NULL))
+		IDMessage(getDeviceName(), "PiFace Focuser 1 interrupt line busy, polling limit switch.");
 
-	// pull ups
-	mcp23s17_write_reg(0x00, GPPUA, 0, mcp23s17_fd);
+	FocusAbsPosNP.s = IPS_BUSY;
+	IDSetNumber(&FocusAbsPosNP, NULL);
 
-	IDMessage(getDeviceName(), "PiFace Focuser 2 connected successfully.");
+	// leave the switch if already on it, then fast approach
+	HomePhase(LimitActive() ? HOME_LEAVE : HOME_FAST);
+	home_timer = IEAddTimer(0, HomeTimer, this);
 	return true;
 }
+void IndiPiFaceFocuser1::HomePhase(int phase)
+{
+	int backoff = (int) HomeConfigN[3].value;
 
-bool IndiPiFaceFocuser2::Disconnect()
+	home_phase = phase;
+	switch (phase)
+	{
+		case HOME_FAST:
+			home_left = MAX_STEPS + MAX_STEPS / 10;
+			break;
+		case HOME_BACKOFF:
+			home_left = backoff;
+			break;
+		case HOME_SLOW:
+			home_left = backoff * 2;
+			break;
+		default:
+			home_left = backoff * 4;
+			break;
+	}
+}
+void IndiPiFaceFocuser1::HomeTimer(void *p)
 {
-	// park focuser
-	if ( FocusParkingS[0].s == ISS_ON )
+	IndiPiFaceFocuser1 *focuser = static_cast<IndiPiFaceFocuser1 *>(p);
+	focuser->home_timer = -1;
+	focuser->HomeTick();
+}
+void IndiPiFaceFocuser1::HomeTick()
+{
+	// level after the previous step, the interrupt callback runs between ticks
+	bool active = LimitActive();
+	switch (home_phase)
 	{
-		IDMessage(getDeviceName(), "PiFace Focuser 2 is parking...");
-		MoveAbsFocuser(FocusAbsPosN[0].min);
+		case HOME_LEAVE:
+			if (!active)
+				HomePhase(HOME_FAST);
+			break;
+		case HOME_FAST:
+			// release the switch and back off, then slow approach for a repeatable edge
+			if (active)
+				HomePhase(HOME_RELEASE);
+			break;
+		case HOME_RELEASE:
+			if (!active)
+				HomePhase(HOME_BACKOFF);
+			break;
+		case HOME_BACKOFF:
+			if (home_left == 0)
+				HomePhase(HOME_SLOW);
+			break;
+		case HOME_SLOW:
+			if (active)
+			{
+				FinishHome(NULL);
+				return;
+			}
+			break;
 	}
 
-	// close device
-	close(mcp23s17_fd);
+	if (home_left <= 0)
+	{
+		FinishHome("limit switch not found");
+		return;
+	}
 
-	IDMessage(getDeviceName(), "PiFace Focuser 2 disconnected successfully.");
-	return true;
-}
+	// one step per tick, the event loop keeps running between steps
+	bool inward = home_phase == HOME_FAST || home_phase == HOME_SLOW;
+	Step(inward ? FOCUS_INWARD : FOCUS_OUTWARD);
+	home_left--;
+	IDSetNumber(&FocusAbsPosNP, NULL);
 
-bool IndiPiFaceFocuser2::initProperties()
+	int delay = (int) HomeConfigN[home_phase == HOME_FAST ? 1 : 2].value;
+	home_timer = IEAddTimer(delay, HomeTimer, this);
+}
+void IndiPiFaceFocuser1::FinishHome(const char *failure)
 {
-    INDI::Focuser::initProperties();
-
-	// options tab
-	IUFillNumber(&MotorDelayN[0],"MOTOR_DELAY","milliseconds","%0.0f",1,100,1,2);
-	IUFillNumberVector(&MotorDelayNP,MotorDelayN,1,getDeviceName(),"MOTOR_CONFIG","Step Delay",OPTIONS_TAB,IP_RW,0,IPS_OK);
+	if (home_timer != -1)
+		IERmTimer(home_timer);
+	home_timer = -1;
+	home_phase = HOME_IDLE;
 
-	IUFillSwitch(&MotorDirS[0],"FORWARD","Normal",ISS_ON);
-	IUFillSwitch(&MotorDirS[1],"REVERSE","Reverse",ISS_OFF);
-	IUFillSwitchVector(&MotorDirSP,MotorDirS,2,getDeviceName(),"MOTOR_DIR","Motor Dir",OPTIONS_TAB,IP_RW,ISR_1OFMANY,60,IPS_OK);
-
-	IUFillNumber(&FocusBacklashN[0], "FOCUS_BACKLASH_VALUE", "Steps", "%0.0f", 0, 100, 1, 0);
-	IUFillNumberVector(&FocusBacklashNP, FocusBacklashN, 1, getDeviceName(), "FOCUS_BACKLASH", "Backlash", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+	// Coast motor
+	bus.WriteBits(0x00, 0x0f, GPIOB, 0);
+	inputs.Stop();
 
-	IUFillSwitch(&FocusParkingS[0],"FOCUS_PARKON","Enable",ISS_ON);
-	IUFillSwitch(&FocusParkingS[1],"FOCUS_PARKOFF","Disable",ISS_OFF);
-	IUFillSwitchVector(&FocusParkingSP,FocusParkingS,2,getDeviceName(),"FOCUS_PARK","Parking",OPTIONS_TAB,IP_RW,ISR_1OFMANY,60,IPS_OK);
+	if (failure != NULL)
+	{
+		FocusAbsPosNP.s = IPS_ALERT;
+		IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 1 %s", failure);
+		FocusHomeSP.s = IPS_ALERT;
+		IDSetSwitch(&FocusHomeSP, NULL);
+		return;
+	}
 
-	IUFillSwitch(&FocusResetS[0],"FOCUS_RESET","Reset",ISS_OFF);
-	IUFillSwitchVector(&FocusResetSP,FocusResetS,1,getDeviceName(),"FOCUS_RESET","Position Reset",OPTIONS_TAB,IP_RW,ISR_1OFMANY,60,IPS_OK);
+	events.Record(PiFaceEventRing::EVENT_HOME, 0, FocusAbsPosN[0].value);
 
-	// main tab
-	IUFillSwitch(&FocusMotionS[0],"FOCUS_INWARD","Focus In",ISS_OFF);
+	// absolute zero at the switch
+	dir = FOCUS_INWARD;
+	FocusAbsPosN[0].value = 0;
+	FocusAbsPosNP.s = IPS_OK;
+	IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 1 homed");
+	FocusHomeSP.s = IPS_OK;
+	IDSetSwitch(&FocusHomeSP, NULL);
+}
+bool IndiPiFaceFocuser1::LimitActive()
+{
+	// switch is active low, INTCAP holds the level latched at the edge
+	uint8_t levels = inputs.IsStarted() ? inputs.Levels() : bus.ReadReg(GPIOA + INPUT_PORT, INPUT_CHIP);
+	return (levels & home_limit) == 0;
+}
+bool IndiPiFaceFocuser1::ISNewText (const char *dev, const char *name, char *texts[], char *names[], int n)
+{
+	// first we check if it's for our device
+	if(strcmp(dev,getDeviceName())==0)
+	{
+        // handle temperature source
+        if (!strcmp(name, TempSourceTP.name))
+        {
+            IUUpdateText(&TempSourceTP,texts,names,n);
+            if (TempCompS[0].s == ISS_ON)
+                IDSnoopDevice(TempSourceT[0].text, TempSourceT[1].text);
+            TempSourceTP.s = IPS_OK;
+            IDSetText(&TempSourceTP, NULL);
+            return true;
+        }
+
+        // handle filter wheel device
+        if (!strcmp(name, FilterWheelTP.name))
+        {
+            IUUpdateText(&FilterWheelTP,texts,names,n);
+            filter_slot = 0;
+            if (FilterOffsetS[0].s == ISS_ON)
+                IDSnoopDevice(FilterWheelT[0].text, "FILTER_SLOT");
+            FilterWheelTP.s = IPS_OK;
+            IDSetText(&FilterWheelTP, NULL);
+            return true;
+        }
+
+        // handle exposing camera
+        if (!strcmp(name, DeferTP.name))
+        {
+            IUUpdateText(&DeferTP,texts,names,n);
+            exposing = false;
+            if (DeferS[0].s == ISS_ON || TempCompS[0].s == ISS_ON)
+                IDSnoopDevice(DeferT[0].text, "CCD_EXPOSURE");
+            DeferTP.s = IPS_OK;
+            IDSetText(&DeferTP, NULL);
+            return true;
+        }
+
+        // handle autofocus hfr source
+        if (!strcmp(name, AutofocusSnoopTP.name))
+        {
+            IUUpdateText(&AutofocusSnoopTP,texts,names,n);
+            IDSnoopDevice(AutofocusSnoopT[0].text, AutofocusSnoopT[1].text);
+            AutofocusSnoopTP.s = IPS_OK;
+            IDSetText(&AutofocusSnoopTP, NULL);
+            return true;
+        }
+
+        // handle metrics endpoint
+        if (!strcmp(name, MetricsTP.name))
+        {
+            IUUpdateText(&MetricsTP,texts,names,n);
+            if (isConnected())
+                StartMetrics();
+            else
+                IDSetText(&MetricsTP, NULL);
+            return true;
+        }
+	}
+	return INDI::Focuser::ISNewText(dev,name,texts,names,n);
+}
+bool IndiPiFaceFocuser1::ISSnoopDevice (XMLEle *root)
+{
+	double value;
+
+	// exposure ended, queued move runs in the readout gap
+	if (PiFaceSnoop::Match(root, DeferT[0].text, "CCD_EXPOSURE"))
+	{
+		bool ended = exposing && PiFaceSnoop::State(root) != IPS_BUSY;
+		exposing = PiFaceSnoop::State(root) == IPS_BUSY;
+		if (ended && deferred_target != -1)
+			RunDeferred();
+	}
+
+	// filter wheel slot, INDI wheels publish the requested slot only once
+	// they are there, so the offset move follows the wheel
+	if (PiFaceSnoop::Match(root, FilterWheelT[0].text, "FILTER_SLOT") && PiFaceSnoop::State(root) != IPS_ALERT &&
+		PiFaceSnoop::Number(root, "FILTER_SLOT_VALUE", &value))
+		FilterChanged((int) value);
+
+	// temperature source, corrections are batched behind the hysteresis
+	if (PiFaceSnoop::Match(root, TempSourceT[0].text, TempSourceT[1].text) && PiFaceSnoop::State(root) != IPS_ALERT &&
+		PiFaceSnoop::Number(root, TempSourceT[2].text, &value))
+		TemperatureChanged(value);
+
+	// only completed measurements of the autofocus source
+	if (autofocus.Running() && autofocus_timer != -1 && !motion_active && !strcmp(tagXMLEle(root), "setNumberVector") &&
+		PiFaceSnoop::Match(root, AutofocusSnoopT[0].text, AutofocusSnoopT[1].text) &&
+		PiFaceSnoop::State(root) != IPS_BUSY && PiFaceSnoop::State(root) != IPS_ALERT &&
+		PiFaceSnoop::Number(root, AutofocusSnoopT[2].text, &value))
+	{
+		// frames exposed while the motor moved are dropped, frames during
+		// the move are not even counted
+		if (autofocus_skip > 0)
+		{
+			autofocus_skip--;
+		}
+		else
+		{
+			IERmTimer(autofocus_timer);
+			autofocus_timer = -1;
+			autofocus.Sample(value);
+
+			if (autofocus.Done())
+				FinishAutofocus();
+			else
+				NextAutofocus();
+		}
+	}
+
+	return INDI::Focuser::ISSnoopDevice(root);
+}
+void IndiPiFaceFocuser1::StartAutofocus()
+{
+	int direction = AutofocusDirS[0].s == ISS_ON ? 1 : -1;
+	autofocus_start = (int) FocusAbsPosN[0].value;
+
+	if (!autofocus.Start(autofocus_start, (int) AutofocusN[0].value, (int) AutofocusN[1].value, direction,
+		(int) AutofocusN[2].value, (int) FocusAbsPosN[0].min, (int) FocusAbsPosN[0].max))
+	{
+		AutofocusSP.s = IPS_ALERT;
+		IDMessage(getDeviceName(), "PiFace Focuser 1 autofocus sweep does not fit the focuser travel.");
+		return;
+	}
+
+	IDSnoopDevice(AutofocusSnoopT[0].text, AutofocusSnoopT[1].text);
+	events.Record(PiFaceEventRing::EVENT_AUTOFOCUS, 0, autofocus_start);
+	IDMessage(getDeviceName(), "PiFace Focuser 1 autofocus sweep of %d positions started.", autofocus.Count());
+
+	AutofocusSP.s = IPS_BUSY;
+	AutofocusResultNP.s = IPS_BUSY;
+
+	// take up the backlash once, every sample is then reached the same way
+	int first = autofocus.Target();
+	MoveAbsFocuser(autofocus.Approach(autofocus_start, first));
+	NextAutofocus();
+}
+void IndiPiFaceFocuser1::NextAutofocus()
+{
+	MoveAbsFocuser(autofocus.Target());
+
+	AutofocusResultN[0].value = autofocus.Taken() + 1;
+	IDSetNumber(&AutofocusResultNP, NULL);
+
+	// wait for a fresh measurement at this position
+	autofocus_skip = (int) AutofocusN[3].value;
+	autofocus_timer = IEAddTimer((int) AutofocusN[4].value * 1000, AutofocusTimeout, this);
+}
+void IndiPiFaceFocuser1::FinishAutofocus()
+{
+	int best;
+	double value, minimum;
+
+	autofocus.Stop();
+
+	if (!autofocus.Fit(&best, &value, &minimum))
+	{
+		AbortAutofocus("too few valid samples", true);
+		return;
+	}
+
+	MoveApproach(best);
+	events.Record(PiFaceEventRing::EVENT_AUTOFOCUS, 1, best);
+	tempcomp.Reset();
+
+	AutofocusResultN[1].value = best;
+	AutofocusResultN[2].value = value;
+	AutofocusResultN[3].value = minimum;
+	AutofocusResultNP.s = IPS_OK;
+	IDSetNumber(&AutofocusResultNP, "PiFace Focuser 1 autofocus best position %d, HFR %0.2f", best, value);
+	AutofocusSP.s = IPS_OK;
+	IDSetSwitch(&AutofocusSP, NULL);
+}
+void IndiPiFaceFocuser1::AbortAutofocus(const char *reason, bool restore)
+{
+	if (autofocus_timer != -1)
+		IERmTimer(autofocus_timer);
+	autofocus_timer = -1;
+	autofocus.Stop();
+
+	// back where the sweep started
+	if (restore)
+		MoveApproach(autofocus_start);
+
+	events.Record(PiFaceEventRing::EVENT_AUTOFOCUS, 2, (int) FocusAbsPosN[0].value);
+	AutofocusResultNP.s = IPS_ALERT;
+	IDSetNumber(&AutofocusResultNP, "PiFace Focuser 1 autofocus %s", reason);
+	AutofocusSP.s = IPS_ALERT;
+	IDSetSwitch(&AutofocusSP, NULL);
+}
+void IndiPiFaceFocuser1::MoveApproach(int position)
+{
+	int from = (int) FocusAbsPosN[0].value;
+	int via = autofocus.Approach(from, position);
+
+	// final position is reached in the sweep direction
+	if (via != position && from != position)
+		MoveAbsFocuser(via);
+	MoveAbsFocuser(position);
+}
+void IndiPiFaceFocuser1::AutofocusTimeout(void *p)
+{
+	IndiPiFaceFocuser1 *focuser = static_cast<IndiPiFaceFocuser1 *>(p);
+	focuser->autofocus_timer = -1;
+	focuser->AbortAutofocus("timed out waiting for HFR", true);
+}
+bool IndiPiFaceFocuser1::DeferMove(int target, bool always)
+{
+	if ((DeferS[0].s != ISS_ON && !always) || !exposing)
+		return false;
+
+	// target is resolved now, the readout gap only runs the steps
+	if (target < FocusAbsPosN[0].min)
+		target = FocusAbsPosN[0].min;
+	if (target > FocusAbsPosN[0].max)
+		target = FocusAbsPosN[0].max;
+
+	// latest request wins
+	deferred_target = target;
+	if (defer_timer == -1)
+		defer_timer = IEAddTimer((int) DeferN[0].value * 1000, DeferTimeout, this);
+
+	FocusAbsPosNP.s = IPS_BUSY;
+	IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 1 move to %d deferred until camera readout", target);
+	return true;
+}
+void IndiPiFaceFocuser1::RunDeferred()
+{
+	int target = deferred_target;
+	CancelDeferred();
+
+	// compensation in the move stays queued until FinishMove
+	IPState state = MoveAbsFocuser(target);
+	if (state == IPS_OK)
+	{
+		tempcomp.Applied(tempcomp.Dequeue());
+		FocusAbsPosNP.s = IPS_OK;
+		IDSetNumber(&FocusAbsPosNP, NULL);
+	}
+	else if (state == IPS_ALERT)
+	{
+		tempcomp.Dequeue();
+	}
+}
+void IndiPiFaceFocuser1::CancelDeferred()
+{
+	if (defer_timer != -1)
+		IERmTimer(defer_timer);
+	defer_timer = -1;
+	deferred_target = -1;
+}
+void IndiPiFaceFocuser1::DeferTimeout(void *p)
+{
+	IndiPiFaceFocuser1 *focuser = static_cast<IndiPiFaceFocuser1 *>(p);
+
+	// camera went quiet, do not hold the move forever
+	focuser->defer_timer = -1;
+	IDMessage(focuser->getDeviceName(), "PiFace Focuser 1 camera exposure did not end, moving now.");
+	focuser->RunDeferred();
+}
+void IndiPiFaceFocuser1::FilterChanged(int slot)
+{
+	if (slot < 1 || slot > MAX_FILTERS || slot == filter_slot)
+		return;
+
+	// first report only tells where the wheel is
+	int previous = filter_slot;
+	filter_slot = slot;
+	if (previous == 0 || FilterOffsetS[0].s != ISS_ON)
+		return;
+
+	// a sweep owns the motor until it ends
+	if (autofocus.Running())
+		return;
+
+	int delta = (int) (FilterOffsetN[slot - 1].value - FilterOffsetN[previous - 1].value);
+	if (delta == 0)
+		return;
+
+	// runs after the wheel, unless the camera is exposing, on top of a
+	// move still waiting or running
+	int base = PlannedTarget();
+	int target = base + delta;
+	IDMessage(getDeviceName(), "PiFace Focuser 1 filter %d offset %+d steps", slot, delta);
+	if (!DeferMove(target) && MoveAbsFocuser(target) == IPS_OK)
+	{
+		FocusAbsPosNP.s = IPS_OK;
+		IDSetNumber(&FocusAbsPosNP, NULL);
+	}
+}
+void IndiPiFaceFocuser1::TemperatureChanged(double celsius)
+{
+	int steps = tempcomp.Update(celsius);
+
+	// a sweep owns the motor until it ends
+	if (steps != 0 && TempCompS[0].s == ISS_ON && !autofocus.Running())
+	{
+		// on top of a move still waiting or running
+		int base = PlannedTarget();
+		IDMessage(getDeviceName(), "PiFace Focuser 1 temperature %0.1f C, compensating %+d steps", celsius, steps);
+
+		// never during an exposure of the watched camera, steps count once moved
+		if (DeferMove(base + steps, true))
+		{
+			tempcomp.Queued(deferred_target - base);
+		}
+		else
+		{
+			IPState state = MoveAbsFocuser(base + steps);
+			if (state == IPS_BUSY)
+			{
+				tempcomp.Queued(steps);
+			}
+			else if (state == IPS_OK)
+			{
+				tempcomp.Applied(steps);
+				FocusAbsPosNP.s = IPS_OK;
+				IDSetNumber(&FocusAbsPosNP, NULL);
+			}
+		}
+	}
+
+	PublishTempComp();
+}
+void IndiPiFaceFocuser1::PublishTempComp()
+{
+	TempStatusN[0].value = tempcomp.Temperature();
+	TempStatusN[1].value = tempcomp.Reference();
+	TempStatusN[2].value = tempcomp.Pending();
+	TempStatusNP.s = tempcomp.Valid() && TempCompS[0].s == ISS_ON ? IPS_OK : IPS_IDLE;
+	IDSetNumber(&TempStatusNP, NULL);
+}
+bool IndiPiFaceFocuser1::WriteConfig(FILE *fp, void *p)
+{
+	IndiPiFaceFocuser1 *focuser = static_cast<IndiPiFaceFocuser1 *>(p);
+
+	IUSaveConfigTag(fp, 0, focuser->getDeviceName(), 1);
+	focuser->saveConfigItems(fp);
+	IUSaveConfigTag(fp, 1, focuser->getDeviceName(), 1);
+
+	return true;
+}
+bool IndiPiFaceFocuser1::saveConfig(bool silent, const char *property)
+{
+	if (!persist.IsOpen())
+		return INDI::Focuser::saveConfig(silent, property);
+
+	// full saves use the atomic writer, single properties wait for it
+	bool rc = persist.Sync();
+	if (property != NULL)
+		return INDI::Focuser::saveConfig(silent, property);
+
+	if (!rc)
+	{
+		IDMessage(getDeviceName(), "PiFace Focuser 1 could not save configuration to %s.", persist.Path());
+		return false;
+	}
+	IUSaveDefaultConfig(NULL, NULL, getDeviceName());
+
+	if (!silent)
+		IDMessage(getDeviceName(), "PiFace Focuser 1 configuration saved.");
+	return true;
+}
+void IndiPiFaceFocuser1::ApplyRealtime()
+{
+	// the thread is restarted, never under a running move
+	if (motion_active)
+	{
+		RealtimeNP.s = RealtimeSP.s = IPS_ALERT;
+		IDSetNumber(&RealtimeNP, NULL);
+		IDSetSwitch(&RealtimeSP, "PiFace Focuser 1 real time settings apply when the motor is idle.");
+		return;
+	}
+
+	int effective = realtime.Configure((int) RealtimeN[0].value, (int) RealtimeN[1].value,
+		RealtimeS[0].s == ISS_ON, RealtimeS[1].s == ISS_ON, this, sizeof(*this));
+	int requested = realtime.Requested();
+
+	RealtimeNP.s = RealtimeSP.s = IPS_OK;
+	IDSetNumber(&RealtimeNP, NULL);
+	IDSetSwitch(&RealtimeSP, NULL);
+
+	// settings without privileges are dropped, not fatal
+	IUSaveText(&RealtimeStatusT[0], realtime.Status());
+	RealtimeStatusTP.s = effective == requested ? IPS_OK : IPS_ALERT;
+	if (effective != requested)
+		IDSetText(&RealtimeStatusTP, "PiFace Focuser 1 real time settings partly denied: %s", realtime.Status());
+	else
+		IDSetText(&RealtimeStatusTP, NULL);
+}
+void IndiPiFaceFocuser1::StartMetrics()
+{
+	metrics.Stop();
+	MetricsTP.s = IPS_IDLE;
+
+	if (MetricsT[0].text != NULL && MetricsT[0].text[0] != 0)
+	{
+		if (metrics.Start(MetricsT[0].text, getDeviceName()))
+		{
+			UpdateMetrics();
+			MetricsTP.s = IPS_OK;
+		}
+		else
+		{
+			MetricsTP.s = IPS_ALERT;
+			IDMessage(getDeviceName(), "PiFace Focuser 1 metrics endpoint %s is not available.", MetricsT[0].text);
+		}
+	}
+
+	IDSetText(&MetricsTP, NULL);
+}
+void IndiPiFaceFocuser1::UpdateMetrics()
+{
+	metrics.Begin();
+	metrics.Counter("piface_spi_reads_total", "SPI register reads", bus.Reads());
+	metrics.Counter("piface_spi_writes_total", "SPI register writes", bus.Writes());
+	metrics.Counter("piface_focuser_steps_total", "Motor half steps", step_count);
+	metrics.Counter("piface_focuser_moves_total", "Completed moves", move_count);
+	metrics.Counter("piface_focuser_move_seconds_total", "Time spent moving", move_ns_total / 1e9);
+	metrics.Gauge("piface_focuser_last_move_seconds", "Duration of the last move", last_move_ns / 1e9);
+	metrics.Gauge("piface_focuser_step_rate", "Steps per second of the last move", last_move_ns > 0 ? last_move_steps * 1e9 / last_move_ns : 0);
+	metrics.Gauge("piface_focuser_step_late_max_seconds", "Worst step wakeup delay of the last move", last_move_late_ns / 1e9);
+	metrics.Gauge("piface_focuser_position", "Absolute focuser position", FocusAbsPosN[0].value);
+	metrics.Commit();
+}
+void IndiPiFaceFocuser1::ExportEvents(int format)
+{
+	int size = 0;
+	char *buffer = events.Export(format, &size);
+	if (buffer == NULL)
+	{
+		EventLogBP.s = IPS_ALERT;
+		IDSetBLOB(&EventLogBP, "PiFace Focuser 1 event export failed");
+		return;
+	}
+
+	EventLogB[0].blob = buffer;
+	EventLogB[0].bloblen = size;
+	EventLogB[0].size = size;
+	strcpy(EventLogB[0].format, format == PiFaceEventRing::EXPORT_CSV ? ".csv" : ".bin");
+	EventLogBP.s = IPS_OK;
+	IDSetBLOB(&EventLogBP, NULL);
+
+	EventLogB[0].blob = NULL;
+	free(buffer);
+}
+bool IndiPiFaceFocuser1::AbortFocuser()
+{
+	IDMessage(getDeviceName() , "PiFace Focuser 1 aborted");
+
+	// homing timer stops with the motor
+	if (home_phase != HOME_IDLE)
+		FinishHome("homing aborted");
+
+	// a sweep without its moves has nothing to measure
+	if (autofocus.Running())
+		AbortAutofocus("aborted", false);
+
+	// queued moves are dropped, a running one stops at the next step and
+	// FinishMove coasts the motor
+	CancelDeferred();
+	StopMove();
+	if (motion_active)
+		return true;
+
+	// Brake
+	bus.WriteBits(0xff, 0x0f, GPIOB, 0);
+
+	// Cost
+	bus.WriteBits(0x00, 0x0f, GPIOB, 0);
+
+	return true;
+}
+
+/************************************************************************************
+*
+*               Seconf Focuser (IndiPiFaceFocuser2)
+*
+*************************************************************************************/
+
+IndiPiFaceFocuser2::IndiPiFaceFocuser2()
+{
+	setVersion(MAJOR_VERSION,MINOR_VERSION);
+	step_count = 0;
+	move_count = 0;
+	move_ns_total = 0;
+	last_move_ns = 0;
+	last_move_steps = 0;
+	last_move_late_ns = 0;
+	autofocus_start = 0;
+	autofocus_skip = 0;
+	autofocus_timer = -1;
+	exposing = false;
+	deferred_target = -1;
+	defer_timer = -1;
+	filter_slot = 0;
+	home_phase = HOME_IDLE;
+	home_left = 0;
+	home_timer = -1;
+	home_limit = 0;
+	motion_done = 0;
+	motion_abort = false;
+	motion_active = false;
+	motion_start = 0;
+	motion_next = -1;
+	motion_timer = -1;
+	motion_cb = -1;
+	motion_begin = 0;
+	setFocuserConnection(CONNECTION_NONE);
+}
+
+IndiPiFaceFocuser2::~IndiPiFaceFocuser2()
+{
+
+}
+
+const char * IndiPiFaceFocuser2::getDefaultName()
+{
+	return FOCUSNAMEF2;
+}
+
+bool IndiPiFaceFocuser2::Connect()
+{
+	// open device
+	if(!bus.Open(0, 0, isSimulation(), (uint32_t) (SpiClockN[0].value * 1000000)))
+	{
+		IDMessage(getDeviceName(), "PiFace Focuser 2 device is not available.");
+		return false;
+	}
+
+	// config register, interrupt bits are left to input capture
+	const uint8_t ioconfig = BANK_OFF | \
+                             SEQOP_ON | \
+                             DISSLW_OFF | \
+                             HAEN_ON;
+	bus.WriteBits(ioconfig, IOCON_BUS_MASK, IOCON, 0);
+
+	// I/O direction, upper nibble only
+	bus.WriteBits(0x00, 0xf0, IODIRA, 0);
+
+	// pull ups
+	bus.WriteBits(0x00, 0xf0, GPPUA, 0);
+
+	// moves are completed on the event loop when the motion thread is done
+	if (realtime.DoneFd() == -1)
+	{
+		IDMessage(getDeviceName(), "PiFace Focuser 2 motion thread is not available.");
+		bus.Close();
+		return false;
+	}
+	motion_cb = IEAddCallback(realtime.DoneFd(), MotionDone, this);
+
+	// position is written on a debounce timer, not per move
+	if (!persist.Open(getDeviceName(), WriteConfig, this))
+		IDMessage(getDeviceName(), "PiFace Focuser 2 config persistence is not available.");
+
+	IDMessage(getDeviceName(), "PiFace Focuser 2 connected successfully.");
+	return true;
+}
+
+bool IndiPiFaceFocuser2::Disconnect()
+{
+	// no sweep without the motor
+	if (autofocus.Running())
+		AbortAutofocus("disconnected", false);
+
+	// queued move is dropped, a running one stops at the next step
+	CancelDeferred();
+	StopMove();
+	WaitMove();
+
+	// homing steps stop with the bus
+	if (home_phase != HOME_IDLE)
+		FinishHome("homing aborted");
+
+	// park focuser
+	if ( FocusParkingS[0].s == ISS_ON )
+	{
+		IDMessage(getDeviceName(), "PiFace Focuser 2 is parking...");
+		if (MoveAbsFocuser(FocusAbsPosN[0].min) == IPS_BUSY)
+			WaitMove();
+	}
+
+	if (motion_cb != -1)
+	{
+		IERmCallback(motion_cb);
+		motion_cb = -1;
+	}
+
+	// parked position and pending changes reach the card
+	persist.Close();
+
+	// stop metrics endpoint
+	metrics.Stop();
+
+	// back to normal scheduling
+	realtime.Release();
+
+	// close device
+	bus.Close();
+
+	IDMessage(getDeviceName(), "PiFace Focuser 2 disconnected successfully.");
+	return true;
+}
+
+bool IndiPiFaceFocuser2::initProperties()
+{
+    INDI::Focuser::initProperties();
+
+	// options tab
+	IUFillNumber(&MotorDelayN[0],"MOTOR_DELAY","milliseconds","%0.0f",1,100,1,2);
+	IUFillNumberVector(&MotorDelayNP,MotorDelayN,1,getDeviceName(),"MOTOR_CONFIG","Step Delay",OPTIONS_TAB,IP_RW,0,IPS_OK);
+
+	IUFillSwitch(&MotorDirS[0],"FORWARD","Normal",ISS_ON);
+	IUFillSwitch(&MotorDirS[1],"REVERSE","Reverse",ISS_OFF);
+	IUFillSwitchVector(&MotorDirSP,MotorDirS,2,getDeviceName(),"MOTOR_DIR","Motor Dir",OPTIONS_TAB,IP_RW,ISR_1OFMANY,60,IPS_OK);
+
+	IUFillNumber(&FocusBacklashN[0], "FOCUS_BACKLASH_VALUE", "Steps", "%0.0f", 0, 100, 1, 0);
+	IUFillNumberVector(&FocusBacklashNP, FocusBacklashN, 1, getDeviceName(), "FOCUS_BACKLASH", "Backlash", OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
+
+	IUFillSwitch(&FocusParkingS[0],"FOCUS_PARKON","Enable",ISS_ON);
+	IUFillSwitch(&FocusParkingS[1],"FOCUS_PARKOFF","Disable",ISS_OFF);
+	IUFillSwitchVector(&FocusParkingSP,FocusParkingS,2,getDeviceName(),"FOCUS_PARK","Parking",OPTIONS_TAB,IP_RW,ISR_1OFMANY,60,IPS_OK);
+
+	IUFillSwitch(&FocusResetS[0],"FOCUS_RESET","Reset",ISS_OFF);
+	IUFillSwitchVector(&FocusResetSP,FocusResetS,1,getDeviceName(),"FOCUS_RESET","Position Reset",OPTIONS_TAB,IP_RW,ISR_1OFMANY,60,IPS_OK);
+
+	IUFillSwitch(&FocusHomeS[0],"FOCUS_HOME","Home",ISS_OFF);
+	IUFillSwitchVector(&FocusHomeSP,FocusHomeS,1,getDeviceName(),"FOCUS_HOME","Homing",MAIN_CONTROL_TAB,IP_RW,ISR_ATMOST1,60,IPS_IDLE);
+
+	IUFillNumber(&HomeConfigN[0],"HOME_INPUT","Limit Input","%0.0f",1,INPUT_COUNT,1,2);
+	IUFillNumber(&HomeConfigN[1],"HOME_FAST_DELAY","Fast Delay (ms)","%0.0f",1,100,1,1);
+	IUFillNumber(&HomeConfigN[2],"HOME_SLOW_DELAY","Slow Delay (ms)","%0.0f",1,100,1,5);
+	IUFillNumber(&HomeConfigN[3],"HOME_BACKOFF","Backoff (steps)","%0.0f",1,2000,10,200);
+	IUFillNumberVector(&HomeConfigNP,HomeConfigN,4,getDeviceName(),"HOME_CONFIG","Homing",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillText(&MetricsT[0],"ENDPOINT","Endpoint","");
+	IUFillTextVector(&MetricsTP,MetricsT,1,getDeviceName(),"METRICS_ENDPOINT","Metrics",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillNumber(&SpiClockN[0],"SPI_SPEED","Clock (MHz)","%0.1f",0.1,10,0.1,10);
+	IUFillNumberVector(&SpiClockNP,SpiClockN,1,getDeviceName(),"SPI_CLOCK","SPI",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillNumber(&RealtimeN[0],"RT_PRIORITY","FIFO Priority (0 off)","%0.0f",0,99,1,0);
+	IUFillNumber(&RealtimeN[1],"RT_CPU","CPU (-1 any)","%0.0f",-1,63,1,-1);
+	IUFillNumberVector(&RealtimeNP,RealtimeN,2,getDeviceName(),"REALTIME_CONFIG","Real Time",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillSwitch(&RealtimeS[0],"RT_MLOCK","Lock Memory",ISS_OFF);
+	IUFillSwitch(&RealtimeS[1],"RT_PREFAULT","Prefault Stack",ISS_OFF);
+	IUFillSwitchVector(&RealtimeSP,RealtimeS,2,getDeviceName(),"REALTIME_OPTIONS","Real Time Memory",OPTIONS_TAB,IP_RW,ISR_NOFMANY,0,IPS_IDLE);
+
+	IUFillText(&RealtimeStatusT[0],"RT_ACTIVE","Active","off");
+	IUFillTextVector(&RealtimeStatusTP,RealtimeStatusT,1,getDeviceName(),"REALTIME_STATUS","Real Time Status",OPTIONS_TAB,IP_RO,0,IPS_IDLE);
+
+	// autofocus tab
+	IUFillSwitch(&AutofocusS[0],"AF_START","Start",ISS_OFF);
+	IUFillSwitch(&AutofocusS[1],"AF_ABORT","Abort",ISS_OFF);
+	IUFillSwitchVector(&AutofocusSP,AutofocusS,2,getDeviceName(),"AUTOFOCUS","Sweep",AUTOFOCUS_TAB,IP_RW,ISR_ATMOST1,0,IPS_IDLE);
+
+	IUFillNumber(&AutofocusN[0],"AF_SAMPLES","Positions","%0.0f",3,AUTOFOCUS_MAX_SAMPLES,1,9);
+	IUFillNumber(&AutofocusN[1],"AF_STEP","Step Size","%0.0f",1,2000,10,50);
+	IUFillNumber(&AutofocusN[2],"AF_OVERSHOOT","Backlash Overshoot","%0.0f",0,2000,10,100);
+	IUFillNumber(&AutofocusN[3],"AF_SKIP","Frames Skipped","%0.0f",0,5,1,1);
+	IUFillNumber(&AutofocusN[4],"AF_TIMEOUT","Sample Timeout (sec)","%0.0f",5,600,5,60);
+	IUFillNumberVector(&AutofocusNP,AutofocusN,5,getDeviceName(),"AUTOFOCUS_CONFIG","Settings",AUTOFOCUS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillSwitch(&AutofocusDirS[0],"AF_OUTWARD","Outward",ISS_ON);
+	IUFillSwitch(&AutofocusDirS[1],"AF_INWARD","Inward",ISS_OFF);
+	IUFillSwitchVector(&AutofocusDirSP,AutofocusDirS,2,getDeviceName(),"AUTOFOCUS_APPROACH","Approach",AUTOFOCUS_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+	IUFillText(&AutofocusSnoopT[0],"AF_DEVICE","Camera","CCD Simulator");
+	IUFillText(&AutofocusSnoopT[1],"AF_PROPERTY","Property","CCD_HFR");
+	IUFillText(&AutofocusSnoopT[2],"AF_ELEMENT","Element","HFR");
+	IUFillTextVector(&AutofocusSnoopTP,AutofocusSnoopT,3,getDeviceName(),"AUTOFOCUS_SOURCE","HFR Source",AUTOFOCUS_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillNumber(&AutofocusResultN[0],"AF_SAMPLE","Sample","%0.0f",0,AUTOFOCUS_MAX_SAMPLES,1,0);
+	IUFillNumber(&AutofocusResultN[1],"AF_BEST","Best Position","%0.0f",0,MAX_STEPS,1,0);
+	IUFillNumber(&AutofocusResultN[2],"AF_FIT","Fitted HFR","%0.2f",0,100,0,0);
+	IUFillNumber(&AutofocusResultN[3],"AF_MIN","Lowest HFR","%0.2f",0,100,0,0);
+	IUFillNumberVector(&AutofocusResultNP,AutofocusResultN,4,getDeviceName(),"AUTOFOCUS_RESULT","Result",AUTOFOCUS_TAB,IP_RO,0,IPS_IDLE);
+
+	// imaging tab
+	IUFillSwitch(&DeferS[0],"DEFER_ENABLE","Enable",ISS_OFF);
+	IUFillSwitch(&DeferS[1],"DEFER_DISABLE","Disable",ISS_ON);
+	IUFillSwitchVector(&DeferSP,DeferS,2,getDeviceName(),"MOVE_DEFERRAL","Defer Moves",IMAGING_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+	IUFillText(&DeferT[0],"DEFER_DEVICE","Camera","CCD Simulator");
+	IUFillTextVector(&DeferTP,DeferT,1,getDeviceName(),"DEFER_CAMERA","Exposing Camera",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillNumber(&DeferN[0],"DEFER_GUARD","Max Wait (sec)","%0.0f",10,3600,10,600);
+	IUFillNumberVector(&DeferNP,DeferN,1,getDeviceName(),"DEFER_CONFIG","Deferral",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillSwitch(&FilterOffsetS[0],"FILTER_OFFSET_ENABLE","Enable",ISS_OFF);
+	IUFillSwitch(&FilterOffsetS[1],"FILTER_OFFSET_DISABLE","Disable",ISS_ON);
+	IUFillSwitchVector(&FilterOffsetSP,FilterOffsetS,2,getDeviceName(),"FILTER_OFFSET_MODE","Filter Offsets",IMAGING_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+	IUFillText(&FilterWheelT[0],"FILTER_DEVICE","Filter Wheel","Filter Simulator");
+	IUFillTextVector(&FilterWheelTP,FilterWheelT,1,getDeviceName(),"FILTER_WHEEL","Filter Wheel",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+
+	for (int i = 0; i < MAX_FILTERS; i++)
+	{
+		char name[MAXINDINAME], label[MAXINDILABEL];
+		snprintf(name, sizeof(name), "OFFSET_%d", i + 1);
+		snprintf(label, sizeof(label), "Filter %d", i + 1);
+		IUFillNumber(&FilterOffsetN[i],name,label,"%0.0f",-MAX_STEPS/10,MAX_STEPS/10,10,0);
+	}
+	IUFillNumberVector(&FilterOffsetNP,FilterOffsetN,MAX_FILTERS,getDeviceName(),"FILTER_OFFSETS","Offsets (steps)",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillSwitch(&TempCompS[0],"TC_ENABLE","Enable",ISS_OFF);
+	IUFillSwitch(&TempCompS[1],"TC_DISABLE","Disable",ISS_ON);
+	IUFillSwitchVector(&TempCompSP,TempCompS,2,getDeviceName(),"TEMP_COMPENSATION","Temp. Compensation",IMAGING_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+	IUFillText(&TempSourceT[0],"TC_DEVICE","Device","Weather Simulator");
+	IUFillText(&TempSourceT[1],"TC_PROPERTY","Property","WEATHER_PARAMETERS");
+	IUFillText(&TempSourceT[2],"TC_ELEMENT","Element","WEATHER_TEMPERATURE");
+	IUFillTextVector(&TempSourceTP,TempSourceT,3,getDeviceName(),"TEMP_SOURCE","Temperature Source",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+
+	IUFillNumber(&TempCompN[0],"TC_COEFFICIENT","Steps per C","%0.1f",-1000,1000,1,0);
+	IUFillNumber(&TempCompN[1],"TC_THRESHOLD","Hysteresis (steps)","%0.0f",1,1000,1,10);
+	IUFillNumberVector(&TempCompNP,TempCompN,2,getDeviceName(),"TEMP_COMP_CONFIG","Compensation",IMAGING_TAB,IP_RW,0,IPS_IDLE);
+	tempcomp.Configure(TempCompN[0].value, (int) TempCompN[1].value);
+
+	IUFillNumber(&TempStatusN[0],"TC_TEMPERATURE","Temperature (C)","%0.2f",-100,100,0,0);
+	IUFillNumber(&TempStatusN[1],"TC_REFERENCE","Reference (C)","%0.2f",-100,100,0,0);
+	IUFillNumber(&TempStatusN[2],"TC_PENDING","Pending (steps)","%0.1f",-MAX_STEPS,MAX_STEPS,0,0);
+	IUFillNumberVector(&TempStatusNP,TempStatusN,3,getDeviceName(),"TEMP_COMP_STATUS","Compensation Status",IMAGING_TAB,IP_RO,0,IPS_IDLE);
+
+	IUFillSwitch(&TempResetS[0],"TC_RESET","Reset Reference",ISS_OFF);
+	IUFillSwitchVector(&TempResetSP,TempResetS,1,getDeviceName(),"TEMP_COMP_RESET","Reference",IMAGING_TAB,IP_RW,ISR_ATMOST1,0,IPS_IDLE);
+
+	// diagnostics tab
+	IUFillSwitch(&EventExportS[0],"EXPORT_BINARY","Binary",ISS_OFF);
+	IUFillSwitch(&EventExportS[1],"EXPORT_CSV","CSV",ISS_OFF);
+	IUFillSwitchVector(&EventExportSP,EventExportS,2,getDeviceName(),"EVENT_EXPORT","Export Events",DIAGNOSTICS_TAB,IP_RW,ISR_ATMOST1,0,IPS_IDLE);
+
+	IUFillBLOB(&EventLogB[0],"EVENTS","Events","");
+	IUFillBLOBVector(&EventLogBP,EventLogB,1,getDeviceName(),"EVENT_LOG","Event Log",DIAGNOSTICS_TAB,IP_RO,60,IPS_IDLE);
+
+	// main tab
+	IUFillSwitch(&FocusMotionS[0],"FOCUS_INWARD","Focus In",ISS_OFF);
 	IUFillSwitch(&FocusMotionS[1],"FOCUS_OUTWARD","Focus Out",ISS_ON);
 	IUFillSwitchVector(&FocusMotionSP,FocusMotionS,2,getDeviceName(),"FOCUS_MOTION","Direction",MAIN_CONTROL_TAB,IP_RW,ISR_ATMOST1,60,IPS_OK);
 
@@ -673,6 +1993,8 @@ bool IndiPiFaceFocuser2::initProperties()
 	// set capabilities
 	SetFocuserCapability(FOCUSER_CAN_ABS_MOVE | FOCUSER_CAN_REL_MOVE);
 
+	addSimulationControl();
+
 	// set default values
 	dir = FOCUS_OUTWARD;
 	step_index = 0;
@@ -705,6 +2027,33 @@ bool IndiPiFaceFocuser2::updateProperties()
 		defineSwitch(&FocusResetSP);
                 defineSwitch(&MotorDirSP);
                 defineNumber(&MotorDelayNP);
+                defineSwitch(&FocusHomeSP);
+                defineNumber(&HomeConfigNP);
+                defineNumber(&SpiClockNP);
+                defineNumber(&RealtimeNP);
+                defineSwitch(&RealtimeSP);
+                defineText(&RealtimeStatusTP);
+                ApplyRealtime();
+                defineSwitch(&EventExportSP);
+                defineBLOB(&EventLogBP);
+                defineText(&MetricsTP);
+                defineSwitch(&AutofocusSP);
+                defineNumber(&AutofocusNP);
+                defineSwitch(&AutofocusDirSP);
+                defineText(&AutofocusSnoopTP);
+                defineNumber(&AutofocusResultNP);
+                defineSwitch(&DeferSP);
+                defineText(&DeferTP);
+                defineNumber(&DeferNP);
+                defineSwitch(&FilterOffsetSP);
+                defineText(&FilterWheelTP);
+                defineNumber(&FilterOffsetNP);
+                defineSwitch(&TempCompSP);
+                defineText(&TempSourceTP);
+                defineNumber(&TempCompNP);
+                defineNumber(&TempStatusNP);
+                defineSwitch(&TempResetSP);
+                StartMetrics();
                 // defineNumber(&FocusBacklashNP);
     }
     else
@@ -716,6 +2065,31 @@ bool IndiPiFaceFocuser2::updateProperties()
 		deleteProperty(FocusResetSP.name);
                 deleteProperty(MotorDirSP.name);
                 deleteProperty(MotorDelayNP.name);
+                deleteProperty(FocusHomeSP.name);
+                deleteProperty(HomeConfigNP.name);
+                deleteProperty(SpiClockNP.name);
+                deleteProperty(RealtimeNP.name);
+                deleteProperty(RealtimeSP.name);
+                deleteProperty(RealtimeStatusTP.name);
+                deleteProperty(EventExportSP.name);
+                deleteProperty(EventLogBP.name);
+                deleteProperty(MetricsTP.name);
+                deleteProperty(AutofocusSP.name);
+                deleteProperty(AutofocusNP.name);
+                deleteProperty(AutofocusDirSP.name);
+                deleteProperty(AutofocusSnoopTP.name);
+                deleteProperty(AutofocusResultNP.name);
+                deleteProperty(DeferSP.name);
+                deleteProperty(DeferTP.name);
+                deleteProperty(DeferNP.name);
+                deleteProperty(FilterOffsetSP.name);
+                deleteProperty(FilterWheelTP.name);
+                deleteProperty(FilterOffsetNP.name);
+                deleteProperty(TempCompSP.name);
+                deleteProperty(TempSourceTP.name);
+                deleteProperty(TempCompNP.name);
+                deleteProperty(TempStatusNP.name);
+                deleteProperty(TempResetSP.name);
     }
 
     return true;
@@ -726,10 +2100,77 @@ bool IndiPiFaceFocuser2::ISNewNumber (const char *dev, const char *name, double
 	// first we check if it's for our device
 	if(strcmp(dev,getDeviceName())==0)
 	{
+        // handle spi clock, applies to the next transfer
+        if (!strcmp(name, SpiClockNP.name))
+        {
+			IUUpdateNumber(&SpiClockNP,values,names,n);
+			bus.SetSpeed((uint32_t) (SpiClockN[0].value * 1000000));
+			SpiClockN[0].value = bus.Speed() / 1e6;
+			SpiClockNP.s = IPS_OK;
+			IDSetNumber(&SpiClockNP, NULL);
+			return true;
+        }
+
+        // a manual move ends a running sweep and sets the compensation reference
+        if (!strcmp(name, FocusAbsPosNP.name) || !strcmp(name, FocusRelPosNP.name))
+        {
+			if (autofocus.Running())
+				AbortAutofocus("manual move", false);
+			tempcomp.Reset();
+        }
+
+        // handle compensation coefficient and hysteresis
+        if (!strcmp(name, TempCompNP.name))
+        {
+			IUUpdateNumber(&TempCompNP,values,names,n);
+			tempcomp.Configure(TempCompN[0].value, (int) TempCompN[1].value);
+			TempCompNP.s = IPS_OK;
+			IDSetNumber(&TempCompNP, NULL);
+			PublishTempComp();
+			return true;
+        }
+
+        // handle filter offset table
+        if (!strcmp(name, FilterOffsetNP.name))
+        {
+			IUUpdateNumber(&FilterOffsetNP,values,names,n);
+			FilterOffsetNP.s = IPS_OK;
+			IDSetNumber(&FilterOffsetNP, NULL);
+			return true;
+        }
+
+        // handle deferral guard
+        if (!strcmp(name, DeferNP.name))
+        {
+			IUUpdateNumber(&DeferNP,values,names,n);
+			DeferNP.s = IPS_OK;
+			IDSetNumber(&DeferNP, NULL);
+			return true;
+        }
+
+        // handle autofocus settings
+        if (!strcmp(name, AutofocusNP.name))
+        {
+			IUUpdateNumber(&AutofocusNP,values,names,n);
+			AutofocusNP.s = IPS_OK;
+			IDSetNumber(&AutofocusNP, NULL);
+			return true;
+        }
+
+        // handle real time priority and cpu
+        if (!strcmp(name, RealtimeNP.name))
+        {
+			IUUpdateNumber(&RealtimeNP,values,names,n);
+			ApplyRealtime();
+			return true;
+        }
+
         // handle focus absolute position
         if (!strcmp(name, FocusAbsPosNP.name))
         {
 			int newPos = (int) values[0];
+            if (DeferMove(newPos))
+                return true;
             if ( MoveAbsFocuser(newPos) == IPS_OK )
             {
                IUUpdateNumber(&FocusAbsPosNP,values,names,n);
@@ -746,6 +2187,12 @@ bool IndiPiFaceFocuser2::ISNewNumber (const char *dev, const char *name, double
 			FocusRelPosNP.s=IPS_OK;
 			IDSetNumber(&FocusRelPosNP, NULL);
 
+			// queued as an absolute target while the camera exposes, relative
+			// requests add up on a move that is already queued
+			int base = PlannedTarget();
+			if (DeferMove(base + (int) FocusRelPosN[0].value * (FocusMotionS[0].s == ISS_ON ? -1 : 1)))
+				return true;
+
 			//FOCUS_INWARD
             if ( FocusMotionS[0].s == ISS_ON )
 				MoveRelFocuser(FOCUS_INWARD, FocusRelPosN[0].value);
@@ -766,6 +2213,15 @@ bool IndiPiFaceFocuser2::ISNewNumber (const char *dev, const char *name, double
             return true;
         }
 
+        // handle homing configuration
+        if (!strcmp(name, HomeConfigNP.name))
+        {
+            IUUpdateNumber(&HomeConfigNP,values,names,n);
+            HomeConfigNP.s=IPS_OK;
+            IDSetNumber(&HomeConfigNP, NULL);
+            return true;
+        }
+
         // handle focus backlash
         if (!strcmp(name, FocusBacklashNP.name))
         {
@@ -791,15 +2247,18 @@ bool IndiPiFaceFocuser2::ISNewSwitch (const char *dev, const char *name, ISState
 
 			//Preset 1
             if ( PresetGotoS[0].s == ISS_ON )
-				MoveAbsFocuser(PresetN[0].value);
+				if (!DeferMove(PresetN[0].value))
+					MoveAbsFocuser(PresetN[0].value);
 
 			//Preset 2
             if ( PresetGotoS[1].s == ISS_ON )
-				MoveAbsFocuser(PresetN[1].value);
+				if (!DeferMove(PresetN[1].value))
+					MoveAbsFocuser(PresetN[1].value);
 
 			//Preset 2
             if ( PresetGotoS[2].s == ISS_ON )
-				MoveAbsFocuser(PresetN[2].value);
+				if (!DeferMove(PresetN[2].value))
+					MoveAbsFocuser(PresetN[2].value);
 
 			PresetGotoS[0].s = ISS_OFF;
 			PresetGotoS[1].s = ISS_OFF;
@@ -820,8 +2279,116 @@ bool IndiPiFaceFocuser2::ISNewSwitch (const char *dev, const char *name, ISState
 				IDSetNumber(&FocusAbsPosNP, NULL);
 				MoveAbsFocuser(0);
 			}
-            FocusResetS[0].s = ISS_OFF;
-            IDSetSwitch(&FocusResetSP, NULL);
+            FocusResetS[0].s = ISS_OFF;
+            IDSetSwitch(&FocusResetSP, NULL);
+			return true;
+		}
+
+        // handle autofocus sweep
+        if(!strcmp(name, AutofocusSP.name))
+        {
+			IUUpdateSwitch(&AutofocusSP, states, names, n);
+			if (AutofocusS[0].s == ISS_ON && !autofocus.Running())
+				StartAutofocus();
+			else if (AutofocusS[1].s == ISS_ON && autofocus.Running())
+				AbortAutofocus("aborted", true);
+			IUResetSwitch(&AutofocusSP);
+			IDSetSwitch(&AutofocusSP, NULL);
+			return true;
+		}
+
+        // handle temperature compensation
+        if(!strcmp(name, TempCompSP.name))
+        {
+			IUUpdateSwitch(&TempCompSP, states, names, n);
+			if (TempCompS[0].s == ISS_ON)
+			{
+				// compensation starts from the focus found at the current temperature
+				tempcomp.Reset();
+				IDSnoopDevice(TempSourceT[0].text, TempSourceT[1].text);
+				IDSnoopDevice(DeferT[0].text, "CCD_EXPOSURE");
+			}
+			TempCompSP.s = IPS_OK;
+			IDSetSwitch(&TempCompSP, NULL);
+			PublishTempComp();
+			return true;
+		}
+
+        // handle compensation reference reset
+        if(!strcmp(name, TempResetSP.name))
+        {
+			tempcomp.Reset();
+			IUResetSwitch(&TempResetSP);
+			TempResetSP.s = IPS_OK;
+			IDSetSwitch(&TempResetSP, NULL);
+			PublishTempComp();
+			return true;
+		}
+
+        // handle filter offsets
+        if(!strcmp(name, FilterOffsetSP.name))
+        {
+			IUUpdateSwitch(&FilterOffsetSP, states, names, n);
+			if (FilterOffsetS[0].s == ISS_ON)
+				IDSnoopDevice(FilterWheelT[0].text, "FILTER_SLOT");
+			FilterOffsetSP.s = IPS_OK;
+			IDSetSwitch(&FilterOffsetSP, NULL);
+			return true;
+		}
+
+        // handle move deferral
+        if(!strcmp(name, DeferSP.name))
+        {
+			IUUpdateSwitch(&DeferSP, states, names, n);
+			if (DeferS[0].s == ISS_ON)
+				IDSnoopDevice(DeferT[0].text, "CCD_EXPOSURE");
+			else if (deferred_target != -1)
+				RunDeferred();
+			DeferSP.s = IPS_OK;
+			IDSetSwitch(&DeferSP, NULL);
+			return true;
+		}
+
+        // handle autofocus approach direction
+        if(!strcmp(name, AutofocusDirSP.name))
+        {
+			IUUpdateSwitch(&AutofocusDirSP, states, names, n);
+			AutofocusDirSP.s = IPS_OK;
+			IDSetSwitch(&AutofocusDirSP, NULL);
+			return true;
+		}
+
+        // handle real time memory options
+        if(!strcmp(name, RealtimeSP.name))
+        {
+			IUUpdateSwitch(&RealtimeSP, states, names, n);
+			ApplyRealtime();
+			return true;
+		}
+
+        // handle event export
+        if(!strcmp(name, EventExportSP.name))
+        {
+			IUUpdateSwitch(&EventExportSP, states, names, n);
+			ExportEvents(EventExportS[1].s == ISS_ON ? PiFaceEventRing::EXPORT_CSV : PiFaceEventRing::EXPORT_BINARY);
+			IUResetSwitch(&EventExportSP);
+			EventExportSP.s = IPS_IDLE;
+			IDSetSwitch(&EventExportSP, NULL);
+			return true;
+		}
+
+        // handle homing
+        if(!strcmp(name, FocusHomeSP.name))
+        {
+			IUUpdateSwitch(&FocusHomeSP, states, names, n);
+
+            if ( FocusHomeS[0].s == ISS_ON )
+            {
+				// stays busy until the homing steps finish
+				FocusHomeSP.s = HomeFocuser() ? IPS_BUSY : IPS_ALERT;
+			}
+            FocusHomeS[0].s = ISS_OFF;
+            IDSetSwitch(&FocusHomeSP, NULL);
 			return true;
 		}
 
@@ -880,6 +2447,23 @@ bool IndiPiFaceFocuser2::saveConfigItems(FILE *fp)
 	IUSaveConfigNumber(fp, &FocusBacklashNP);
 	IUSaveConfigSwitch(fp, &FocusParkingSP);
 	IUSaveConfigSwitch(fp, &MotorDirSP);
+	IUSaveConfigNumber(fp, &HomeConfigNP);
+	IUSaveConfigNumber(fp, &SpiClockNP);
+	IUSaveConfigNumber(fp, &RealtimeNP);
+	IUSaveConfigSwitch(fp, &RealtimeSP);
+	IUSaveConfigText(fp, &MetricsTP);
+	IUSaveConfigNumber(fp, &AutofocusNP);
+	IUSaveConfigSwitch(fp, &AutofocusDirSP);
+	IUSaveConfigText(fp, &AutofocusSnoopTP);
+	IUSaveConfigSwitch(fp, &DeferSP);
+	IUSaveConfigText(fp, &DeferTP);
+	IUSaveConfigNumber(fp, &DeferNP);
+	IUSaveConfigSwitch(fp, &FilterOffsetSP);
+	IUSaveConfigText(fp, &FilterWheelTP);
+	IUSaveConfigNumber(fp, &FilterOffsetNP);
+	IUSaveConfigSwitch(fp, &TempCompSP);
+	IUSaveConfigText(fp, &TempSourceTP);
+	IUSaveConfigNumber(fp, &TempCompNP);
 
 	if ( FocusParkingS[0].s == ISS_ON )
 		IUSaveConfigNumber(fp, &FocusAbsPosNP);
@@ -896,18 +2480,33 @@ IPState IndiPiFaceFocuser2::MoveFocuser(FocusDirection direction, int speed, int
 
 IPState IndiPiFaceFocuser2::MoveRelFocuser(FocusDirection direction, int ticks)
 {
-	int targetTicks = FocusAbsPosN[0].value + (ticks * (direction == FOCUS_INWARD ? -1 : 1));
+	// relative to where running and queued moves end
+	int targetTicks = PlannedTarget() + (ticks * (direction == FOCUS_INWARD ? -1 : 1));
 	return MoveAbsFocuser(targetTicks);
 }
 
 IPState IndiPiFaceFocuser2::MoveAbsFocuser(int targetTicks)
 {
+	// homing owns the motor until it finishes
+	if (home_phase != HOME_IDLE)
+	{
+		IDMessage(getDeviceName(), "PiFace Focuser 2 is homing.");
+		return IPS_ALERT;
+	}
+
     if (targetTicks < FocusAbsPosN[0].min || targetTicks > FocusAbsPosN[0].max)
     {
         IDMessage(getDeviceName(), "Requested position is out of range.");
         return IPS_ALERT;
     }
 
+	// a running move finishes first, the latest target waits for it
+	if (motion_active)
+	{
+		motion_next = targetTicks;
+		return IPS_BUSY;
+	}
+
     if (targetTicks == FocusAbsPosN[0].value)
     {
         // IDMessage(getDeviceName(), "PiFace Focuser 2 already in the requested position.");
@@ -934,97 +2533,811 @@ IPState IndiPiFaceFocuser2::MoveAbsFocuser(int targetTicks)
     }
 
 	// if direction changed do backlash adjustment - TO DO
+	// the backlash is taken up by the first steps of the run
 	if ( lastdir != dir && FocusAbsPosN[0].value != 0 && FocusBacklashN[0].value != 0 )
-	{
 		IDMessage(getDeviceName() , "PiFace Focuser 2 backlash compensation by %0.0f steps...", FocusBacklashN[0].value);
-		StepperMotor(FocusBacklashN[0].value, dir);
-	}
 
 	// process targetTicks
 	int ticks = abs(targetTicks - FocusAbsPosN[0].value);
 
-	// GO
+	// GO, FinishMove completes the move
+	events.Record(PiFaceEventRing::EVENT_MOVE_START, 0, targetTicks);
 	StepperMotor(ticks, dir);
 
-	// update abspos value and status
-	IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 2 moved to position %0.0f", FocusAbsPosN[0].value );
+    return IPS_BUSY;
+}
+
+int IndiPiFaceFocuser2::StepperMotor(int steps, FocusDirection direction)
+{
+	// steps run on the motion thread, the event loop stays free and
+	// publishes the position from a timer until MotionDone
+	motion_start = FocusAbsPosN[0].value;
+	motion_dir = direction;
+	motion_steps = steps;
+	motion_period = (long long) (MotorDelayN[0].value * 1000000);
+	motion_done = 0;
+	motion_abort = false;
+	motion_active = true;
+	motion_begin = MonotonicNs();
+	motion_timer = IEAddTimer(MOTION_PUBLISH_MS, MotionTimer, this);
+
+	// busy until FinishMove, whichever request started the move
+	FocusAbsPosNP.s = IPS_BUSY;
+	IDSetNumber(&FocusAbsPosNP, NULL);
+
+	realtime.Start(MotionJob, this);
+
+	return 0;
+}
+void IndiPiFaceFocuser2::MotionJob(void *p)
+{
+	IndiPiFaceFocuser2 *focuser = static_cast<IndiPiFaceFocuser2 *>(p);
+	long long late = 0;
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	// an abort stops the run at the next step
+	for (int i = 0; i < focuser->motion_steps && !focuser->motion_abort; i++)
+	{
+		focuser->Coils(focuser->motion_dir);
+		focuser->motion_done = i + 1;
+
+		// steps keep their period, a late wakeup does not push the next one
+		long long over = SleepUntil(&deadline, focuser->motion_period);
+		if (over > late)
+			late = over;
+	}
+
+	focuser->last_move_late_ns = late;
+}
+void IndiPiFaceFocuser2::MotionTimer(void *p)
+{
+	IndiPiFaceFocuser2 *focuser = static_cast<IndiPiFaceFocuser2 *>(p);
+	focuser->motion_timer = -1;
+	if (!focuser->motion_active)
+		return;
+
+	int sign = focuser->motion_dir == FOCUS_INWARD ? -1 : 1;
+	focuser->FocusAbsPosN[0].value = focuser->motion_start + sign * focuser->motion_done;
+	IDSetNumber(&focuser->FocusAbsPosNP, NULL);
+	focuser->motion_timer = IEAddTimer(MOTION_PUBLISH_MS, MotionTimer, focuser);
+}
+void IndiPiFaceFocuser2::MotionDone(int fd, void *p)
+{
+	INDI_UNUSED(fd);
+	IndiPiFaceFocuser2 *focuser = static_cast<IndiPiFaceFocuser2 *>(p);
+
+	// the thread signals after the last step
+	if (focuser->realtime.Done() && focuser->motion_active && focuser->realtime.Wait(0))
+		focuser->FinishMove();
+}
+void IndiPiFaceFocuser2::FinishMove()
+{
+	if (motion_timer != -1)
+		IERmTimer(motion_timer);
+	motion_timer = -1;
+	motion_active = false;
+
+	int done = motion_done;
+	int sign = motion_dir == FOCUS_INWARD ? -1 : 1;
+	FocusAbsPosN[0].value = motion_start + sign * done;
+
+	// Coast motor
+	bus.WriteBits(0x00, 0xf0, GPIOA, 0);
+
+	events.Record(PiFaceEventRing::EVENT_STEP_BATCH, motion_dir, done);
+	last_move_ns = MonotonicNs() - motion_begin;
+	last_move_steps = done;
+	move_ns_total += last_move_ns;
+	move_count++;
+	events.Record(PiFaceEventRing::EVENT_MOVE_END, 0, FocusAbsPosN[0].value);
+
+	// parked position is part of the config
+	if ( FocusParkingS[0].s == ISS_ON )
+		persist.MarkDirty();
+
+	if (metrics.IsStarted())
+		UpdateMetrics();
+
+	if (motion_abort)
+	{
+		FocusAbsPosNP.s = IPS_IDLE;
+		IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 2 stopped at position %0.0f", FocusAbsPosN[0].value);
+		return;
+	}
+
+	// chained or newer target
+	if (motion_next != -1)
+	{
+		int next = motion_next;
+		motion_next = -1;
+		IPState state = MoveAbsFocuser(next);
+		if (state == IPS_BUSY)
+			return;
+		if (state == IPS_ALERT)
+		{
+			tempcomp.Dequeue();
+			FocusAbsPosNP.s = IPS_ALERT;
+			IDSetNumber(&FocusAbsPosNP, NULL);
+			return;
+		}
+	}
+
+	// compensation counts once the focuser is there, unless part of it
+	// still waits for the readout
+	if (deferred_target == -1)
+		tempcomp.Applied(tempcomp.Dequeue());
+
 	FocusAbsPosNP.s = IPS_OK;
+	IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 2 moved to position %0.0f", FocusAbsPosN[0].value);
+}
+void IndiPiFaceFocuser2::StopMove()
+{
+	// queued targets are dropped, their compensation is pending again
+	motion_next = -1;
+	tempcomp.Dequeue();
+	if (motion_active)
+		motion_abort = true;
+}
+void IndiPiFaceFocuser2::WaitMove()
+{
+	// disconnect only, the bus closes after the last step
+	while (motion_active)
+	{
+		while (!realtime.Wait(MOTION_PUBLISH_MS))
+			;
+		realtime.Done();
+		FinishMove();
+	}
+}
+int IndiPiFaceFocuser2::PlannedTarget()
+{
+	// where the focuser ends once deferred, queued and running moves are done
+	if (deferred_target != -1)
+		return deferred_target;
+	if (motion_next != -1)
+		return motion_next;
+	if (motion_active)
+		return motion_start + (motion_dir == FOCUS_INWARD ? -motion_steps : motion_steps);
+	return (int) FocusAbsPosN[0].value;
+}
+void IndiPiFaceFocuser2::Step(FocusDirection direction)
+{
+	Coils(direction);
+
+	if ( direction == FOCUS_INWARD )
+		FocusAbsPosN[0].value -= 1;
+	else
+		FocusAbsPosN[0].value += 1;
+}
+unsigned long IndiPiFaceFocuser2::SpiReads()
+{
+	return bus.Reads();
+}
+unsigned long IndiPiFaceFocuser2::SpiWrites()
+{
+	return bus.Writes();
+}
+void IndiPiFaceFocuser2::Coils(FocusDirection direction)
+{
+	// reversed motor walks the sequence the other way
+	bool forward = (direction == FOCUS_OUTWARD) == (MotorDirS[1].s == ISS_ON);
+	step_index = (step_index + (forward ? 1 : 7)) % 8;
+	step_count++;
+	int value = step_sequence[step_index];
+
+	// GPIOA upper nibble
+	bus.WriteBits((value & 0xf) << 4, 0xf0, GPIOA, 0);
+}
+bool IndiPiFaceFocuser2::HomeFocuser()
+{
+	if (home_phase != HOME_IDLE)
+		return true;
+
+	// a running move owns the motor
+	if (motion_active)
+	{
+		IDMessage(getDeviceName(), "PiFace Focuser 2 is moving.");
+		return false;
+	}
+
+	home_limit = 1 << (INPUT_SHIFT + (int) HomeConfigN[0].value - 1);
+
+	// limit switch on interrupt, polled when the line is owned by another driver
+	if (!inputs.Start(&bus, INPUT_CHIP, INPUT_PORT, home_limit, NULL, NULL))
+		IDMessage(getDeviceName(), "PiFace Focuser 2 interrupt line busy, polling limit switch.");
+
+	FocusAbsPosNP.s = IPS_BUSY;
 	IDSetNumber(&FocusAbsPosNP, NULL);
 
-    return IPS_OK;
+	// leave the switch if already on it, then fast approach
+	HomePhase(LimitActive() ? HOME_LEAVE : HOME_FAST);
+	home_timer = IEAddTimer(0, HomeTimer, this);
+	return true;
 }
+void IndiPiFaceFocuser2::HomePhase(int phase)
+{
+	int backoff = (int) HomeConfigN[3].value;
 
-int IndiPiFaceFocuser2::StepperMotor(int steps, FocusDirection direction)
+	home_phase = phase;
+	switch (phase)
+	{
+		case HOME_FAST:
+			home_left = MAX_STEPS + MAX_STEPS / 10;
+			break;
+		case HOME_BACKOFF:
+			home_left = backoff;
+			break;
+		case HOME_SLOW:
+			home_left = backoff * 2;
+			break;
+		default:
+			home_left = backoff * 4;
+			break;
+	}
+}
+void IndiPiFaceFocuser2::HomeTimer(void *p)
+{
+	IndiPiFaceFocuser2 *focuser = static_cast<IndiPiFaceFocuser2 *>(p);
+	focuser->home_timer = -1;
+	focuser->HomeTick();
+}
+void IndiPiFaceFocuser2::HomeTick()
+{
+	// level after the previous step, the interrupt callback runs between ticks
+	bool active = LimitActive();
+	switch (home_phase)
+	{
+		case HOME_LEAVE:
+			if (!active)
+				HomePhase(HOME_FAST);
+			break;
+		case HOME_FAST:
+			// release the switch and back off, then slow approach for a repeatable edge
+			if (active)
+				HomePhase(HOME_RELEASE);
+			break;
+		case HOME_RELEASE:
+			if (!active)
+				HomePhase(HOME_BACKOFF);
+			break;
+		case HOME_BACKOFF:
+			if (home_left == 0)
+				HomePhase(HOME_SLOW);
+			break;
+		case HOME_SLOW:
+			if (active)
+			{
+				FinishHome(NULL);
+				return;
+			}
+			break;
+	}
+
+	if (home_left <= 0)
+	{
+		FinishHome("limit switch not found");
+		return;
+	}
+
+	// one step per tick, the event loop keeps running between steps
+	bool inward = home_phase == HOME_FAST || home_phase == HOME_SLOW;
+	Step(inward ? FOCUS_INWARD : FOCUS_OUTWARD);
+	home_left--;
+	IDSetNumber(&FocusAbsPosNP, NULL);
+
+	int delay = (int) HomeConfigN[home_phase == HOME_FAST ? 1 : 2].value;
+	home_timer = IEAddTimer(delay, HomeTimer, this);
+}
+void IndiPiFaceFocuser2::FinishHome(const char *failure)
+{
+	if (home_timer != -1)
+		IERmTimer(home_timer);
+	home_timer = -1;
+	home_phase = HOME_IDLE;
+
+	// Coast motor
+	bus.WriteBits(0x00, 0xf0, GPIOA, 0);
+	inputs.Stop();
+
+	if (failure != NULL)
+	{
+		FocusAbsPosNP.s = IPS_ALERT;
+		IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 2 %s", failure);
+		FocusHomeSP.s = IPS_ALERT;
+		IDSetSwitch(&FocusHomeSP, NULL);
+		return;
+	}
+
+	events.Record(PiFaceEventRing::EVENT_HOME, 0, FocusAbsPosN[0].value);
+
+	// absolute zero at the switch
+	dir = FOCUS_INWARD;
+	FocusAbsPosN[0].value = 0;
+	FocusAbsPosNP.s = IPS_OK;
+	IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 2 homed");
+	FocusHomeSP.s = IPS_OK;
+	IDSetSwitch(&FocusHomeSP, NULL);
+}
+bool IndiPiFaceFocuser2::LimitActive()
+{
+	// switch is active low, INTCAP holds the level latched at the edge
+	uint8_t levels = inputs.IsStarted() ? inputs.Levels() : bus.ReadReg(GPIOA + INPUT_PORT, INPUT_CHIP);
+	return (levels & home_limit) == 0;
+}
+bool IndiPiFaceFocuser2::ISNewText (const char *dev, const char *name, char *texts[], char *names[], int n)
+{
+	// first we check if it's for our device
+	if(strcmp(dev,getDeviceName())==0)
+	{
+        // handle temperature source
+        if (!strcmp(name, TempSourceTP.name))
+        {
+            IUUpdateText(&TempSourceTP,texts,names,n);
+            if (TempCompS[0].s == ISS_ON)
+                IDSnoopDevice(TempSourceT[0].text, TempSourceT[1].text);
+            TempSourceTP.s = IPS_OK;
+            IDSetText(&TempSourceTP, NULL);
+            return true;
+        }
+
+        // handle filter wheel device
+        if (!strcmp(name, FilterWheelTP.name))
+        {
+            IUUpdateText(&FilterWheelTP,texts,names,n);
+            filter_slot = 0;
+            if (FilterOffsetS[0].s == ISS_ON)
+                IDSnoopDevice(FilterWheelT[0].text, "FILTER_SLOT");
+            FilterWheelTP.s = IPS_OK;
+            IDSetText(&FilterWheelTP, NULL);
+            return true;
+        }
+
+        // handle exposing camera
+        if (!strcmp(name, DeferTP.name))
+        {
+            IUUpdateText(&DeferTP,texts,names,n);
+            exposing = false;
+            if (DeferS[0].s == ISS_ON || TempCompS[0].s == ISS_ON)
+                IDSnoopDevice(DeferT[0].text, "CCD_EXPOSURE");
+            DeferTP.s = IPS_OK;
+            IDSetText(&DeferTP, NULL);
+            return true;
+        }
+
+        // handle autofocus hfr source
+        if (!strcmp(name, AutofocusSnoopTP.name))
+        {
+            IUUpdateText(&AutofocusSnoopTP,texts,names,n);
+            IDSnoopDevice(AutofocusSnoopT[0].text, AutofocusSnoopT[1].text);
+            AutofocusSnoopTP.s = IPS_OK;
+            IDSetText(&AutofocusSnoopTP, NULL);
+            return true;
+        }
+
+        // handle metrics endpoint
+        if (!strcmp(name, MetricsTP.name))
+        {
+            IUUpdateText(&MetricsTP,texts,names,n);
+            if (isConnected())
+                StartMetrics();
+            else
+                IDSetText(&MetricsTP, NULL);
+            return true;
+        }
+	}
+	return INDI::Focuser::ISNewText(dev,name,texts,names,n);
+}
+bool IndiPiFaceFocuser2::ISSnoopDevice (XMLEle *root)
 {
-    int step_states[8];
-    int value;
-    int payload = 0x00;
+	double value;
+
+	// exposure ended, queued move runs in the readout gap
+	if (PiFaceSnoop::Match(root, DeferT[0].text, "CCD_EXPOSURE"))
+	{
+		bool ended = exposing && PiFaceSnoop::State(root) != IPS_BUSY;
+		exposing = PiFaceSnoop::State(root) == IPS_BUSY;
+		if (ended && deferred_target != -1)
+			RunDeferred();
+	}
 
-	if(direction == FOCUS_OUTWARD)
+	// filter wheel slot, INDI wheels publish the requested slot only once
+	// they are there, so the offset move follows the wheel
+	if (PiFaceSnoop::Match(root, FilterWheelT[0].text, "FILTER_SLOT") && PiFaceSnoop::State(root) != IPS_ALERT &&
+		PiFaceSnoop::Number(root, "FILTER_SLOT_VALUE", &value))
+		FilterChanged((int) value);
+
+	// temperature source, corrections are batched behind the hysteresis
+	if (PiFaceSnoop::Match(root, TempSourceT[0].text, TempSourceT[1].text) && PiFaceSnoop::State(root) != IPS_ALERT &&
+		PiFaceSnoop::Number(root, TempSourceT[2].text, &value))
+		TemperatureChanged(value);
+
+	// only completed measurements of the autofocus source
+	if (autofocus.Running() && autofocus_timer != -1 && !motion_active && !strcmp(tagXMLEle(root), "setNumberVector") &&
+		PiFaceSnoop::Match(root, AutofocusSnoopT[0].text, AutofocusSnoopT[1].text) &&
+		PiFaceSnoop::State(root) != IPS_BUSY && PiFaceSnoop::State(root) != IPS_ALERT &&
+		PiFaceSnoop::Number(root, AutofocusSnoopT[2].text, &value))
 	{
-		if ( MotorDirS[1].s == ISS_ON )
+		// frames exposed while the motor moved are dropped, frames during
+		// the move are not even counted
+		if (autofocus_skip > 0)
 		{
-			//clockwise out
-			int step_states[8] = {0xa, 0x2, 0x6, 0x4, 0x5, 0x1, 0x9, 0x8};
+			autofocus_skip--;
 		}
 		else
 		{
-			//clockwise in
-			int step_states[8] = {0x8, 0x9, 0x1, 0x5, 0x4, 0x6, 0x2, 0xa};
+			IERmTimer(autofocus_timer);
+			autofocus_timer = -1;
+			autofocus.Sample(value);
+
+			if (autofocus.Done())
+				FinishAutofocus();
+			else
+				NextAutofocus();
 		}
 	}
-	else
+
+	return INDI::Focuser::ISSnoopDevice(root);
+}
+void IndiPiFaceFocuser2::StartAutofocus()
+{
+	int direction = AutofocusDirS[0].s == ISS_ON ? 1 : -1;
+	autofocus_start = (int) FocusAbsPosN[0].value;
+
+	if (!autofocus.Start(autofocus_start, (int) AutofocusN[0].value, (int) AutofocusN[1].value, direction,
+		(int) AutofocusN[2].value, (int) FocusAbsPosN[0].min, (int) FocusAbsPosN[0].max))
+	{
+		AutofocusSP.s = IPS_ALERT;
+		IDMessage(getDeviceName(), "PiFace Focuser 2 autofocus sweep does not fit the focuser travel.");
+		return;
+	}
+
+	IDSnoopDevice(AutofocusSnoopT[0].text, AutofocusSnoopT[1].text);
+	events.Record(PiFaceEventRing::EVENT_AUTOFOCUS, 0, autofocus_start);
+	IDMessage(getDeviceName(), "PiFace Focuser 2 autofocus sweep of %d positions started.", autofocus.Count());
+
+	AutofocusSP.s = IPS_BUSY;
+	AutofocusResultNP.s = IPS_BUSY;
+
+	// take up the backlash once, every sample is then reached the same way
+	int first = autofocus.Target();
+	MoveAbsFocuser(autofocus.Approach(autofocus_start, first));
+	NextAutofocus();
+}
+void IndiPiFaceFocuser2::NextAutofocus()
+{
+	MoveAbsFocuser(autofocus.Target());
+
+	AutofocusResultN[0].value = autofocus.Taken() + 1;
+	IDSetNumber(&AutofocusResultNP, NULL);
+
+	// wait for a fresh measurement at this position
+	autofocus_skip = (int) AutofocusN[3].value;
+	autofocus_timer = IEAddTimer((int) AutofocusN[4].value * 1000, AutofocusTimeout, this);
+}
+void IndiPiFaceFocuser2::FinishAutofocus()
+{
+	int best;
+	double value, minimum;
+
+	autofocus.Stop();
+
+	if (!autofocus.Fit(&best, &value, &minimum))
+	{
+		AbortAutofocus("too few valid samples", true);
+		return;
+	}
+
+	MoveApproach(best);
+	events.Record(PiFaceEventRing::EVENT_AUTOFOCUS, 1, best);
+	tempcomp.Reset();
+
+	AutofocusResultN[1].value = best;
+	AutofocusResultN[2].value = value;
+	AutofocusResultN[3].value = minimum;
+	AutofocusResultNP.s = IPS_OK;
+	IDSetNumber(&AutofocusResultNP, "PiFace Focuser 2 autofocus best position %d, HFR %0.2f", best, value);
+	AutofocusSP.s = IPS_OK;
+	IDSetSwitch(&AutofocusSP, NULL);
+}
+void IndiPiFaceFocuser2::AbortAutofocus(const char *reason, bool restore)
+{
+	if (autofocus_timer != -1)
+		IERmTimer(autofocus_timer);
+	autofocus_timer = -1;
+	autofocus.Stop();
+
+	// back where the sweep started
+	if (restore)
+		MoveApproach(autofocus_start);
+
+	events.Record(PiFaceEventRing::EVENT_AUTOFOCUS, 2, (int) FocusAbsPosN[0].value);
+	AutofocusResultNP.s = IPS_ALERT;
+	IDSetNumber(&AutofocusResultNP, "PiFace Focuser 2 autofocus %s", reason);
+	AutofocusSP.s = IPS_ALERT;
+	IDSetSwitch(&AutofocusSP, NULL);
+}
+void IndiPiFaceFocuser2::MoveApproach(int position)
+{
+	int from = (int) FocusAbsPosN[0].value;
+	int via = autofocus.Approach(from, position);
+
+	// final position is reached in the sweep direction
+	if (via != position && from != position)
+		MoveAbsFocuser(via);
+	MoveAbsFocuser(position);
+}
+void IndiPiFaceFocuser2::AutofocusTimeout(void *p)
+{
+	IndiPiFaceFocuser2 *focuser = static_cast<IndiPiFaceFocuser2 *>(p);
+	focuser->autofocus_timer = -1;
+	focuser->AbortAutofocus("timed out waiting for HFR", true);
+}
+bool IndiPiFaceFocuser2::DeferMove(int target, bool always)
+{
+	if ((DeferS[0].s != ISS_ON && !always) || !exposing)
+		return false;
+
+	// target is resolved now, the readout gap only runs the steps
+	if (target < FocusAbsPosN[0].min)
+		target = FocusAbsPosN[0].min;
+	if (target > FocusAbsPosN[0].max)
+		target = FocusAbsPosN[0].max;
+
+	// latest request wins
+	deferred_target = target;
+	if (defer_timer == -1)
+		defer_timer = IEAddTimer((int) DeferN[0].value * 1000, DeferTimeout, this);
+
+	FocusAbsPosNP.s = IPS_BUSY;
+	IDSetNumber(&FocusAbsPosNP, "PiFace Focuser 2 move to %d deferred until camera readout", target);
+	return true;
+}
+void IndiPiFaceFocuser2::RunDeferred()
+{
+	int target = deferred_target;
+	CancelDeferred();
+
+	// compensation in the move stays queued until FinishMove
+	IPState state = MoveAbsFocuser(target);
+	if (state == IPS_OK)
+	{
+		tempcomp.Applied(tempcomp.Dequeue());
+		FocusAbsPosNP.s = IPS_OK;
+		IDSetNumber(&FocusAbsPosNP, NULL);
+	}
+	else if (state == IPS_ALERT)
+	{
+		tempcomp.Dequeue();
+	}
+}
+void IndiPiFaceFocuser2::CancelDeferred()
+{
+	if (defer_timer != -1)
+		IERmTimer(defer_timer);
+	defer_timer = -1;
+	deferred_target = -1;
+}
+void IndiPiFaceFocuser2::DeferTimeout(void *p)
+{
+	IndiPiFaceFocuser2 *focuser = static_cast<IndiPiFaceFocuser2 *>(p);
+
+	// camera went quiet, do not hold the move forever
+	focuser->defer_timer = -1;
+	IDMessage(focuser->getDeviceName(), "PiFace Focuser 2 camera exposure did not end, moving now.");
+	focuser->RunDeferred();
+}
+void IndiPiFaceFocuser2::FilterChanged(int slot)
+{
+	if (slot < 1 || slot > MAX_FILTERS || slot == filter_slot)
+		return;
+
+	// first report only tells where the wheel is
+	int previous = filter_slot;
+	filter_slot = slot;
+	if (previous == 0 || FilterOffsetS[0].s != ISS_ON)
+		return;
+
+	// a sweep owns the motor until it ends
+	if (autofocus.Running())
+		return;
+
+	int delta = (int) (FilterOffsetN[slot - 1].value - FilterOffsetN[previous - 1].value);
+	if (delta == 0)
+		return;
+
+	// runs after the wheel, unless the camera is exposing, on top of a
+	// move still waiting or running
+	int base = PlannedTarget();
+	int target = base + delta;
+	IDMessage(getDeviceName(), "PiFace Focuser 2 filter %d offset %+d steps", slot, delta);
+	if (!DeferMove(target) && MoveAbsFocuser(target) == IPS_OK)
+	{
+		FocusAbsPosNP.s = IPS_OK;
+		IDSetNumber(&FocusAbsPosNP, NULL);
+	}
+}
+void IndiPiFaceFocuser2::TemperatureChanged(double celsius)
+{
+	int steps = tempcomp.Update(celsius);
+
+	// a sweep owns the motor until it ends
+	if (steps != 0 && TempCompS[0].s == ISS_ON && !autofocus.Running())
 	{
-		if ( MotorDirS[1].s == ISS_ON )
+		// on top of a move still waiting or running
+		int base = PlannedTarget();
+		IDMessage(getDeviceName(), "PiFace Focuser 2 temperature %0.1f C, compensating %+d steps", celsius, steps);
+
+		// never during an exposure of the watched camera, steps count once moved
+		if (DeferMove(base + steps, true))
 		{
-			//clockwise in
-			int step_states[8] = {0x8, 0x9, 0x1, 0x5, 0x4, 0x6, 0x2, 0xa};
+			tempcomp.Queued(deferred_target - base);
 		}
 		else
 		{
-			//clockwise out
-			int step_states[8] = {0xa, 0x2, 0x6, 0x4, 0x5, 0x1, 0x9, 0x8};
+			IPState state = MoveAbsFocuser(base + steps);
+			if (state == IPS_BUSY)
+			{
+				tempcomp.Queued(steps);
+			}
+			else if (state == IPS_OK)
+			{
+				tempcomp.Applied(steps);
+				FocusAbsPosNP.s = IPS_OK;
+				IDSetNumber(&FocusAbsPosNP, NULL);
+			}
 		}
 	}
 
-    for (int i = 0; i < steps; i++)
-    {
-	// update position for a client
-
-        if ( dir == FOCUS_INWARD )
-        	FocusAbsPosN[0].value -= 1;
-        if ( dir == FOCUS_OUTWARD )
-        	FocusAbsPosN[0].value += 1;
-        IDSetNumber(&FocusAbsPosNP, NULL);
-
-		if(step_index == (sizeof(step_states)/sizeof(int)))
-			step_index = 0;
-		value = step_states[step_index];
-		step_index++;
-
-		// GPIOB upper nibble, polarity reversed
-		payload = payload & 0x0f;
-		payload = payload | ((value & 0xf) << 4);
-
-		// make step
-		mcp23s17_write_reg(payload, GPIOA, 0, mcp23s17_fd);
-		usleep(MotorDelayN[0].value * 1000);
+	PublishTempComp();
+}
+void IndiPiFaceFocuser2::PublishTempComp()
+{
+	TempStatusN[0].value = tempcomp.Temperature();
+	TempStatusN[1].value = tempcomp.Reference();
+	TempStatusN[2].value = tempcomp.Pending();
+	TempStatusNP.s = tempcomp.Valid() && TempCompS[0].s == ISS_ON ? IPS_OK : IPS_IDLE;
+	IDSetNumber(&TempStatusNP, NULL);
+}
+bool IndiPiFaceFocuser2::WriteConfig(FILE *fp, void *p)
+{
+	IndiPiFaceFocuser2 *focuser = static_cast<IndiPiFaceFocuser2 *>(p);
+
+	IUSaveConfigTag(fp, 0, focuser->getDeviceName(), 1);
+	focuser->saveConfigItems(fp);
+	IUSaveConfigTag(fp, 1, focuser->getDeviceName(), 1);
+
+	return true;
+}
+bool IndiPiFaceFocuser2::saveConfig(bool silent, const char *property)
+{
+	if (!persist.IsOpen())
+		return INDI::Focuser::saveConfig(silent, property);
+
+	// full saves use the atomic writer, single properties wait for it
+	bool rc = persist.Sync();
+	if (property != NULL)
+		return INDI::Focuser::saveConfig(silent, property);
+
+	if (!rc)
+	{
+		IDMessage(getDeviceName(), "PiFace Focuser 2 could not save configuration to %s.", persist.Path());
+		return false;
+	}
+	IUSaveDefaultConfig(NULL, NULL, getDeviceName());
+
+	if (!silent)
+		IDMessage(getDeviceName(), "PiFace Focuser 2 configuration saved.");
+	return true;
+}
+void IndiPiFaceFocuser2::ApplyRealtime()
+{
+	// the thread is restarted, never under a running move
+	if (motion_active)
+	{
+		RealtimeNP.s = RealtimeSP.s = IPS_ALERT;
+		IDSetNumber(&RealtimeNP, NULL);
+		IDSetSwitch(&RealtimeSP, "PiFace Focuser 2 real time settings apply when the motor is idle.");
+		return;
+	}
+
+	int effective = realtime.Configure((int) RealtimeN[0].value, (int) RealtimeN[1].value,
+		RealtimeS[0].s == ISS_ON, RealtimeS[1].s == ISS_ON, this, sizeof(*this));
+	int requested = realtime.Requested();
+
+	RealtimeNP.s = RealtimeSP.s = IPS_OK;
+	IDSetNumber(&RealtimeNP, NULL);
+	IDSetSwitch(&RealtimeSP, NULL);
+
+	// settings without privileges are dropped, not fatal
+	IUSaveText(&RealtimeStatusT[0], realtime.Status());
+	RealtimeStatusTP.s = effective == requested ? IPS_OK : IPS_ALERT;
+	if (effective != requested)
+		IDSetText(&RealtimeStatusTP, "PiFace Focuser 2 real time settings partly denied: %s", realtime.Status());
+	else
+		IDSetText(&RealtimeStatusTP, NULL);
+}
+void IndiPiFaceFocuser2::StartMetrics()
+{
+	metrics.Stop();
+	MetricsTP.s = IPS_IDLE;
+
+	if (MetricsT[0].text != NULL && MetricsT[0].text[0] != 0)
+	{
+		if (metrics.Start(MetricsT[0].text, getDeviceName()))
+		{
+			UpdateMetrics();
+			MetricsTP.s = IPS_OK;
+		}
+		else
+		{
+			MetricsTP.s = IPS_ALERT;
+			IDMessage(getDeviceName(), "PiFace Focuser 2 metrics endpoint %s is not available.", MetricsT[0].text);
 		}
+	}
+
+	IDSetText(&MetricsTP, NULL);
+}
+void IndiPiFaceFocuser2::UpdateMetrics()
+{
+	metrics.Begin();
+	metrics.Counter("piface_spi_reads_total", "SPI register reads", bus.Reads());
+	metrics.Counter("piface_spi_writes_total", "SPI register writes", bus.Writes());
+	metrics.Counter("piface_focuser_steps_total", "Motor half steps", step_count);
+	metrics.Counter("piface_focuser_moves_total", "Completed moves", move_count);
+	metrics.Counter("piface_focuser_move_seconds_total", "Time spent moving", move_ns_total / 1e9);
+	metrics.Gauge("piface_focuser_last_move_seconds", "Duration of the last move", last_move_ns / 1e9);
+	metrics.Gauge("piface_focuser_step_rate", "Steps per second of the last move", last_move_ns > 0 ? last_move_steps * 1e9 / last_move_ns : 0);
+	metrics.Gauge("piface_focuser_step_late_max_seconds", "Worst step wakeup delay of the last move", last_move_late_ns / 1e9);
+	metrics.Gauge("piface_focuser_position", "Absolute focuser position", FocusAbsPosN[0].value);
+	metrics.Commit();
+}
+void IndiPiFaceFocuser2::ExportEvents(int format)
+{
+	int size = 0;
+	char *buffer = events.Export(format, &size);
+	if (buffer == NULL)
+	{
+		EventLogBP.s = IPS_ALERT;
+		IDSetBLOB(&EventLogBP, "PiFace Focuser 2 event export failed");
+		return;
+	}
 
-		// Coast motor
-		mcp23s17_write_reg(0x00, GPIOA, 0, mcp23s17_fd);
+	EventLogB[0].blob = buffer;
+	EventLogB[0].bloblen = size;
+	EventLogB[0].size = size;
+	strcpy(EventLogB[0].format, format == PiFaceEventRing::EXPORT_CSV ? ".csv" : ".bin");
+	EventLogBP.s = IPS_OK;
+	IDSetBLOB(&EventLogBP, NULL);
 
-		return 0;
+	EventLogB[0].blob = NULL;
+	free(buffer);
 }
 bool IndiPiFaceFocuser2::AbortFocuser()
 {
 	IDMessage(getDeviceName() , "PiFace Focuser 2 aborted");
 
+	// homing timer stops with the motor
+	if (home_phase != HOME_IDLE)
+		FinishHome("homing aborted");
+
+	// a sweep without its moves has nothing to measure
+	if (autofocus.Running())
+		AbortAutofocus("aborted", false);
+
+	// queued moves are dropped, a running one stops at the next step and
+	// FinishMove coasts the motor
+	CancelDeferred();
+	StopMove();
+	if (motion_active)
+		return true;
+
 	// Brake
-	mcp23s17_write_reg(0xff, GPIOA, 0, mcp23s17_fd);
+	bus.WriteBits(0xff, 0xf0, GPIOA, 0);
 
 	// Cost
-	mcp23s17_write_reg(0x00, GPIOA, 0, mcp23s17_fd);
+	bus.WriteBits(0x00, 0xf0, GPIOA, 0);
 
 	return true;
 }
@@ -19,8 +19,34 @@
 #ifndef PIFACEFOCUS_H
 #define PIFACEFOCUS_H
 
+#include <atomic>
+
 #include <indifocuser.h>
 
+#include "piface_mcp23s17.h"
+#include "piface_inputs.h"
+#include "piface_eventring.h"
+#include "piface_metrics.h"
+#include "piface_realtime.h"
+#include "piface_autofocus.h"
+#include "piface_snoop.h"
+#include "piface_tempcomp.h"
+#include "piface_persist.h"
+
+// filter wheel slots with a focus offset
+#define MAX_FILTERS 8
+
+// homing phases, one motor step per event loop timer tick
+enum PiFaceHomePhase
+{
+	HOME_IDLE,
+	HOME_LEAVE,
+	HOME_FAST,
+	HOME_RELEASE,
+	HOME_BACKOFF,
+	HOME_SLOW
+};
+
 class IndiPiFaceFocuser1 : public INDI::Focuser
 {
     protected:
@@ -35,6 +61,125 @@ class IndiPiFaceFocuser1 : public INDI::Focuser
 	INumberVectorProperty FocusBacklashNP;
 	INumber MotorDelayN[1];
 	INumberVectorProperty MotorDelayNP;
+        ISwitch FocusHomeS[1];
+        ISwitchVectorProperty FocusHomeSP;
+	INumber HomeConfigN[4];
+	INumberVectorProperty HomeConfigNP;
+	INumber SpiClockN[1];
+	INumberVectorProperty SpiClockNP;
+	INumber RealtimeN[2];
+	INumberVectorProperty RealtimeNP;
+	ISwitch RealtimeS[2];
+	ISwitchVectorProperty RealtimeSP;
+	IText RealtimeStatusT[1];
+	ITextVectorProperty RealtimeStatusTP;
+	PiFaceRealtime realtime;
+	void ApplyRealtime();
+	FocusDirection motion_dir;
+	int motion_steps;
+	long long motion_period;
+	std::atomic<int> motion_done;
+	std::atomic<bool> motion_abort;
+	bool motion_active;
+	int motion_start;
+	int motion_next;
+	int motion_timer;
+	int motion_cb;
+	long long motion_begin;
+	static void MotionJob(void *p);
+	static void MotionTimer(void *p);
+	static void MotionDone(int fd, void *p);
+	void FinishMove();
+	void StopMove();
+	void WaitMove();
+	int PlannedTarget();
+	ISwitch AutofocusS[2];
+	ISwitchVectorProperty AutofocusSP;
+	INumber AutofocusN[5];
+	INumberVectorProperty AutofocusNP;
+	ISwitch AutofocusDirS[2];
+	ISwitchVectorProperty AutofocusDirSP;
+	IText AutofocusSnoopT[3];
+	ITextVectorProperty AutofocusSnoopTP;
+	INumber AutofocusResultN[4];
+	INumberVectorProperty AutofocusResultNP;
+	PiFaceAutofocus autofocus;
+	int autofocus_start;
+	int autofocus_skip;
+	int autofocus_timer;
+	void StartAutofocus();
+	void NextAutofocus();
+	void FinishAutofocus();
+	void AbortAutofocus(const char *reason, bool restore);
+	void MoveApproach(int position);
+	static void AutofocusTimeout(void *p);
+	ISwitch DeferS[2];
+	ISwitchVectorProperty DeferSP;
+	IText DeferT[1];
+	ITextVectorProperty DeferTP;
+	INumber DeferN[1];
+	INumberVectorProperty DeferNP;
+	bool exposing;
+	int deferred_target;
+	int defer_timer;
+	bool DeferMove(int target, bool always = false);
+	void RunDeferred();
+	void CancelDeferred();
+	static void DeferTimeout(void *p);
+	ISwitch FilterOffsetS[2];
+	ISwitchVectorProperty FilterOffsetSP;
+	IText FilterWheelT[1];
+	ITextVectorProperty FilterWheelTP;
+	INumber FilterOffsetN[MAX_FILTERS];
+	INumberVectorProperty FilterOffsetNP;
+	int filter_slot;
+	void FilterChanged(int slot);
+	ISwitch TempCompS[2];
+	ISwitchVectorProperty TempCompSP;
+	IText TempSourceT[3];
+	ITextVectorProperty TempSourceTP;
+	INumber TempCompN[2];
+	INumberVectorProperty TempCompNP;
+	INumber TempStatusN[3];
+	INumberVectorProperty TempStatusNP;
+	ISwitch TempResetS[1];
+	ISwitchVectorProperty TempResetSP;
+	PiFaceTempComp tempcomp;
+	void TemperatureChanged(double celsius);
+	void PublishTempComp();
+	PiFacePersist persist;
+	static bool WriteConfig(FILE *fp, void *p);
+	ISwitch EventExportS[2];
+	ISwitchVectorProperty EventExportSP;
+	IBLOB EventLogB[1];
+	IBLOBVectorProperty EventLogBP;
+	PiFaceEventRing events;
+	void ExportEvents(int format);
+	IText MetricsT[1];
+	ITextVectorProperty MetricsTP;
+	PiFaceMetrics metrics;
+	unsigned long step_count;
+	unsigned long move_count;
+	long long move_ns_total;
+	long long last_move_ns;
+	int last_move_steps;
+	long long last_move_late_ns;
+	void StartMetrics();
+	void UpdateMetrics();
+	PiFaceInputs inputs;
+	void Step(FocusDirection direction);
+	void Coils(FocusDirection direction);
+	int home_phase;
+	int home_left;
+	int home_timer;
+	uint8_t home_limit;
+	void HomePhase(int phase);
+	void HomeTick();
+	void FinishHome(const char *failure);
+	bool LimitActive();
+	static void HomeTimer(void *p);
+	PiFaceMcp23s17 bus;
+	friend class PiFaceTests;
     public:
         IndiPiFaceFocuser1();
         virtual ~IndiPiFaceFocuser1();
@@ -49,16 +194,21 @@ class IndiPiFaceFocuser1 : public INDI::Focuser
 
         virtual bool ISNewNumber (const char *dev, const char *name, double values[], char *names[], int n);
         virtual bool ISNewSwitch (const char *dev, const char *name, ISState *states, char *names[], int n);
+        virtual bool ISNewText (const char *dev, const char *name, char *texts[], char *names[], int n);
+        virtual bool ISSnoopDevice (XMLEle *root);
         virtual bool saveConfigItems(FILE *fp);
+        virtual bool saveConfig(bool silent = false, const char *property = NULL);
 
 	virtual IPState MoveFocuser(FocusDirection dir, int speed, int duration);
         virtual IPState MoveAbsFocuser(int ticks);
         virtual IPState MoveRelFocuser(FocusDirection dir, int ticks);
 	virtual int StepperMotor(int steps, FocusDirection dir);
 	virtual bool AbortFocuser();
+	virtual bool HomeFocuser();
 	FocusDirection dir;
-	int mcp23s17_fd;
 	int step_index;
+	unsigned long SpiReads();
+	unsigned long SpiWrites();
 };
 class IndiPiFaceFocuser2 : public INDI::Focuser
 {
@@ -74,6 +224,125 @@ class IndiPiFaceFocuser2 : public INDI::Focuser
 	INumberVectorProperty FocusBacklashNP;
 	INumber MotorDelayN[1];
 	INumberVectorProperty MotorDelayNP;
+        ISwitch FocusHomeS[1];
+        ISwitchVectorProperty FocusHomeSP;
+	INumber HomeConfigN[4];
+	INumberVectorProperty HomeConfigNP;
+	INumber SpiClockN[1];
+	INumberVectorProperty SpiClockNP;
+	INumber RealtimeN[2];
+	INumberVectorProperty RealtimeNP;
+	ISwitch RealtimeS[2];
+	ISwitchVectorProperty RealtimeSP;
+	IText RealtimeStatusT[1];
+	ITextVectorProperty RealtimeStatusTP;
+	PiFaceRealtime realtime;
+	void ApplyRealtime();
+	FocusDirection motion_dir;
+	int motion_steps;
+	long long motion_period;
+	std::atomic<int> motion_done;
+	std::atomic<bool> motion_abort;
+	bool motion_active;
+	int motion_start;
+	int motion_next;
+	int motion_timer;
+	int motion_cb;
+	long long motion_begin;
+	static void MotionJob(void *p);
+	static void MotionTimer(void *p);
+	static void MotionDone(int fd, void *p);
+	void FinishMove();
+	void StopMove();
+	void WaitMove();
+	int PlannedTarget();
+	ISwitch AutofocusS[2];
+	ISwitchVectorProperty AutofocusSP;
+	INumber AutofocusN[5];
+	INumberVectorProperty AutofocusNP;
+	ISwitch AutofocusDirS[2];
+	ISwitchVectorProperty AutofocusDirSP;
+	IText AutofocusSnoopT[3];
+	ITextVectorProperty AutofocusSnoopTP;
+	INumber AutofocusResultN[4];
+	INumberVectorProperty AutofocusResultNP;
+	PiFaceAutofocus autofocus;
+	int autofocus_start;
+	int autofocus_skip;
+	int autofocus_timer;
+	void StartAutofocus();
+	void NextAutofocus();
+	void FinishAutofocus();
+	void AbortAutofocus(const char *reason, bool restore);
+	void MoveApproach(int position);
+	static void AutofocusTimeout(void *p);
+	ISwitch DeferS[2];
+	ISwitchVectorProperty DeferSP;
+	IText DeferT[1];
+	ITextVectorProperty DeferTP;
+	INumber DeferN[1];
+	INumberVectorProperty DeferNP;
+	bool exposing;
+	int deferred_target;
+	int defer_timer;
+	bool DeferMove(int target, bool always = false);
+	void RunDeferred();
+	void CancelDeferred();
+	static void DeferTimeout(void *p);
+	ISwitch FilterOffsetS[2];
+	ISwitchVectorProperty FilterOffsetSP;
+	IText FilterWheelT[1];
+	ITextVectorProperty FilterWheelTP;
+	INumber FilterOffsetN[MAX_FILTERS];
+	INumberVectorProperty FilterOffsetNP;
+	int filter_slot;
+	void FilterChanged(int slot);
+	ISwitch TempCompS[2];
+	ISwitchVectorProperty TempCompSP;
+	IText TempSourceT[3];
+	ITextVectorProperty TempSourceTP;
+	INumber TempCompN[2];
+	INumberVectorProperty TempCompNP;
+	INumber TempStatusN[3];
+	INumberVectorProperty TempStatusNP;
+	ISwitch TempResetS[1];
+	ISwitchVectorProperty TempResetSP;
+	PiFaceTempComp tempcomp;
+	void TemperatureChanged(double celsius);
+	void PublishTempComp();
+	PiFacePersist persist;
+	static bool WriteConfig(FILE *fp, void *p);
+	ISwitch EventExportS[2];
+	ISwitchVectorProperty EventExportSP;
+	IBLOB EventLogB[1];
+	IBLOBVectorProperty EventLogBP;
+	PiFaceEventRing events;
+	void ExportEvents(int format);
+	IText MetricsT[1];
+	ITextVectorProperty MetricsTP;
+	PiFaceMetrics metrics;
+	unsigned long step_count;
+	unsigned long move_count;
+	long long move_ns_total;
+	long long last_move_ns;
+	int last_move_steps;
+	long long last_move_late_ns;
+	void StartMetrics();
+	void UpdateMetrics();
+	PiFaceInputs inputs;
+	void Step(FocusDirection direction);
+	void Coils(FocusDirection direction);
+	int home_phase;
+	int home_left;
+	int home_timer;
+	uint8_t home_limit;
+	void HomePhase(int phase);
+	void HomeTick();
+	void FinishHome(const char *failure);
+	bool LimitActive();
+	static void HomeTimer(void *p);
+	PiFaceMcp23s17 bus;
+	friend class PiFaceTests;
     public:
         IndiPiFaceFocuser2();
         virtual ~IndiPiFaceFocuser2();
@@ -88,16 +357,21 @@ class IndiPiFaceFocuser2 : public INDI::Focuser
 
         virtual bool ISNewNumber (const char *dev, const char *name, double values[], char *names[], int n);
         virtual bool ISNewSwitch (const char *dev, const char *name, ISState *states, char *names[], int n);
+        virtual bool ISNewText (const char *dev, const char *name, char *texts[], char *names[], int n);
+        virtual bool ISSnoopDevice (XMLEle *root);
         virtual bool saveConfigItems(FILE *fp);
+        virtual bool saveConfig(bool silent = false, const char *property = NULL);
 
 	virtual IPState MoveFocuser(FocusDirection dir, int speed, int duration);
         virtual IPState MoveAbsFocuser(int ticks);
         virtual IPState MoveRelFocuser(FocusDirection dir, int ticks);
 	virtual int StepperMotor(int steps, FocusDirection dir);
 	virtual bool AbortFocuser();
+	virtual bool HomeFocuser();
 	FocusDirection dir;
-	int mcp23s17_fd;
 	int step_index;
+	unsigned long SpiReads();
+	unsigned long SpiWrites();
 };
 
 #endif
@@ -0,0 +1,81 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// indi_piface_focuser entry points, the drivers themselves are in piface_focuser.cpp.
+
+#include <memory>
+#include <string.h>
+
+#include "piface_focuser.h"
+#include "piface_recorder.h"
+
+// We declare a pointer to indiPiFaceFocuser.
+std::unique_ptr<IndiPiFaceFocuser1> indiPiFaceFocuser1(new IndiPiFaceFocuser1);
+std::unique_ptr<IndiPiFaceFocuser2> indiPiFaceFocuser2(new IndiPiFaceFocuser2);
+
+void ISPoll(void *p);
+void ISGetProperties(const char *dev)
+{
+        indiPiFaceFocuser1->ISGetProperties(dev);
+        indiPiFaceFocuser2->ISGetProperties(dev);
+}
+
+void ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int num)
+{
+		PiFaceRecorder::Switch(dev, name, states, names, num);
+		if (!strcmp(dev, indiPiFaceFocuser1->getDeviceName()))
+			indiPiFaceFocuser1->ISNewSwitch(dev, name, states, names, num);
+		else if (!strcmp(dev, indiPiFaceFocuser2->getDeviceName()))
+			indiPiFaceFocuser2->ISNewSwitch(dev, name, states, names, num);
+}
+
+void ISNewText(	const char *dev, const char *name, char *texts[], char *names[], int num)
+{
+		PiFaceRecorder::Text(dev, name, texts, names, num);
+		if (!strcmp(dev, indiPiFaceFocuser1->getDeviceName()))
+			indiPiFaceFocuser1->ISNewText(dev, name, texts, names, num);
+		else if (!strcmp(dev, indiPiFaceFocuser2->getDeviceName()))
+			indiPiFaceFocuser2->ISNewText(dev, name, texts, names, num);
+}
+
+void ISNewNumber(const char *dev, const char *name, double values[], char *names[], int num)
+{
+		PiFaceRecorder::Number(dev, name, values, names, num);
+		if (!strcmp(dev, indiPiFaceFocuser1->getDeviceName()))
+			indiPiFaceFocuser1->ISNewNumber(dev, name, values, names, num);
+		else if (!strcmp(dev, indiPiFaceFocuser2->getDeviceName()))
+			indiPiFaceFocuser2->ISNewNumber(dev, name, values, names, num);
+}
+
+void ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int n)
+{
+  INDI_UNUSED(dev);
+  INDI_UNUSED(name);
+  INDI_UNUSED(sizes);
+  INDI_UNUSED(blobsizes);
+  INDI_UNUSED(blobs);
+  INDI_UNUSED(formats);
+  INDI_UNUSED(names);
+  INDI_UNUSED(n);
+}
+
+void ISSnoopDevice (XMLEle *root)
+{
+	indiPiFaceFocuser1->ISSnoopDevice(root);
+	indiPiFaceFocuser2->ISSnoopDevice(root);
+}
@@ -0,0 +1,131 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stddef.h>
+#include <indidevapi.h>
+
+#include "piface_inputs.h"
+
+PiFaceInputs::PiFaceInputs()
+{
+	bus = NULL;
+	hw = 0;
+	port = 0;
+	mask = 0;
+	levels = 0;
+	saved_gpinten = 0;
+	saved_intcon = 0;
+	saved_defval = 0;
+	callback_id = -1;
+	changed_fp = NULL;
+	changed_p = NULL;
+}
+PiFaceInputs::~PiFaceInputs()
+{
+	Stop();
+}
+bool PiFaceInputs::Start(PiFaceMcp23s17 *mcp23s17, uint8_t chip, int gpio_port, uint8_t pins, Changed *fp, void *p)
+{
+	Stop();
+
+	// the line owner configures the interrupt registers, a second user
+	// would otherwise disable the capture the owner relies on
+	if (!mcp23s17->OpenInterrupt())
+		return false;
+
+	bus = mcp23s17;
+	hw = chip;
+	port = gpio_port;
+	mask = pins;
+	changed_fp = fp;
+	changed_p = p;
+
+	// shared open-drain INT, either port raises it
+	// addressing bits belong to the device that opened the bus
+	const uint8_t ioconfig = INT_MIRROR_ON | \
+							 ODR_ON | \
+							 INTPOL_LOW;
+	bus->WriteBits(ioconfig, IOCON_INT_MASK, IOCON, hw);
+
+	// inputs with pull ups, other pins untouched
+	bus->WriteBits(mask, mask, IODIRA + port, hw);
+	bus->WriteBits(mask, mask, GPPUA + port, hw);
+
+	// interrupt on any change, previous bits restored by Stop
+	saved_gpinten = bus->ReadReg(GPINTENA + port, hw) & mask;
+	saved_intcon = bus->ReadReg(INTCONA + port, hw) & mask;
+	saved_defval = bus->ReadReg(DEFVALA + port, hw) & mask;
+	bus->WriteBits(0x00, mask, INTCONA + port, hw);
+	bus->WriteBits(0x00, mask, DEFVALA + port, hw);
+	bus->WriteBits(mask, mask, GPINTENA + port, hw);
+
+	// initial levels, reading the port clears a stale interrupt
+	levels = bus->ReadReg(GPIOA + port, hw) & mask;
+
+	callback_id = IEAddCallback(bus->InterruptFd(), InterruptCallback, this);
+	return true;
+}
+void PiFaceInputs::Stop()
+{
+	if (callback_id != -1)
+	{
+		IERmCallback(callback_id);
+		callback_id = -1;
+	}
+
+	if (bus != NULL && bus->IsOpen())
+	{
+		bus->WriteBits(saved_gpinten, mask, GPINTENA + port, hw);
+		bus->WriteBits(saved_intcon, mask, INTCONA + port, hw);
+		bus->WriteBits(saved_defval, mask, DEFVALA + port, hw);
+		bus->CloseInterrupt();
+	}
+	bus = NULL;
+}
+bool PiFaceInputs::IsStarted()
+{
+	return callback_id != -1;
+}
+uint8_t PiFaceInputs::Levels()
+{
+	return levels;
+}
+void PiFaceInputs::InterruptCallback(int fd, void *p)
+{
+	INDI_UNUSED(fd);
+	static_cast<PiFaceInputs *>(p)->Interrupt();
+}
+void PiFaceInputs::Interrupt()
+{
+	if (!bus->ReadInterrupt())
+		return;
+
+	// INTCAP and GPIO in one sequential read, INTCAPA..GPIOA or INTCAPB..GPIOB;
+	// a bounce after the capture shows in GPIO and would raise no new interrupt,
+	// so the current level is published
+	uint8_t regs[3];
+	if (!bus->ReadRegs(regs, 3, INTCAPA + port, hw))
+		return;
+
+	uint8_t current = regs[2] & mask;
+	uint8_t changed = current ^ levels;
+	levels = current;
+
+	if (changed && changed_fp)
+		changed_fp(changed, levels, changed_p);
+}
@@ -0,0 +1,65 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACEINPUTS_H
+#define PIFACEINPUTS_H
+
+#include <stdint.h>
+
+#include "piface_mcp23s17.h"
+
+// inputs on the upper nibble of chip 0 port B, free of motor and relay outputs
+#define INPUT_CHIP 0
+#define INPUT_PORT PiFaceMcp23s17::PORT_B
+#define INPUT_MASK 0xf0
+#define INPUT_SHIFT 4
+#define INPUT_COUNT 4
+
+// Interrupt-on-change capture of MCP23S17 inputs.
+// The chip raises INT on any change of the masked pins; the interrupt line
+// is registered with the INDI event loop and INTCAP is read once per event,
+// so idle inputs cost no SPI traffic.
+class PiFaceInputs
+{
+public:
+	typedef void (Changed)(uint8_t changed, uint8_t levels, void *p);
+private:
+	PiFaceMcp23s17 *bus;
+	uint8_t hw;
+	int port;
+	uint8_t mask;
+	uint8_t levels;
+	uint8_t saved_gpinten;
+	uint8_t saved_intcon;
+	uint8_t saved_defval;
+	int callback_id;
+	Changed *changed_fp;
+	void *changed_p;
+	static void InterruptCallback(int fd, void *p);
+	void Interrupt();
+public:
+	PiFaceInputs();
+	~PiFaceInputs();
+
+	bool Start(PiFaceMcp23s17 *mcp23s17, uint8_t chip, int gpio_port, uint8_t pins, Changed *fp, void *p);
+	void Stop();
+	bool IsStarted();
+	uint8_t Levels();
+};
+
+#endif
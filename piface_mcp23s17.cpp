@@ -0,0 +1,659 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/gpio.h>
+#include <mutex>
+
+#include "piface_mcp23s17.h"
+#include "piface_vcd.h"
+
+// spidev handles shared by devices in the same process
+#define SHARED_HANDLES 4
+static struct
+{
+	int bus;
+	int cs;
+	int fd;
+	int users;
+} shared[SHARED_HANDLES];
+
+static int OpenSpidev(int bus, int chip_select)
+{
+	char path[32];
+	snprintf(path, sizeof(path), "/dev/spidev%d.%d", bus, chip_select);
+
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	// mode 0, 8 bit words, clock is set per transfer
+	uint8_t mode = SPI_MODE_0;
+	uint8_t bits = 8;
+	uint32_t speed = MCP23S17_SPEED;
+	if (ioctl(fd, SPI_IOC_WR_MODE, &mode) == -1 ||
+		ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) == -1 ||
+		ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+static int AcquireHandle(int bus, int chip_select)
+{
+	int free_slot = -1;
+
+	for (int i = 0; i < SHARED_HANDLES; i++)
+	{
+		if (shared[i].users > 0 && shared[i].bus == bus && shared[i].cs == chip_select)
+		{
+			shared[i].users++;
+			return shared[i].fd;
+		}
+		if (shared[i].users == 0 && free_slot == -1)
+			free_slot = i;
+	}
+
+	int fd = OpenSpidev(bus, chip_select);
+	if (fd == -1 || free_slot == -1)
+		return fd;
+
+	shared[free_slot].bus = bus;
+	shared[free_slot].cs = chip_select;
+	shared[free_slot].fd = fd;
+	shared[free_slot].users = 1;
+	return fd;
+}
+// serializes devices and threads of one process, flock only excludes
+// other open files and so other processes
+static std::mutex bus_mutex;
+
+static void ReleaseHandle(int fd)
+{
+	for (int i = 0; i < SHARED_HANDLES; i++)
+	{
+		if (shared[i].users > 0 && shared[i].fd == fd)
+		{
+			// last user closes
+			if (--shared[i].users == 0)
+				close(fd);
+			return;
+		}
+	}
+
+	close(fd);
+}
+
+PiFaceMcp23s17::PiFaceMcp23s17()
+{
+	fd = -1;
+	spi_bus = 0;
+	spi_cs = 0;
+	spi_reads = 0;
+	spi_writes = 0;
+	spi_speed = MCP23S17_SPEED;
+	memset(tx, 0, sizeof(tx));
+	memset(rx, 0, sizeof(rx));
+	memset(&xfer, 0, sizeof(xfer));
+	xfer.tx_buf = (unsigned long) tx;
+	xfer.rx_buf = (unsigned long) rx;
+	xfer.speed_hz = spi_speed;
+	xfer.bits_per_word = 8;
+	simulated = false;
+	irq_fd = -1;
+	lock_fd = -1;
+	sim_irq[0] = sim_irq[1] = -1;
+	shadow = &local_shadow;
+	memset(&local_shadow, 0, sizeof(local_shadow));
+	SimReset();
+}
+PiFaceMcp23s17::~PiFaceMcp23s17()
+{
+	Close();
+}
+bool PiFaceMcp23s17::Open(int bus, int chip_select, bool simulation, uint32_t speed)
+{
+	Close();
+
+	simulated = simulation;
+	SetSpeed(speed);
+
+	if (simulated)
+	{
+		SimReset();
+		memset(&local_shadow, 0, sizeof(local_shadow));
+		fd = 0;
+		return true;
+	}
+
+	spi_bus = bus;
+	spi_cs = chip_select;
+	fd = AcquireHandle(bus, chip_select);
+	if (fd == -1)
+		return false;
+
+	// lock file of this device, one open file per device
+	char path[64];
+	snprintf(path, sizeof(path), MCP23S17_LOCK, bus, chip_select);
+	lock_fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0660);
+
+	OpenShadow();
+
+	// a chip reset clears IOCON, HAEN is set by every device that opens
+	// the bus, so without it the latches in the image are stale
+	Lock();
+	if ((ReadReg(IOCON, 0) & HAEN_ON) == 0)
+		memset(shadow->valid, 0, sizeof(shadow->valid));
+	Unlock();
+	return true;
+}
+void PiFaceMcp23s17::Close()
+{
+	CloseInterrupt();
+	CloseShadow();
+
+	if (fd != -1 && !simulated)
+		ReleaseHandle(fd);
+	fd = -1;
+
+	if (lock_fd != -1)
+		close(lock_fd);
+	lock_fd = -1;
+}
+bool PiFaceMcp23s17::IsOpen()
+{
+	return fd != -1;
+}
+bool PiFaceMcp23s17::IsSimulated()
+{
+	return simulated;
+}
+uint8_t PiFaceMcp23s17::ReadReg(uint8_t reg, uint8_t hw)
+{
+	std::lock_guard<std::recursive_mutex> guard(access);
+
+	spi_reads++;
+
+	if (simulated)
+		return SimRead(reg, hw);
+
+	tx[0] = MCP23S17_READ(hw);
+	tx[1] = reg;
+	tx[2] = 0;
+	if (!Transfer(3))
+		return 0;
+
+	return rx[2];
+}
+void PiFaceMcp23s17::WriteReg(uint8_t data, uint8_t reg, uint8_t hw)
+{
+	std::lock_guard<std::recursive_mutex> guard(access);
+
+	bool latch = (reg == GPIOA || reg == GPIOB || reg == OLATA || reg == OLATB) && hw < MCP23S17_CHIPS;
+
+	if (latch)
+		Lock();
+
+	spi_writes++;
+	if (simulated)
+	{
+		SimWrite(data, reg, hw);
+	}
+	else
+	{
+		tx[0] = MCP23S17_WRITE(hw);
+		tx[1] = reg;
+		tx[2] = data;
+		Transfer(3);
+	}
+
+	// whole port written, image follows
+	if (latch)
+	{
+		shadow->latch[hw][reg & 1] = data;
+		shadow->valid[hw][reg & 1] = 1;
+		Unlock();
+	}
+}
+void PiFaceMcp23s17::WriteBits(uint8_t data, uint8_t mask, uint8_t reg, uint8_t hw)
+{
+	if (hw >= MCP23S17_CHIPS)
+		return;
+
+	std::lock_guard<std::recursive_mutex> guard(access);
+
+	bool latch = reg == GPIOA || reg == GPIOB || reg == OLATA || reg == OLATB;
+	int port = reg & 1;
+
+	Lock();
+
+	// latches come from the shared image, other registers from the chip
+	uint8_t current;
+	if (latch && shadow->valid[hw][port])
+	{
+		current = shadow->latch[hw][port];
+	}
+	else
+	{
+		uint8_t source = latch ? OLATA + port : reg;
+		spi_reads++;
+		if (simulated)
+		{
+			current = SimRead(source, hw);
+		}
+		else
+		{
+			tx[0] = MCP23S17_READ(hw);
+			tx[1] = source;
+			tx[2] = 0;
+			current = Transfer(3) ? rx[2] : 0;
+		}
+	}
+
+	uint8_t value = (current & ~mask) | (data & mask);
+
+	spi_writes++;
+	if (simulated)
+	{
+		SimWrite(value, reg, hw);
+	}
+	else
+	{
+		tx[0] = MCP23S17_WRITE(hw);
+		tx[1] = reg;
+		tx[2] = value;
+		Transfer(3);
+	}
+
+	if (latch)
+	{
+		shadow->latch[hw][port] = value;
+		shadow->valid[hw][port] = 1;
+	}
+
+	Unlock();
+}
+uint8_t PiFaceMcp23s17::Latch(uint8_t reg, uint8_t hw)
+{
+	if (hw >= MCP23S17_CHIPS)
+		return 0;
+
+	std::lock_guard<std::recursive_mutex> guard(access);
+
+	int port = reg & 1;
+
+	// output latch from the shared image, OLAT is read once after a reset
+	Lock();
+	if (!shadow->valid[hw][port])
+	{
+		shadow->latch[hw][port] = ReadReg(OLATA + port, hw);
+		shadow->valid[hw][port] = 1;
+	}
+	uint8_t value = shadow->latch[hw][port];
+	Unlock();
+
+	return value;
+}
+bool PiFaceMcp23s17::ReadRegs(uint8_t *data, int count, uint8_t reg, uint8_t hw)
+{
+	std::lock_guard<std::recursive_mutex> guard(access);
+
+	// sequential read, the address pointer advances with SEQOP_ON
+	if (count < 1 || reg + count > MCP23S17_REGS)
+		return false;
+
+	spi_reads++;
+
+	if (simulated)
+	{
+		for (int i = 0; i < count; i++)
+			data[i] = SimRead(reg + i, hw);
+		return true;
+	}
+
+	tx[0] = MCP23S17_READ(hw);
+	tx[1] = reg;
+	memset(tx + 2, 0, count);
+	if (!Transfer(2 + count))
+		return false;
+
+	memcpy(data, rx + 2, count);
+	return true;
+}
+bool PiFaceMcp23s17::WriteRegs(const uint8_t *data, int count, uint8_t reg, uint8_t hw)
+{
+	if (count < 1 || reg + count > MCP23S17_REGS || hw >= MCP23S17_CHIPS)
+		return false;
+
+	std::lock_guard<std::recursive_mutex> guard(access);
+
+	Lock();
+
+	spi_writes++;
+	bool ok = true;
+	if (simulated)
+	{
+		for (int i = 0; i < count; i++)
+			SimWrite(data[i], reg + i, hw);
+	}
+	else
+	{
+		tx[0] = MCP23S17_WRITE(hw);
+		tx[1] = reg;
+		memcpy(tx + 2, data, count);
+		ok = Transfer(2 + count);
+	}
+
+	// latches in the run follow into the image
+	for (int i = 0; ok && i < count; i++)
+	{
+		uint8_t r = reg + i;
+		if (r == GPIOA || r == GPIOB || r == OLATA || r == OLATB)
+		{
+			shadow->latch[hw][r & 1] = data[i];
+			shadow->valid[hw][r & 1] = 1;
+		}
+	}
+
+	Unlock();
+	return ok;
+}
+void PiFaceMcp23s17::SetSpeed(uint32_t speed)
+{
+	if (speed > MCP23S17_SPEED)
+		speed = MCP23S17_SPEED;
+	if (speed < MCP23S17_MIN_SPEED)
+		speed = MCP23S17_MIN_SPEED;
+
+	spi_speed = speed;
+	xfer.speed_hz = speed;
+}
+uint32_t PiFaceMcp23s17::Speed()
+{
+	return spi_speed;
+}
+bool PiFaceMcp23s17::Transfer(int len)
+{
+	// buffers and transfer are set up once, only the length changes
+	xfer.len = len;
+	return ioctl(fd, SPI_IOC_MESSAGE(1), &xfer) >= 0;
+}
+unsigned long PiFaceMcp23s17::Reads()
+{
+	return spi_reads;
+}
+unsigned long PiFaceMcp23s17::Writes()
+{
+	return spi_writes;
+}
+void PiFaceMcp23s17::OpenShadow()
+{
+	CloseShadow();
+
+	int shm_fd = open(MCP23S17_SHADOW, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0660);
+	if (shm_fd == -1)
+		return;
+
+	// driver processes of one user or group share the image
+	fchmod(shm_fd, 0660);
+
+	if (ftruncate(shm_fd, sizeof(PiFaceShadow)) == -1)
+	{
+		close(shm_fd);
+		return;
+	}
+
+	void *map = mmap(NULL, sizeof(PiFaceShadow), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	close(shm_fd);
+	if (map == MAP_FAILED)
+		return;
+
+	shadow = static_cast<PiFaceShadow *>(map);
+
+	// fresh image, latches are read from the chip on first use
+	Lock();
+	if (shadow->magic != MCP23S17_SHADOW_MAGIC)
+	{
+		memset(shadow, 0, sizeof(PiFaceShadow));
+		shadow->magic = MCP23S17_SHADOW_MAGIC;
+	}
+	Unlock();
+}
+void PiFaceMcp23s17::CloseShadow()
+{
+	if (shadow != &local_shadow)
+		munmap(shadow, sizeof(PiFaceShadow));
+
+	shadow = &local_shadow;
+}
+void PiFaceMcp23s17::Lock()
+{
+	if (simulated)
+		return;
+
+	// threads and devices of this process, then other processes
+	bus_mutex.lock();
+	if (lock_fd != -1)
+		flock(lock_fd, LOCK_EX);
+}
+void PiFaceMcp23s17::Unlock()
+{
+	if (simulated)
+		return;
+
+	if (lock_fd != -1)
+		flock(lock_fd, LOCK_UN);
+	bus_mutex.unlock();
+}
+bool PiFaceMcp23s17::OpenInterrupt()
+{
+	CloseInterrupt();
+
+	if (simulated)
+	{
+		if (pipe2(sim_irq, O_NONBLOCK | O_CLOEXEC) == -1)
+			return false;
+		irq_fd = sim_irq[0];
+		return true;
+	}
+
+	int chip_fd = open(MCP23S17_INT_CHIP, O_RDONLY | O_CLOEXEC);
+	if (chip_fd == -1)
+		return false;
+
+	// INT is active low
+	struct gpioevent_request req;
+	memset(&req, 0, sizeof(req));
+	req.lineoffset = MCP23S17_INT_LINE;
+	req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+	strncpy(req.consumer_label, "piface", sizeof(req.consumer_label) - 1);
+
+	int rc = ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req);
+	close(chip_fd);
+	if (rc == -1)
+		return false;
+
+	irq_fd = req.fd;
+	fcntl(irq_fd, F_SETFL, fcntl(irq_fd, F_GETFL) | O_NONBLOCK);
+
+	return true;
+}
+void PiFaceMcp23s17::CloseInterrupt()
+{
+	if (simulated)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			if (sim_irq[i] != -1)
+				close(sim_irq[i]);
+			sim_irq[i] = -1;
+		}
+	}
+	else if (irq_fd != -1)
+	{
+		close(irq_fd);
+	}
+	irq_fd = -1;
+}
+int PiFaceMcp23s17::InterruptFd()
+{
+	return irq_fd;
+}
+bool PiFaceMcp23s17::ReadInterrupt()
+{
+	bool events = false;
+
+	// drain all pending edges
+	if (simulated)
+	{
+		char buffer[16];
+		while (read(irq_fd, buffer, sizeof(buffer)) > 0)
+			events = true;
+	}
+	else
+	{
+		struct gpioevent_data event;
+		while (read(irq_fd, &event, sizeof(event)) == sizeof(event))
+			events = true;
+	}
+
+	return events;
+}
+
+/************************************************************************************
+*
+*               Simulated chip
+*
+*************************************************************************************/
+
+void PiFaceMcp23s17::SimReset()
+{
+	memset(sim_regs, 0, sizeof(sim_regs));
+	memset(sim_inputs, 0, sizeof(sim_inputs));
+	memset(sim_pins, 0, sizeof(sim_pins));
+
+	// power-on state, all pins inputs
+	for (int hw = 0; hw < MCP23S17_CHIPS; hw++)
+	{
+		sim_regs[hw][IODIRA] = 0xff;
+		sim_regs[hw][IODIRB] = 0xff;
+	}
+}
+uint8_t PiFaceMcp23s17::SimRead(uint8_t reg, uint8_t hw)
+{
+	if (hw >= MCP23S17_CHIPS || reg >= MCP23S17_REGS)
+		return 0;
+
+	uint8_t *regs = sim_regs[hw];
+	int port = reg & 1;
+
+	switch (reg)
+	{
+	case GPIOA:
+	case GPIOB:
+		// reading the port clears the interrupt
+		regs[INTFA + port] = 0;
+		return SimPins(hw, port);
+	case INTCAPA:
+	case INTCAPB:
+		regs[INTFA + port] = 0;
+		return regs[reg];
+	default:
+		return regs[reg];
+	}
+}
+void PiFaceMcp23s17::SimWrite(uint8_t data, uint8_t reg, uint8_t hw)
+{
+	if (hw >= MCP23S17_CHIPS || reg >= MCP23S17_REGS)
+		return;
+
+	uint8_t *regs = sim_regs[hw];
+
+	switch (reg)
+	{
+	case GPIOA:
+	case GPIOB:
+		// writes go to the output latch
+		regs[OLATA + (reg & 1)] = data;
+		break;
+	case INTFA:
+	case INTFB:
+	case INTCAPA:
+	case INTCAPB:
+		// read only
+		break;
+	default:
+		regs[reg] = data;
+	}
+
+	// pins follow latch and direction
+	if (reg == GPIOA || reg == GPIOB || reg == OLATA || reg == OLATB)
+		SimTrace(hw, reg & 1, true);
+	else if (reg == IODIRA || reg == IODIRB)
+		SimTrace(hw, reg & 1, false);
+}
+uint8_t PiFaceMcp23s17::SimPins(uint8_t hw, int port)
+{
+	uint8_t *regs = sim_regs[hw];
+	return (regs[OLATA + port] & ~regs[IODIRA + port]) | (sim_inputs[hw][port] & regs[IODIRA + port]);
+}
+void PiFaceMcp23s17::SimTrace(uint8_t hw, int port, bool write)
+{
+	uint8_t pins = SimPins(hw, port);
+	PiFaceVcd::Pins(hw, port, pins, pins ^ sim_pins[hw][port], write);
+	sim_pins[hw][port] = pins;
+}
+void PiFaceMcp23s17::SimSetInputs(uint8_t hw, int port, uint8_t levels)
+{
+	if (!simulated || hw >= MCP23S17_CHIPS)
+		return;
+
+	std::lock_guard<std::recursive_mutex> guard(access);
+
+	uint8_t *regs = sim_regs[hw];
+	uint8_t previous = sim_inputs[hw][port];
+	sim_inputs[hw][port] = levels;
+	SimTrace(hw, port, false);
+
+	// interrupt on change or on difference from DEFVAL
+	uint8_t enabled = regs[GPINTENA + port] & regs[IODIRA + port];
+	uint8_t compare = regs[INTCONA + port];
+	uint8_t triggered = enabled & ((~compare & (previous ^ levels)) | (compare & (regs[DEFVALA + port] ^ levels)));
+
+	// pending interrupt holds its capture until cleared
+	if (triggered == 0 || regs[INTFA + port] != 0)
+		return;
+
+	regs[INTFA + port] = triggered;
+	regs[INTCAPA + port] = SimPins(hw, port);
+
+	// falling edge on INT
+	char c = 1;
+	if (sim_irq[1] != -1 && write(sim_irq[1], &c, 1) == -1)
+		return;
+}
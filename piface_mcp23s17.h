@@ -0,0 +1,182 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACEMCP23S17_H
+#define PIFACEMCP23S17_H
+
+#include <stdint.h>
+#include <linux/spi/spidev.h>
+#include <mutex>
+
+#define MCP23S17_CHIPS 8
+#define MCP23S17_REGS 0x16
+
+// spidev clock, the chip is rated to 10 MHz
+#define MCP23S17_SPEED 10000000
+#define MCP23S17_MIN_SPEED 100000
+
+// opcode, address and up to one sequential pass over the register file
+#define MCP23S17_XFER (2 + MCP23S17_REGS)
+
+// register map, IOCON.BANK = 0
+constexpr uint8_t IODIRA = 0x00;
+constexpr uint8_t IODIRB = 0x01;
+constexpr uint8_t IPOLA = 0x02;
+constexpr uint8_t IPOLB = 0x03;
+constexpr uint8_t GPINTENA = 0x04;
+constexpr uint8_t GPINTENB = 0x05;
+constexpr uint8_t DEFVALA = 0x06;
+constexpr uint8_t DEFVALB = 0x07;
+constexpr uint8_t INTCONA = 0x08;
+constexpr uint8_t INTCONB = 0x09;
+constexpr uint8_t IOCON = 0x0a;
+constexpr uint8_t GPPUA = 0x0c;
+constexpr uint8_t GPPUB = 0x0d;
+constexpr uint8_t INTFA = 0x0e;
+constexpr uint8_t INTFB = 0x0f;
+constexpr uint8_t INTCAPA = 0x10;
+constexpr uint8_t INTCAPB = 0x11;
+constexpr uint8_t GPIOA = 0x12;
+constexpr uint8_t GPIOB = 0x13;
+constexpr uint8_t OLATA = 0x14;
+constexpr uint8_t OLATB = 0x15;
+
+// IOCON bits
+constexpr uint8_t BANK_OFF = 0x00;
+constexpr uint8_t BANK_ON = 0x80;
+constexpr uint8_t INT_MIRROR_ON = 0x40;
+constexpr uint8_t INT_MIRROR_OFF = 0x00;
+constexpr uint8_t SEQOP_OFF = 0x20;
+constexpr uint8_t SEQOP_ON = 0x00;
+constexpr uint8_t DISSLW_ON = 0x10;
+constexpr uint8_t DISSLW_OFF = 0x00;
+constexpr uint8_t HAEN_ON = 0x08;
+constexpr uint8_t HAEN_OFF = 0x00;
+constexpr uint8_t ODR_ON = 0x04;
+constexpr uint8_t ODR_OFF = 0x00;
+constexpr uint8_t INTPOL_HIGH = 0x02;
+constexpr uint8_t INTPOL_LOW = 0x00;
+
+// IOCON bits by owner, each writes only its own with WriteBits
+// bus owners: addressing, sequential mode and slew rate
+constexpr uint8_t IOCON_BUS_MASK = 0xb8;
+// input capture: INT pin mirroring, drive and polarity
+constexpr uint8_t IOCON_INT_MASK = 0x46;
+
+// device opcodes, hardware address in bits 1-3
+constexpr uint8_t MCP23S17_WRITE(uint8_t hw) { return 0x40 | ((hw & 7) << 1); }
+constexpr uint8_t MCP23S17_READ(uint8_t hw) { return 0x41 | ((hw & 7) << 1); }
+
+// output latch image shared by driver processes
+#define MCP23S17_SHADOW "/dev/shm/piface-mcp23s17"
+
+// bus lock of driver processes, per spidev bus and chip select
+#define MCP23S17_LOCK "/dev/shm/piface-spidev%d.%d.lock"
+#define MCP23S17_SHADOW_MAGIC 0x50494631
+
+struct PiFaceShadow
+{
+	uint32_t magic;
+	uint8_t latch[MCP23S17_CHIPS][2];
+	uint8_t valid[MCP23S17_CHIPS][2];
+};
+
+// PiFace interrupt line on the Raspberry Pi header
+#define MCP23S17_INT_CHIP "/dev/gpiochip0"
+#define MCP23S17_INT_LINE 25
+
+// MCP23S17 access for the drivers.
+// Registers go to the chip through spidev, or to an in-memory register
+// file when simulated. Every access reuses one preallocated transfer, and
+// ReadRegs/WriteRegs move a run of registers in a single transfer when
+// IOCON has SEQOP_ON. Devices hosted in one process share the spidev handle.
+// Latch updates are serialized by a process mutex and flock on a lock file
+// opened per device, and the output latches are kept in an image shared by
+// driver processes, so each owner updates only its own bits with WriteBits
+// and no read-back. A handle may be used by the event loop and the focuser
+// motion thread at once, its registers and transfer buffers are guarded.
+// The simulated chip behaves like the real one for GPIO, OLAT and interrupt
+// capture so inputs can be exercised off-site, and its pin levels can be
+// dumped as a VCD waveform (PIFACE_VCD, see piface_vcd.h).
+class PiFaceMcp23s17
+{
+private:
+	int fd;
+	int spi_bus;
+	int spi_cs;
+	bool simulated;
+	int irq_fd;
+	int lock_fd;
+	int sim_irq[2];
+	uint8_t sim_regs[MCP23S17_CHIPS][MCP23S17_REGS];
+	uint8_t sim_inputs[MCP23S17_CHIPS][2];
+	uint8_t sim_pins[MCP23S17_CHIPS][2];
+	unsigned long spi_reads;
+	unsigned long spi_writes;
+	uint32_t spi_speed;
+	uint8_t tx[MCP23S17_XFER];
+	uint8_t rx[MCP23S17_XFER];
+	struct spi_ioc_transfer xfer;
+	std::recursive_mutex access;
+	bool Transfer(int len);
+	PiFaceShadow *shadow;
+	PiFaceShadow local_shadow;
+	void OpenShadow();
+	void CloseShadow();
+	void Lock();
+	void Unlock();
+	uint8_t SimRead(uint8_t reg, uint8_t hw);
+	void SimWrite(uint8_t data, uint8_t reg, uint8_t hw);
+	void SimReset();
+	uint8_t SimPins(uint8_t hw, int port);
+	void SimTrace(uint8_t hw, int port, bool write);
+public:
+	enum
+	{
+		PORT_A = 0,
+		PORT_B = 1
+	};
+
+	PiFaceMcp23s17();
+	~PiFaceMcp23s17();
+
+	bool Open(int bus, int chip_select, bool simulation, uint32_t speed = MCP23S17_SPEED);
+	void Close();
+	bool IsOpen();
+	bool IsSimulated();
+
+	uint8_t ReadReg(uint8_t reg, uint8_t hw);
+	void WriteReg(uint8_t data, uint8_t reg, uint8_t hw);
+	void WriteBits(uint8_t data, uint8_t mask, uint8_t reg, uint8_t hw);
+	uint8_t Latch(uint8_t reg, uint8_t hw);
+	bool ReadRegs(uint8_t *data, int count, uint8_t reg, uint8_t hw);
+	bool WriteRegs(const uint8_t *data, int count, uint8_t reg, uint8_t hw);
+	void SetSpeed(uint32_t speed);
+	uint32_t Speed();
+	unsigned long Reads();
+	unsigned long Writes();
+
+	bool OpenInterrupt();
+	void CloseInterrupt();
+	int InterruptFd();
+	bool ReadInterrupt();
+
+	void SimSetInputs(uint8_t hw, int port, uint8_t levels);
+};
+
+#endif
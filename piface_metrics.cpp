@@ -0,0 +1,264 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <indidevapi.h>
+
+#include "piface_metrics.h"
+
+PiFaceMetrics::PiFaceMetrics()
+{
+	listen_fd = -1;
+	listen_cb = -1;
+	socket_path[0] = 0;
+	device[0] = 0;
+	staging_len = 0;
+	snapshot_len = 0;
+	last_name = NULL;
+
+	for (int i = 0; i < METRICS_CLIENTS; i++)
+	{
+		client_fd[i] = -1;
+		client_cb[i] = -1;
+	}
+}
+PiFaceMetrics::~PiFaceMetrics()
+{
+	Stop();
+}
+bool PiFaceMetrics::Start(const char *endpoint, const char *device_name)
+{
+	Stop();
+
+	if (endpoint == NULL || endpoint[0] == 0)
+		return false;
+
+	snprintf(device, sizeof(device), "%s", device_name);
+
+	if (endpoint[0] == '/')
+	{
+		// unix socket
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(endpoint) >= sizeof(addr.sun_path))
+			return false;
+		strcpy(addr.sun_path, endpoint);
+
+		// a stale socket is replaced, any other file is left alone
+		struct stat st;
+		if (lstat(endpoint, &st) == 0)
+		{
+			if (!S_ISSOCK(st.st_mode))
+				return false;
+			unlink(endpoint);
+		}
+
+		listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listen_fd == -1)
+			return false;
+
+		if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+		{
+			Stop();
+			return false;
+		}
+		snprintf(socket_path, sizeof(socket_path), "%s", endpoint);
+	}
+	else
+	{
+		// [address:]port, loopback unless an address is given
+		char host[64] = "127.0.0.1";
+		const char *colon = strrchr(endpoint, ':');
+		int port = atoi(colon ? colon + 1 : endpoint);
+		if (colon && colon - endpoint < (int) sizeof(host))
+		{
+			memcpy(host, endpoint, colon - endpoint);
+			host[colon - endpoint] = 0;
+			if (!strcmp(host, "localhost"))
+				strcpy(host, "127.0.0.1");
+		}
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		if (port <= 0 || port > 65535 || inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+			return false;
+
+		listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (listen_fd == -1)
+			return false;
+
+		int on = 1;
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+		{
+			Stop();
+			return false;
+		}
+	}
+
+	if (listen(listen_fd, METRICS_CLIENTS) == -1)
+	{
+		Stop();
+		return false;
+	}
+
+	listen_cb = IEAddCallback(listen_fd, AcceptCallback, this);
+	return true;
+}
+void PiFaceMetrics::Stop()
+{
+	for (int i = 0; i < METRICS_CLIENTS; i++)
+		CloseClient(i);
+
+	if (listen_cb != -1)
+	{
+		IERmCallback(listen_cb);
+		listen_cb = -1;
+	}
+	if (listen_fd != -1)
+	{
+		close(listen_fd);
+		listen_fd = -1;
+	}
+	if (socket_path[0])
+	{
+		struct stat st;
+		if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode))
+			unlink(socket_path);
+		socket_path[0] = 0;
+	}
+}
+bool PiFaceMetrics::IsStarted()
+{
+	return listen_fd != -1;
+}
+void PiFaceMetrics::AcceptCallback(int fd, void *p)
+{
+	INDI_UNUSED(fd);
+	static_cast<PiFaceMetrics *>(p)->Accept();
+}
+void PiFaceMetrics::Accept()
+{
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd == -1)
+		return;
+
+	for (int i = 0; i < METRICS_CLIENTS; i++)
+	{
+		if (client_fd[i] == -1)
+		{
+			client_fd[i] = fd;
+			client_cb[i] = IEAddCallback(fd, ClientCallback, this);
+			return;
+		}
+	}
+
+	// too many scrapers
+	close(fd);
+}
+void PiFaceMetrics::ClientCallback(int fd, void *p)
+{
+	static_cast<PiFaceMetrics *>(p)->Serve(fd);
+}
+void PiFaceMetrics::Serve(int fd)
+{
+	int slot = -1;
+	for (int i = 0; i < METRICS_CLIENTS; i++)
+		if (client_fd[i] == fd)
+			slot = i;
+	if (slot == -1)
+		return;
+
+	char request[512];
+	ssize_t n = read(fd, request, sizeof(request));
+	if (n == -1 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	// answer the first request and close, the snapshot fits the socket buffer
+	if (n > 0)
+	{
+		char header[160];
+		int len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", snapshot_len);
+		if (send(fd, header, len, MSG_NOSIGNAL | MSG_DONTWAIT | MSG_MORE) == len)
+			send(fd, snapshot, snapshot_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+	}
+
+	CloseClient(slot);
+}
+void PiFaceMetrics::CloseClient(int slot)
+{
+	if (client_cb[slot] != -1)
+	{
+		IERmCallback(client_cb[slot]);
+		client_cb[slot] = -1;
+	}
+	if (client_fd[slot] != -1)
+	{
+		close(client_fd[slot]);
+		client_fd[slot] = -1;
+	}
+}
+void PiFaceMetrics::Begin()
+{
+	staging_len = 0;
+	last_name = NULL;
+}
+void PiFaceMetrics::Append(const char *name, const char *help, const char *type, double value, const char *labels)
+{
+	int room = METRICS_SIZE - staging_len;
+	int n = 0;
+
+	// type header once per metric family
+	if (last_name == NULL || strcmp(last_name, name))
+		n = snprintf(staging + staging_len, room, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+	if (n >= room)
+		return;
+
+	int m = snprintf(staging + staging_len + n, room - n, "%s{device=\"%s\"%s%s} %.15g\n", name, device, labels ? "," : "", labels ? labels : "", value);
+	if (m >= room - n)
+		return;
+
+	staging_len += n + m;
+	last_name = name;
+}
+void PiFaceMetrics::Counter(const char *name, const char *help, double value, const char *labels)
+{
+	Append(name, help, "counter", value, labels);
+}
+void PiFaceMetrics::Gauge(const char *name, const char *help, double value, const char *labels)
+{
+	Append(name, help, "gauge", value, labels);
+}
+void PiFaceMetrics::Commit()
+{
+	memcpy(snapshot, staging, staging_len);
+	snapshot_len = staging_len;
+}
@@ -0,0 +1,66 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACEMETRICS_H
+#define PIFACEMETRICS_H
+
+#define METRICS_CLIENTS 4
+#define METRICS_SIZE 8192
+
+// Prometheus text endpoint.
+// Listens on a loopback TCP port ("9101", "127.0.0.1:9101") or a unix
+// socket ("/run/piface.sock") from the INDI event loop; an existing path is
+// only replaced when it is a socket. The driver builds
+// a snapshot with Begin/Counter/Gauge/Commit when its values change and a
+// scrape only copies the last committed snapshot, so it never touches the
+// hardware or waits on motion.
+class PiFaceMetrics
+{
+private:
+	int listen_fd;
+	int listen_cb;
+	int client_fd[METRICS_CLIENTS];
+	int client_cb[METRICS_CLIENTS];
+	char socket_path[108];
+	char device[64];
+	char staging[METRICS_SIZE];
+	int staging_len;
+	char snapshot[METRICS_SIZE];
+	int snapshot_len;
+	const char *last_name;
+	static void AcceptCallback(int fd, void *p);
+	static void ClientCallback(int fd, void *p);
+	void Accept();
+	void Serve(int fd);
+	void CloseClient(int slot);
+	void Append(const char *name, const char *help, const char *type, double value, const char *labels);
+public:
+	PiFaceMetrics();
+	~PiFaceMetrics();
+
+	bool Start(const char *endpoint, const char *device_name);
+	void Stop();
+	bool IsStarted();
+
+	void Begin();
+	void Counter(const char *name, const char *help, double value, const char *labels = 0);
+	void Gauge(const char *name, const char *help, double value, const char *labels = 0);
+	void Commit();
+};
+
+#endif
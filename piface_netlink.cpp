@@ -0,0 +1,158 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "piface_netlink.h"
+
+PiFaceNetLink::PiFaceNetLink()
+{
+	netlink_fd = -1;
+}
+PiFaceNetLink::~PiFaceNetLink()
+{
+	Close();
+}
+bool PiFaceNetLink::Open()
+{
+	Close();
+
+	netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (netlink_fd == -1)
+		return false;
+
+	struct sockaddr_nl addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+	if (bind(netlink_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+void PiFaceNetLink::Close()
+{
+	if (netlink_fd != -1)
+		close(netlink_fd);
+	netlink_fd = -1;
+}
+int PiFaceNetLink::Fd()
+{
+	return netlink_fd;
+}
+bool PiFaceNetLink::Process()
+{
+	bool changed = false;
+	ssize_t len;
+
+	// drain all pending messages
+	for (;;)
+	{
+		len = recv(netlink_fd, buffer, sizeof(buffer), 0);
+		if (len == -1 && errno == EINTR)
+			continue;
+
+		// receive buffer overran, dropped messages may hold a change
+		if (len == -1 && errno == ENOBUFS)
+		{
+			changed = true;
+			continue;
+		}
+		if (len <= 0)
+			break;
+
+		for (struct nlmsghdr *nh = (struct nlmsghdr *) buffer; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+		{
+			if (nh->nlmsg_type == RTM_NEWADDR || nh->nlmsg_type == RTM_DELADDR)
+				changed = true;
+		}
+	}
+
+	return changed;
+}
+bool PiFaceNetLink::Hostname(char *text, size_t len)
+{
+	if (gethostname(text, len) == -1)
+		return false;
+
+	text[len - 1] = '\0';
+	return true;
+}
+bool PiFaceNetLink::LocalAddresses(char *text, size_t len)
+{
+	struct ifaddrs *ifaddr;
+	char address[INET6_ADDRSTRLEN];
+	size_t n = 0;
+
+	if (getifaddrs(&ifaddr) == -1)
+		return false;
+
+	text[0] = '\0';
+
+	// same order as hostname -I, IPv4 before IPv6
+	for (int family = AF_INET; ; family = AF_INET6)
+	{
+		for (struct ifaddrs *ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next)
+		{
+			if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != family || (ifa->ifa_flags & IFF_LOOPBACK))
+				continue;
+
+			if (family == AF_INET)
+			{
+				struct sockaddr_in *sin = (struct sockaddr_in *) ifa->ifa_addr;
+				inet_ntop(AF_INET, &sin->sin_addr, address, sizeof(address));
+			}
+			else
+			{
+				// skip link-local like hostname -I
+				struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ifa->ifa_addr;
+				if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr))
+					continue;
+				inet_ntop(AF_INET6, &sin6->sin6_addr, address, sizeof(address));
+			}
+
+			int r = snprintf(text + n, len - n, "%s%s", n ? " " : "", address);
+			if (r < 0 || (size_t) r >= len - n)
+			{
+				text[n] = '\0';
+				break;
+			}
+			n += r;
+		}
+
+		if (family == AF_INET6)
+			break;
+	}
+
+	freeifaddrs(ifaddr);
+	return true;
+}
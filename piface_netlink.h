@@ -0,0 +1,46 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACENETLINK_H
+#define PIFACENETLINK_H
+
+#include <stddef.h>
+
+// Listener for rtnetlink address events (RTM_NEWADDR/RTM_DELADDR).
+// The socket is non-blocking and meant to be registered with the INDI
+// event loop; addresses are taken with getifaddrs when an event arrives.
+class PiFaceNetLink
+{
+private:
+	int netlink_fd;
+	char buffer[8192];
+public:
+	PiFaceNetLink();
+	~PiFaceNetLink();
+
+	bool Open();
+	void Close();
+	int Fd();
+
+	bool Process();
+
+	static bool Hostname(char *text, size_t len);
+	static bool LocalAddresses(char *text, size_t len);
+};
+
+#endif
@@ -0,0 +1,377 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <eventloop.h>
+#include <indidevapi.h>
+
+#include "piface_persist.h"
+
+static PiFacePersist *stores[PERSIST_MAX_STORES];
+static int signal_fd[2] = { -1, -1 };
+
+// monotonic clock in milliseconds
+static long long NowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void SignalHandler(int sig)
+{
+	// only the event loop may touch the drivers
+	int saved = errno;
+	char c = (char) sig;
+	if (write(signal_fd[1], &c, 1) == -1)
+		_exit(128 + sig);
+	errno = saved;
+}
+
+PiFacePersist::PiFacePersist()
+{
+	has_pending = false;
+	writing = false;
+	stopping = false;
+	files = skipped = errors = 0;
+	path[0] = 0;
+	writer_fp = NULL;
+	writer_p = NULL;
+	dirty = false;
+	first_dirty = 0;
+	timer_id = -1;
+}
+PiFacePersist::~PiFacePersist()
+{
+	Close();
+}
+bool PiFacePersist::Open(const char *device, Writer *fp, void *p)
+{
+	Close();
+
+	// same location as IUGetConfigFP
+	const char *config = getenv("INDICONFIG");
+	if (config != NULL && config[0] != 0)
+		snprintf(path, sizeof(path), "%s", config);
+	else
+	{
+		const char *home = getenv("HOME");
+		if (home == NULL)
+			return false;
+		snprintf(path, sizeof(path), "%s/.indi", home);
+		if (mkdir(path, 0755) == -1 && errno != EEXIST)
+			return false;
+		snprintf(path, sizeof(path), "%s/.indi/%s_config.xml", home, device);
+	}
+
+	writer_fp = fp;
+	writer_p = p;
+	written.clear();
+	stopping = false;
+	worker = std::thread(&PiFacePersist::Run, this);
+
+	InstallSignals();
+	for (int i = 0; i < PERSIST_MAX_STORES; i++)
+	{
+		if (stores[i] == NULL)
+		{
+			stores[i] = this;
+			break;
+		}
+	}
+
+	return true;
+}
+void PiFacePersist::Close()
+{
+	if (!worker.joinable())
+		return;
+
+	for (int i = 0; i < PERSIST_MAX_STORES; i++)
+		if (stores[i] == this)
+			stores[i] = NULL;
+
+	// last changes go out before the worker stops
+	if (dirty)
+		Flush();
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_one();
+	worker.join();
+}
+bool PiFacePersist::IsOpen()
+{
+	return worker.joinable();
+}
+void PiFacePersist::MarkDirty()
+{
+	if (!IsOpen())
+		return;
+
+	long long now = NowMs();
+	if (!dirty)
+	{
+		dirty = true;
+		first_dirty = now;
+	}
+
+	// restart the quiet period, but never past the longest delay
+	long long delay = PERSIST_DEBOUNCE_MS;
+	if (now + delay > first_dirty + PERSIST_MAX_DELAY_MS)
+		delay = first_dirty + PERSIST_MAX_DELAY_MS - now;
+	if (delay < 0)
+		delay = 0;
+
+	if (timer_id != -1)
+		IERmTimer(timer_id);
+	timer_id = IEAddTimer((int) delay, DebounceTimeout, this);
+}
+void PiFacePersist::DebounceTimeout(void *p)
+{
+	PiFacePersist *persist = static_cast<PiFacePersist *>(p);
+	persist->timer_id = -1;
+	persist->Flush();
+}
+bool PiFacePersist::Flush()
+{
+	if (timer_id != -1)
+	{
+		IERmTimer(timer_id);
+		timer_id = -1;
+	}
+	dirty = false;
+
+	if (!IsOpen())
+		return false;
+
+	// generate on the event loop, properties are not shared with the worker
+	char *buffer = NULL;
+	size_t size = 0;
+	FILE *fp = open_memstream(&buffer, &size);
+	if (fp == NULL)
+		return false;
+	bool rc = writer_fp(fp, writer_p);
+	fclose(fp);
+
+	if (rc)
+	{
+		// a newer config replaces one not yet written
+		std::lock_guard<std::mutex> guard(lock);
+		pending.assign(buffer, size);
+		has_pending = true;
+	}
+	free(buffer);
+
+	if (rc)
+		wake.notify_one();
+	return rc;
+}
+bool PiFacePersist::Sync()
+{
+	unsigned long before;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		before = errors;
+	}
+
+	if (!Flush())
+		return false;
+
+	Wait();
+
+	std::lock_guard<std::mutex> guard(lock);
+	return errors == before;
+}
+void PiFacePersist::Wait()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (has_pending || writing)
+		idle.wait(guard);
+}
+void PiFacePersist::Run()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	for (;;)
+	{
+		while (!has_pending && !stopping)
+			wake.wait(guard);
+		if (!has_pending)
+			break;
+
+		std::string data;
+		data.swap(pending);
+		has_pending = false;
+		writing = true;
+		guard.unlock();
+
+		// unchanged config costs no write
+		bool same = data == written;
+		bool rc = same || WriteFile(data);
+		if (rc && !same)
+			written.swap(data);
+
+		guard.lock();
+		writing = false;
+		if (!rc)
+			errors++;
+		else if (same)
+			skipped++;
+		else
+			files++;
+		idle.notify_all();
+	}
+}
+bool PiFacePersist::WriteFile(const std::string &data)
+{
+	char tmp[sizeof(path) + 8];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+	{
+		perror("PiFacePersist open");
+		return false;
+	}
+
+	const char *p = data.data();
+	size_t left = data.size();
+	while (left > 0)
+	{
+		ssize_t n = write(fd, p, left);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			perror("PiFacePersist write");
+			close(fd);
+			unlink(tmp);
+			return false;
+		}
+		p += n;
+		left -= n;
+	}
+
+	// data first, then the rename, then the directory entry
+	if (fsync(fd) == -1 || close(fd) == -1)
+	{
+		perror("PiFacePersist fsync");
+		unlink(tmp);
+		return false;
+	}
+	if (rename(tmp, path) == -1)
+	{
+		perror("PiFacePersist rename");
+		unlink(tmp);
+		return false;
+	}
+
+	char dir[sizeof(path)];
+	snprintf(dir, sizeof(dir), "%s", path);
+	char *slash = strrchr(dir, '/');
+	if (slash == NULL)
+		snprintf(dir, sizeof(dir), ".");
+	else if (slash == dir)
+		slash[1] = 0;
+	else
+		*slash = 0;
+
+	int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd != -1)
+	{
+		fsync(dfd);
+		close(dfd);
+	}
+
+	return true;
+}
+void PiFacePersist::InstallSignals()
+{
+	if (signal_fd[0] != -1)
+		return;
+	if (pipe2(signal_fd, O_NONBLOCK | O_CLOEXEC) == -1)
+		return;
+
+	IEAddCallback(signal_fd[0], SignalCallback, NULL);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SignalHandler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGHUP, &sa, NULL);
+
+	// indiserver closing stdin ends the driver with exit()
+	atexit(SyncAll);
+}
+void PiFacePersist::SignalCallback(int fd, void *p)
+{
+	char sig;
+	if (read(fd, &sig, 1) != 1)
+		return;
+
+	SyncAll();
+
+	// terminate as the signal would have
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+void PiFacePersist::SyncAll()
+{
+	for (int i = 0; i < PERSIST_MAX_STORES; i++)
+	{
+		if (stores[i] == NULL)
+			continue;
+
+		// a write already queued must land too
+		if (stores[i]->dirty)
+			stores[i]->Sync();
+		else
+			stores[i]->Wait();
+	}
+}
+const char *PiFacePersist::Path()
+{
+	return path;
+}
+unsigned long PiFacePersist::Files()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return files;
+}
+unsigned long PiFacePersist::Skipped()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return skipped;
+}
+unsigned long PiFacePersist::Errors()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return errors;
+}
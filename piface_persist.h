@@ -0,0 +1,89 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACEPERSIST_H
+#define PIFACEPERSIST_H
+
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// quiet time after the last change before config is written
+#define PERSIST_DEBOUNCE_MS 2000
+// longest a change waits while changes keep coming
+#define PERSIST_MAX_DELAY_MS 10000
+// devices sharing one process
+#define PERSIST_MAX_STORES 4
+
+// Debounced config persistence.
+// Drivers mark their state dirty instead of saving on every command; the
+// config is generated in memory on the event loop once changes settle and
+// a background thread writes it to <file>.tmp, fsyncs and renames it over
+// the device config, skipping writes that would not change the file.
+// Disconnect, SIGTERM, SIGINT, SIGHUP and exit flush pending changes.
+class PiFacePersist
+{
+public:
+	typedef bool (Writer)(FILE *fp, void *p);
+private:
+	std::thread worker;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::string pending;
+	std::string written;
+	bool has_pending;
+	bool writing;
+	bool stopping;
+	unsigned long files;
+	unsigned long skipped;
+	unsigned long errors;
+	char path[1024];
+	Writer *writer_fp;
+	void *writer_p;
+	bool dirty;
+	long long first_dirty;
+	int timer_id;
+	void Run();
+	bool WriteFile(const std::string &data);
+	void Wait();
+	static void DebounceTimeout(void *p);
+	static void InstallSignals();
+	static void SignalCallback(int fd, void *p);
+	static void SyncAll();
+public:
+	PiFacePersist();
+	~PiFacePersist();
+
+	bool Open(const char *device, Writer *fp, void *p);
+	void Close();
+	bool IsOpen();
+
+	void MarkDirty();
+	bool Flush();
+	bool Sync();
+
+	const char *Path();
+	unsigned long Files();
+	unsigned long Skipped();
+	unsigned long Errors();
+};
+
+#endif
@@ -0,0 +1,280 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <chrono>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "piface_realtime.h"
+
+// touch the stack below the caller, kept out of line so it really grows
+static void __attribute__((noinline)) PrefaultStack()
+{
+	volatile char stack[REALTIME_PREFAULT_STACK];
+	for (size_t i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+PiFaceRealtime::PiFaceRealtime()
+{
+	priority = 0;
+	cpu = -1;
+	lock_stack = false;
+	prefault = false;
+	region = NULL;
+	region_len = 0;
+	requested = 0;
+	effective = 0;
+	running = false;
+	ready = false;
+	quit = false;
+	job_fp = NULL;
+	job_p = NULL;
+	busy = false;
+	done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	UpdateStatus();
+}
+PiFaceRealtime::~PiFaceRealtime()
+{
+	Release();
+	if (done_fd != -1)
+		close(done_fd);
+}
+int PiFaceRealtime::Configure(int fifo_priority, int cpu_index, bool lock_memory, bool prefault_stack,
+	const void *lock_region, size_t lock_len)
+{
+	Release();
+
+	priority = fifo_priority;
+	cpu = cpu_index;
+	lock_stack = lock_memory;
+	prefault = prefault_stack;
+	region = lock_region;
+	region_len = lock_len;
+
+	requested = 0;
+	if (priority > 0)
+		requested |= RT_FIFO;
+	if (lock_memory)
+		requested |= RT_MLOCK;
+	if (cpu >= 0)
+		requested |= RT_AFFINITY;
+	if (prefault_stack)
+		requested |= RT_PREFAULT;
+	effective = 0;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, REALTIME_THREAD_STACK);
+	ready = quit = false;
+	running = pthread_create(&thread, &attr, ThreadMain, this) == 0;
+	pthread_attr_destroy(&attr);
+
+	// the thread reports which settings it could apply to itself
+	if (running)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		idle.wait(guard, [this] { return ready; });
+	}
+
+	UpdateStatus();
+	return effective;
+}
+void PiFaceRealtime::Release()
+{
+	if (running)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			quit = true;
+		}
+		wake.notify_one();
+		pthread_join(thread, NULL);
+		running = false;
+	}
+
+	// the stack went with the thread
+	if (effective & RT_MLOCK && region != NULL)
+		munlock(region, region_len);
+
+	effective = requested = 0;
+	priority = 0;
+	cpu = -1;
+	region = NULL;
+	region_len = 0;
+	UpdateStatus();
+}
+void PiFaceRealtime::Start(Job *fp, void *p)
+{
+	if (!running)
+	{
+		fp(p);
+		Signal();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		job_fp = fp;
+		job_p = p;
+		busy = true;
+	}
+	wake.notify_one();
+}
+bool PiFaceRealtime::Wait(int timeout)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	return idle.wait_for(guard, std::chrono::milliseconds(timeout), [this] { return !busy; });
+}
+int PiFaceRealtime::DoneFd()
+{
+	return done_fd;
+}
+bool PiFaceRealtime::Done()
+{
+	// clears the signal, several finished jobs read as one
+	uint64_t count = 0;
+	return done_fd != -1 && read(done_fd, &count, sizeof(count)) == sizeof(count) && count > 0;
+}
+void PiFaceRealtime::Signal()
+{
+	uint64_t one = 1;
+	if (done_fd != -1 && write(done_fd, &one, sizeof(one)) != sizeof(one))
+		perror("PiFaceRealtime signal");
+}
+void *PiFaceRealtime::ThreadMain(void *p)
+{
+	static_cast<PiFaceRealtime *>(p)->Run();
+	return NULL;
+}
+void PiFaceRealtime::Run()
+{
+	int applied = Setup();
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		effective = applied;
+		ready = true;
+	}
+	idle.notify_all();
+
+	std::unique_lock<std::mutex> guard(lock);
+	for (;;)
+	{
+		wake.wait(guard, [this] { return quit || busy; });
+		if (quit)
+			break;
+
+		// the job runs unlocked, Wait only looks at busy
+		Job *fp = job_fp;
+		void *p = job_p;
+		guard.unlock();
+		fp(p);
+		guard.lock();
+
+		busy = false;
+		idle.notify_all();
+		Signal();
+	}
+}
+int PiFaceRealtime::Setup()
+{
+	int applied = 0;
+
+	// EPERM without CAP_SYS_NICE or RLIMIT_RTPRIO, motion runs as before
+	if (priority > 0)
+	{
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0)
+			applied |= RT_FIFO;
+	}
+
+	if (cpu >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0)
+			applied |= RT_AFFINITY;
+	}
+
+	// this thread's stack and the caller's region only, RLIMIT_MEMLOCK permitting
+	if (lock_stack)
+	{
+		pthread_attr_t attr;
+		void *stack = NULL;
+		size_t size = 0;
+		bool ok = pthread_getattr_np(pthread_self(), &attr) == 0;
+		if (ok)
+		{
+			ok = pthread_attr_getstack(&attr, &stack, &size) == 0 && mlock(stack, size) == 0;
+			pthread_attr_destroy(&attr);
+		}
+		if (ok && region != NULL && mlock(region, region_len) != 0)
+		{
+			munlock(stack, size);
+			ok = false;
+		}
+		if (ok)
+			applied |= RT_MLOCK;
+	}
+
+	// faulted pages are only guaranteed to stay when locked
+	if (prefault)
+	{
+		PrefaultStack();
+		applied |= RT_PREFAULT;
+	}
+
+	return applied;
+}
+int PiFaceRealtime::Requested()
+{
+	return requested;
+}
+int PiFaceRealtime::Effective()
+{
+	return effective;
+}
+const char *PiFaceRealtime::Status()
+{
+	return status;
+}
+void PiFaceRealtime::UpdateStatus()
+{
+	int len = 0;
+	status[0] = 0;
+
+	if (requested & RT_FIFO)
+		len += snprintf(status + len, sizeof(status) - len, "%sfifo %d %s", len ? ", " : "", priority, effective & RT_FIFO ? "ok" : "denied");
+	if (requested & RT_MLOCK)
+		len += snprintf(status + len, sizeof(status) - len, "%smlock %s", len ? ", " : "", effective & RT_MLOCK ? "ok" : "denied");
+	if (requested & RT_AFFINITY)
+		len += snprintf(status + len, sizeof(status) - len, "%scpu %d %s", len ? ", " : "", cpu, effective & RT_AFFINITY ? "ok" : "denied");
+	if (requested & RT_PREFAULT)
+		len += snprintf(status + len, sizeof(status) - len, "%sstack %dk ok", len ? ", " : "", REALTIME_PREFAULT_STACK / 1024);
+
+	if (len == 0)
+		snprintf(status, sizeof(status), "off");
+}
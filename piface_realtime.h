@@ -0,0 +1,100 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACEREALTIME_H
+#define PIFACEREALTIME_H
+
+#include <sched.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <mutex>
+#include <condition_variable>
+
+// stack touched up front so motion never takes a page fault on it
+#define REALTIME_PREFAULT_STACK (256 * 1024)
+
+// motion thread stack, room for the prefaulted part and the step loop
+#define REALTIME_THREAD_STACK (512 * 1024)
+
+// Dedicated thread executing focuser motion.
+// Configure starts the thread and applies the settings to it alone:
+// SCHED_FIFO priority, CPU affinity, a prefaulted stack and, with memory
+// locking, mlock of its stack and of the region given by the caller. The
+// event loop thread keeps its normal scheduling and the rest of the process
+// stays pageable; code pages are not locked. Settings the process is not
+// allowed to use are skipped and left out of Effective(). Start returns at
+// once and every finished job is signalled on DoneFd for the event loop.
+// Without a thread, Start runs the job on the caller and signals it the
+// same way.
+class PiFaceRealtime
+{
+public:
+	typedef void (Job)(void *p);
+private:
+	int priority;
+	int cpu;
+	bool lock_stack;
+	bool prefault;
+	const void *region;
+	size_t region_len;
+	int requested;
+	int effective;
+	pthread_t thread;
+	bool running;
+	bool ready;
+	bool quit;
+	Job *job_fp;
+	void *job_p;
+	bool busy;
+	int done_fd;
+	void Signal();
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	char status[128];
+	static void *ThreadMain(void *p);
+	void Run();
+	int Setup();
+	void UpdateStatus();
+public:
+	enum
+	{
+		RT_FIFO = 1,
+		RT_MLOCK = 2,
+		RT_AFFINITY = 4,
+		RT_PREFAULT = 8
+	};
+
+	PiFaceRealtime();
+	~PiFaceRealtime();
+
+	int Configure(int fifo_priority, int cpu_index, bool lock_memory, bool prefault_stack,
+		const void *lock_region = NULL, size_t lock_len = 0);
+	void Release();
+
+	void Start(Job *fp, void *p);
+	bool Wait(int timeout);
+	int DoneFd();
+	bool Done();
+
+	int Requested();
+	int Effective();
+	const char *Status();
+};
+
+#endif
@@ -0,0 +1,89 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "piface_recorder.h"
+
+static FILE *record_fp = NULL;
+static bool record_checked = false;
+static long long record_start = 0;
+
+static long long MonotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+bool PiFaceRecorder::Open()
+{
+	// environment is looked up once
+	if (!record_checked)
+	{
+		record_checked = true;
+		const char *path = getenv(RECORDER_ENV);
+		if (path != NULL && path[0] != 0)
+		{
+			record_fp = fopen(path, "a");
+			record_start = MonotonicNs();
+		}
+	}
+
+	return record_fp != NULL;
+}
+void PiFaceRecorder::Begin(const char *type, const char *dev, const char *name)
+{
+	fprintf(record_fp, "%lld\t%s\t%s\t%s", MonotonicNs() - record_start, type, dev ? dev : "", name);
+}
+void PiFaceRecorder::Switch(const char *dev, const char *name, ISState *states, char *names[], int n)
+{
+	if (!Open())
+		return;
+
+	Begin("switch", dev, name);
+	for (int i = 0; i < n; i++)
+		fprintf(record_fp, "\t%s=%s", names[i], states[i] == ISS_ON ? "On" : "Off");
+	fputc('\n', record_fp);
+	fflush(record_fp);
+}
+void PiFaceRecorder::Number(const char *dev, const char *name, double values[], char *names[], int n)
+{
+	if (!Open())
+		return;
+
+	Begin("number", dev, name);
+	for (int i = 0; i < n; i++)
+		fprintf(record_fp, "\t%s=%.17g", names[i], values[i]);
+	fputc('\n', record_fp);
+	fflush(record_fp);
+}
+void PiFaceRecorder::Text(const char *dev, const char *name, char *texts[], char *names[], int n)
+{
+	if (!Open())
+		return;
+
+	// texts are single line values
+	Begin("text", dev, name);
+	for (int i = 0; i < n; i++)
+		fprintf(record_fp, "\t%s=%s", names[i], texts[i]);
+	fputc('\n', record_fp);
+	fflush(record_fp);
+}
@@ -0,0 +1,43 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACERECORDER_H
+#define PIFACERECORDER_H
+
+#include <indiapi.h>
+
+// environment variable naming the recording file
+#define RECORDER_ENV "PIFACE_RECORD"
+
+// Command stream recorder.
+// When PIFACE_RECORD is set, every client request reaching the driver entry
+// points is appended to that file as one tab separated line:
+//   <ns since start> <switch|number|text> <device> <property> <elem>=<value>...
+// tools/piface_replay feeds a recording back into the simulated drivers.
+class PiFaceRecorder
+{
+private:
+	static bool Open();
+	static void Begin(const char *type, const char *dev, const char *name);
+public:
+	static void Switch(const char *dev, const char *name, ISState *states, char *names[], int n);
+	static void Number(const char *dev, const char *name, double values[], char *names[], int n);
+	static void Text(const char *dev, const char *name, char *texts[], char *names[], int n);
+};
+
+#endif
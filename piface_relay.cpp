@@ -20,8 +20,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <memory>
+#include <algorithm>
 #include <string.h>
-#include <mcp23s17.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
 
 #include "piface_relay.h"
 
@@ -30,106 +32,194 @@
 
 #define CHECK_BIT(var,pos) (((var)>>(pos)) & 1)
 
-// We declare a pointer to IndiPiFaceRelay
-std::unique_ptr<IndiPiFaceRelay> indiPiFaceRelay(new IndiPiFaceRelay);
+#define PWM_TICK_MS 10
+#define DUTY_CYCLE_TAB "Duty Cycle"
+#define TRIGGER_TAB "Triggers"
+#define DIAGNOSTICS_TAB "Diagnostics"
 
-void ISPoll(void *p);
-void ISInit()
-{
-   static int isInit = 0;
-
-   if (isInit == 1)
-       return;
+// shortest time between two stall messages
+#define STALL_MESSAGE_INTERVAL 10
 
-    isInit = 1;
-    if(indiPiFaceRelay.get() == 0) indiPiFaceRelay.reset(new IndiPiFaceRelay());
+// total retry backoff of one port write, it runs on the event loop
+#define RETRY_BUDGET_US 5000
 
-}
-void ISGetProperties(const char *dev)
-{
-        ISInit();
-        indiPiFaceRelay->ISGetProperties(dev);
-}
-void ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int num)
-{
-        ISInit();
-        indiPiFaceRelay->ISNewSwitch(dev, name, states, names, num);
-}
-void ISNewText(	const char *dev, const char *name, char *texts[], char *names[], int num)
-{
-        ISInit();
-        indiPiFaceRelay->ISNewText(dev, name, texts, names, num);
-}
-void ISNewNumber(const char *dev, const char *name, double values[], char *names[], int num)
+// monotonic clock in nanoseconds
+static long long MonotonicNs()
 {
-        ISInit();
-        indiPiFaceRelay->ISNewNumber(dev, name, values, names, num);
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
-void ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int num)
-{
-  INDI_UNUSED(dev);
-  INDI_UNUSED(name);
-  INDI_UNUSED(sizes);
-  INDI_UNUSED(blobsizes);
-  INDI_UNUSED(blobs);
-  INDI_UNUSED(formats);
-  INDI_UNUSED(names);
-  INDI_UNUSED(num);
-}
-void ISSnoopDevice (XMLEle *root)
+
+// monotonic clock in pwm ticks
+static unsigned long MonotonicTicks()
 {
-    ISInit();
-    indiPiFaceRelay->ISSnoopDevice(root);
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long) ts.tv_sec * (1000 / PWM_TICK_MS) + ts.tv_nsec / (PWM_TICK_MS * 1000000);
 }
+
 IndiPiFaceRelay::IndiPiFaceRelay()
 {
 	setVersion(MAJOR_VERSION,MINOR_VERSION);
+	counter = 0;
+	next_time = 0;
+	sysworker_cb = -1;
+	netlink_cb = -1;
+	port_dirty = 0;
+	pwm_timer_id = -1;
+	port_image[0] = port_image[1] = 0;
+
+	pulse_fd = -1;
+	pulse_cb = -1;
+
+	write_count = 0;
+	retry_count = 0;
+	error_count = 0;
+	write_stats_dirty = false;
+	restoring = false;
+	toggle_count = 0;
+	timerhit_ns = 0;
+	timerhit_max_ns = 0;
+
+	// event loop sections timed against the stall budget
+	stall_timerhit = stall.Find("timerhit");
+	stall_systime = stall.Find("timerhit", "systime");
+	stall_stats = stall.Find("timerhit", "stats");
+	stall_metrics = stall.Find("timerhit", "metrics");
+	stall_lag = stall.Find("lag");
+	stall_connect = stall.Find("connect");
+	timer_due = 0;
+	stall_message_time = 0;
+	stall_dirty = false;
+
+	for (int i = 0; i < RELAY_COUNT; i++)
+	{
+		PiFaceTimerWheel::InitTimer(&pwm_timer[i], i);
+		pwm_on[i] = false;
+		pulse[i].remaining = 0;
+		pulse[i].deadline = 0;
+	}
+
+	RelaySP[0] = &Relay1SP;
+	RelaySP[1] = &Relay2SP;
+	RelaySP[2] = &Relay3SP;
+	RelaySP[3] = &Relay4SP;
+	RelaySP[4] = &Relay5SP;
+	RelaySP[5] = &Relay6SP;
+	RelaySP[6] = &Relay7SP;
+	RelaySP[7] = &Relay8SP;
 }
 IndiPiFaceRelay::~IndiPiFaceRelay()
 {
 }
 bool IndiPiFaceRelay::Connect()
 {
-	// open device (bus, chip_select)
-    mcp23s17_fd = mcp23s17_open(0,0);
+	long long start = MonotonicNs();
 
-    if(mcp23s17_fd == -1)
+	// open device (bus, chip_select)
+    if(!bus.Open(0, 0, isSimulation(), (uint32_t) (SpiClockN[0].value * 1000000)))
 	{
 		IDMessage(getDeviceName(), "PiFace Relay device is not available.");
 		return false;
 	}
 
-	// config register
+	// config register, interrupt bits are left to input capture
 	const uint8_t ioconfig = BANK_OFF | \
-							 INT_MIRROR_OFF | \
-							 SEQOP_OFF | \
+							 SEQOP_ON | \
 							 DISSLW_OFF | \
-							 HAEN_ON | \
-							 ODR_OFF | \
-							 INTPOL_LOW;
-	mcp23s17_write_reg(ioconfig, IOCON, 0, mcp23s17_fd);
-	mcp23s17_write_reg(ioconfig, IOCON, 1, mcp23s17_fd);
-
-	// I/O direction
-	mcp23s17_write_reg(0x00, IODIRA, 0, mcp23s17_fd);
-	mcp23s17_write_reg(0x00, IODIRB, 0, mcp23s17_fd);
-	mcp23s17_write_reg(0x00, IODIRA, 1, mcp23s17_fd);
-	mcp23s17_write_reg(0x00, IODIRB, 1, mcp23s17_fd);
-
-	// GPIOB pull ups
-	mcp23s17_write_reg(0x00, GPPUB, 0, mcp23s17_fd);
-	mcp23s17_write_reg(0x00, GPPUB, 1, mcp23s17_fd);
+							 HAEN_ON;
+	bus.WriteBits(ioconfig, IOCON_BUS_MASK, IOCON, 0);
+	bus.WriteBits(ioconfig, IOCON_BUS_MASK, IOCON, 1);
+
+	// I/O direction, relay pins only
+	bus.WriteBits(0x00, RELAY_MASK, IODIRA, 0);
+	bus.WriteBits(0x00, RELAY_MASK, IODIRA, 1);
+
+	// collect system and network info in background
+	if (sysworker.Start((int) RefreshN[1].value, (int) RefreshN[2].value))
+		sysworker_cb = IEAddCallback(sysworker.NotifyFd(), SysWorkerCallback, this);
+	else
+		IDMessage(getDeviceName(), "PiFace Relay system info is not available.");
+
+	// input capture
+	if (InputCaptureS[0].s == ISS_ON)
+		StartInputs();
+
+	// pulse timer with absolute deadlines
+	pulse_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (pulse_fd != -1)
+		pulse_cb = IEAddCallback(pulse_fd, PulseCallback, this);
+	else
+		IDMessage(getDeviceName(), "PiFace Relay pulse timer is not available.");
+
+	// follow address changes instead of polling
+	if (netlink.Open())
+		netlink_cb = IEAddCallback(netlink.Fd(), NetLinkCallback, this);
+	else
+		IDMessage(getDeviceName(), "PiFace Relay network events are not available.");
+
+	// relay states are written on a debounce timer, not per toggle
+	if (!persist.Open(getDeviceName(), WriteConfig, this))
+		IDMessage(getDeviceName(), "PiFace Relay config persistence is not available.");
 
 	// start timer for sysinfo updates
+	next_time = 0;
 	SetTimer(1000);
+	timer_due = MonotonicNs() + 1000000000LL;
+
+	EndCallback(stall_connect, start);
 
     IDMessage(getDeviceName(), "PiFace Relay connected successfully.");
     return true;
 }
 bool IndiPiFaceRelay::Disconnect()
 {
+	// stop duty cycling, heaters off
+	StopAllPwm();
+
+	// stop input capture
+	inputs.Stop();
+
+	// stop pulses and sequences
+	for (int i = 0; i < RELAY_COUNT; i++)
+		StopPulse(i);
+	FlushPorts();
+	if (pulse_cb != -1)
+	{
+		IERmCallback(pulse_cb);
+		pulse_cb = -1;
+	}
+	if (pulse_fd != -1)
+	{
+		close(pulse_fd);
+		pulse_fd = -1;
+	}
+
+	// pending relay states reach the card
+	persist.Close();
+
 	// close device
-	close(mcp23s17_fd);
+	bus.Close();
+
+	// stop system info collection
+	if (sysworker_cb != -1)
+	{
+		IERmCallback(sysworker_cb);
+		sysworker_cb = -1;
+	}
+	sysworker.Stop();
+
+	// stop metrics endpoint
+	metrics.Stop();
+
+	// stop network events
+	if (netlink_cb != -1)
+	{
+		IERmCallback(netlink_cb);
+		netlink_cb = -1;
+	}
+	netlink.Close();
 
     IDMessage(getDeviceName(), "PiFace Relay disconnected successfully.");
     return true;
@@ -138,112 +228,164 @@ void IndiPiFaceRelay::TimerHit()
 {
 	if(isConnected())
 	{
-		// update gps time
-		struct tm *local_timeinfo;
-		static char ts[32];
-		time_t rawtime;
-		time(&rawtime);
-		local_timeinfo = localtime (&rawtime);
-		strftime(ts, 20, "%Y-%m-%dT%H:%M:%S", local_timeinfo);
-		IUSaveText(&SysTimeT[0], ts);
-		snprintf(ts, sizeof(ts), "%4.2f", (local_timeinfo->tm_gmtoff/3600.0));
-		IUSaveText(&SysTimeT[1], ts);
-		SysTimeTP.s = IPS_OK;
-		IDSetText(&SysTimeTP, NULL);
-
-		// update system info
-		FILE* pipe;
-		char buffer[128];
+		long long start = MonotonicNs();
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+
+		// late wakeup is time the loop spent elsewhere
+		if (timer_due != 0)
+			EndCallback(stall_lag, timer_due);
+
+		// update system time
+		long long section = MonotonicNs();
+		if ( tv.tv_sec >= next_time )
+		{
+			struct tm *local_timeinfo;
+			static char ts[32];
+			time_t rawtime = tv.tv_sec;
+			local_timeinfo = localtime (&rawtime);
+			strftime(ts, 20, "%Y-%m-%dT%H:%M:%S", local_timeinfo);
+			bool changed = SaveTextIfChanged(&SysTimeT[0], ts);
+			snprintf(ts, sizeof(ts), "%4.2f", (local_timeinfo->tm_gmtoff/3600.0));
+			changed |= SaveTextIfChanged(&SysTimeT[1], ts);
+			if (changed || SysTimeTP.s != IPS_OK)
+			{
+				SysTimeTP.s = IPS_OK;
+				IDSetText(&SysTimeTP, NULL);
+			}
+
+			// next multiple of refresh interval
+			int interval = (int) RefreshN[0].value;
+			next_time = tv.tv_sec - (tv.tv_sec % interval) + interval;
+		}
+		EndCallback(stall_systime, section);
+
+		// write counters and stall statistics, at most once a second
+		section = MonotonicNs();
+		if (write_stats_dirty)
+			PublishWriteStats();
+		if (stall_dirty || counter % 10 == 0)
+			PublishStalls();
+		EndCallback(stall_stats, section);
 
 		// every 5 seconds
-		if ( counter % 5 == 0 )
+		if ( counter % 5 == 0 && SwitchSP.s != IPS_IDLE )
 		{
 			// reset system halt/restart button
 			SwitchSP.s = IPS_IDLE;
 			IDSetSwitch(&SwitchSP, NULL);
 		}
 
-		// every 10 secs
-		if ( counter % 10 == 0 )
-		{
-			// system info
-			SysInfoTP.s = IPS_BUSY;
-			IDSetText(&SysInfoTP, NULL);
+		if ( counter <= 0 )
+			counter = 60;
+		counter--;
 
-			//update Hardware
-			pipe = popen("cat /proc/cpuinfo|grep Hardware|awk -F: '{print $2}'", "r");
-			fgets(buffer, 128, pipe);
-			pclose(pipe);
-			IUSaveText(&SysInfoT[0], buffer);
-
-			//update uptime
-			pipe = popen("uptime|awk -F, '{print $1}'|awk -Fup '{print $2}'", "r");
-			fgets(buffer, 128, pipe);
-			pclose(pipe);
-			IUSaveText(&SysInfoT[1], buffer);
-
-			//update load
-			pipe = popen("uptime|awk -F\", \" '{print $3\"/\"$4\"/\"$5}'|awk -F: '{print $2}'", "r");
-			fgets(buffer, 128, pipe);
-			pclose(pipe);
-			IUSaveText(&SysInfoT[2], buffer);
-
-			//update free mem
-			pipe = popen("cat /proc/meminfo|grep MemFree|awk -F: '{print $2}'|sed -e 's/^[[:space:]]*//'", "r");
-			fgets(buffer, 128, pipe);
-			pclose(pipe);
-			IUSaveText(&SysInfoT[3], buffer);
-
-			//update temperature - check banana pi
-			if (!strcmp(SysInfoT[0].text, "sun8i"))
-			{
-				pipe = popen("cat /sys/class/thermal/thermal_zone0/temp", "r");
-			} else
+		// run time without the metrics snapshot itself
+		timerhit_ns = MonotonicNs() - start;
+		if (timerhit_ns > timerhit_max_ns)
+			timerhit_max_ns = timerhit_ns;
+		section = MonotonicNs();
+		if (metrics.IsStarted())
+			UpdateMetrics();
+		EndCallback(stall_metrics, section);
+		EndCallback(stall_timerhit, start);
+
+		// wake up at the next full second, SetTimer(1000) drifts by the run time
+		int delay = 1000 - tv.tv_usec / 1000;
+		if (delay <= 0)
+			delay = 1000;
+		SetTimer(delay);
+		timer_due = MonotonicNs() + delay * 1000000LL;
+    }
+}
+bool IndiPiFaceRelay::SaveTextIfChanged(IText *tp, const char *text)
+{
+	if (tp->text != NULL && !strcmp(tp->text, text))
+		return false;
+
+	IUSaveText(tp, text);
+	return true;
+}
+void IndiPiFaceRelay::SysWorkerCallback(int fd, void *p)
+{
+	INDI_UNUSED(fd);
+	static_cast<IndiPiFaceRelay *>(p)->UpdateSysInfo();
+}
+void IndiPiFaceRelay::UpdateSysInfo()
+{
+	PiFaceSysSnapshot info;
+	int updated = sysworker.Fetch(&info);
+
+	if (!isConnected())
+		return;
+
+	bool busy = BusyStateS[0].s == ISS_ON;
+
+	// system info, published only when a value changed
+	if (updated & PiFaceSysWorker::SYSINFO_UPDATED)
+	{
+		bool changed = SaveTextIfChanged(&SysInfoT[0], info.hardware);
+		changed |= SaveTextIfChanged(&SysInfoT[1], info.uptime);
+		changed |= SaveTextIfChanged(&SysInfoT[2], info.load);
+		changed |= SaveTextIfChanged(&SysInfoT[3], info.freemem);
+		changed |= SaveTextIfChanged(&SysInfoT[4], info.temperature);
+
+		if (changed || SysInfoTP.s != IPS_OK)
+		{
+			if (busy)
 			{
-				pipe = popen("vcgencmd measure_temp|awk -F= '{print $2}'", "r");
+				SysInfoTP.s = IPS_BUSY;
+				IDSetText(&SysInfoTP, NULL);
 			}
-			fgets(buffer, 128, pipe);
-			pclose(pipe);
-			IUSaveText(&SysInfoT[4], buffer);
-
 			SysInfoTP.s = IPS_OK;
 			IDSetText(&SysInfoTP, NULL);
-
 		}
-		// every 60 secs
-		if ( counter == 0 )
-		{
-			// network info
-			NetInfoTP.s = IPS_BUSY;
-			IDSetText(&NetInfoTP, NULL);
+	}
 
-			//update Hostname
-			pipe = popen("hostname", "r");
-			fgets(buffer, 128, pipe);
-			pclose(pipe);
-			IUSaveText(&NetInfoT[0], buffer);
+	// public ip, published only when changed
+	if (updated & PiFaceSysWorker::NETINFO_UPDATED)
+		PublishNetInfo(SaveTextIfChanged(&NetInfoT[2], info.publicip));
+}
+void IndiPiFaceRelay::NetLinkCallback(int fd, void *p)
+{
+	INDI_UNUSED(fd);
+	IndiPiFaceRelay *relay = static_cast<IndiPiFaceRelay *>(p);
 
-			//update Local IP
-			pipe = popen("hostname -I", "r");
-			fgets(buffer, 128, pipe);
-			pclose(pipe);
-			IUSaveText(&NetInfoT[1], buffer);
+	if (relay->netlink.Process())
+	{
+		relay->UpdateNetInfo();
 
-			//update Public IP
-			pipe = popen("dig +short myip.opendns.com @resolver1.opendns.com", "r");
-			fgets(buffer, 128, pipe);
-			pclose(pipe);
-			IUSaveText(&NetInfoT[2], buffer);
+		// public ip may follow a local address change
+		relay->sysworker.RefreshNetInfo();
+	}
+}
+void IndiPiFaceRelay::UpdateNetInfo()
+{
+	char buffer[128];
+	bool changed = false;
 
-			NetInfoTP.s = IPS_OK;
-			IDSetText(&NetInfoTP, NULL);
+	//update Hostname
+	if (PiFaceNetLink::Hostname(buffer, sizeof(buffer)))
+		changed |= SaveTextIfChanged(&NetInfoT[0], buffer);
 
-			counter = 60;
-		}
-		counter--;
+	//update Local IP
+	if (PiFaceNetLink::LocalAddresses(buffer, sizeof(buffer)))
+		changed |= SaveTextIfChanged(&NetInfoT[1], buffer);
 
-		SetTimer(1000);
-    }
+	PublishNetInfo(changed);
+}
+void IndiPiFaceRelay::PublishNetInfo(bool changed)
+{
+	if (!isConnected() || (!changed && NetInfoTP.s == IPS_OK))
+		return;
+
+	if (BusyStateS[0].s == ISS_ON)
+	{
+		NetInfoTP.s = IPS_BUSY;
+		IDSetText(&NetInfoTP, NULL);
+	}
+	NetInfoTP.s = IPS_OK;
+	IDSetText(&NetInfoTP, NULL);
 }
 const char * IndiPiFaceRelay::getDefaultName()
 {
@@ -271,6 +413,110 @@ bool IndiPiFaceRelay::initProperties()
     IUFillText(&NetInfoT[2],"PUBLIC_IP","Public IP",NULL);
     IUFillTextVector(&NetInfoTP,NetInfoT,3,getDeviceName(),"NETWORK_INFO","Network Info","System Info",IP_RO,60,IPS_IDLE);
 
+	// options
+    IUFillNumber(&RefreshN[0],"TIME_REFRESH","System Time (sec)","%0.0f",1,3600,1,1);
+    IUFillNumber(&RefreshN[1],"SYSINFO_REFRESH","System Info (sec)","%0.0f",1,3600,1,10);
+    IUFillNumber(&RefreshN[2],"NETINFO_REFRESH","Public IP (sec)","%0.0f",1,3600,1,60);
+    IUFillNumberVector(&RefreshNP,RefreshN,3,getDeviceName(),"REFRESH_INTERVAL","Refresh",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+    IUFillText(&MetricsT[0],"ENDPOINT","Endpoint","");
+    IUFillTextVector(&MetricsTP,MetricsT,1,getDeviceName(),"METRICS_ENDPOINT","Metrics",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+    IUFillNumber(&SpiClockN[0],"SPI_SPEED","Clock (MHz)","%0.1f",0.1,10,0.1,10);
+    IUFillNumberVector(&SpiClockNP,SpiClockN,1,getDeviceName(),"SPI_CLOCK","SPI",OPTIONS_TAB,IP_RW,0,IPS_IDLE);
+
+    IUFillSwitch(&BusyStateS[0],"BUSY_ON","Enable",ISS_ON);
+    IUFillSwitch(&BusyStateS[1],"BUSY_OFF","Disable",ISS_OFF);
+    IUFillSwitchVector(&BusyStateSP,BusyStateS,2,getDeviceName(),"BUSY_STATE","Busy State",OPTIONS_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+	// duty cycle
+	for (int i = 0; i < RELAY_COUNT; i++)
+	{
+		char name[MAXINDINAME], label[MAXINDILABEL];
+		snprintf(name, sizeof(name), "RELAY%d_DUTY", i + 1);
+		snprintf(label, sizeof(label), "Relay %d (%%)", i + 1);
+		IUFillNumber(&PwmDutyN[i], name, label, "%0.0f", 0, 100, 1, 0);
+		snprintf(name, sizeof(name), "RELAY%d_PERIOD", i + 1);
+		snprintf(label, sizeof(label), "Relay %d (sec)", i + 1);
+		IUFillNumber(&PwmPeriodN[i], name, label, "%0.1f", 0.1, 600, 1, 10);
+	}
+    IUFillNumberVector(&PwmDutyNP,PwmDutyN,RELAY_COUNT,getDeviceName(),"RELAY_DUTY","Duty Cycle",DUTY_CYCLE_TAB,IP_RW,0,IPS_IDLE);
+    IUFillNumberVector(&PwmPeriodNP,PwmPeriodN,RELAY_COUNT,getDeviceName(),"RELAY_PERIOD","Period",DUTY_CYCLE_TAB,IP_RW,0,IPS_IDLE);
+
+	// inputs
+	for (int i = 0; i < INPUT_COUNT; i++)
+	{
+		char name[MAXINDINAME], label[MAXINDILABEL];
+		snprintf(name, sizeof(name), "INPUT%d", i + 1);
+		snprintf(label, sizeof(label), "Input %d", i + 1);
+		IUFillLight(&InputL[i], name, label, IPS_IDLE);
+		IUFillSwitch(&SimInputS[i], name, label, ISS_OFF);
+	}
+    IUFillLightVector(&InputLP,InputL,INPUT_COUNT,getDeviceName(),"INPUTS","Inputs",MAIN_CONTROL_TAB,IPS_IDLE);
+    IUFillSwitchVector(&SimInputSP,SimInputS,INPUT_COUNT,getDeviceName(),"SIMULATE_INPUTS","Simulate Inputs",OPTIONS_TAB,IP_RW,ISR_NOFMANY,0,IPS_IDLE);
+
+    IUFillSwitch(&InputCaptureS[0],"CAPTURE_ON","Enable",ISS_OFF);
+    IUFillSwitch(&InputCaptureS[1],"CAPTURE_OFF","Disable",ISS_ON);
+    IUFillSwitchVector(&InputCaptureSP,InputCaptureS,2,getDeviceName(),"INPUT_CAPTURE","Input Capture",OPTIONS_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+	// diagnostics
+    IUFillSwitch(&VerifyS[0],"VERIFY_NONE","None",ISS_OFF);
+    IUFillSwitch(&VerifyS[1],"VERIFY_ONCE","Readback",ISS_ON);
+    IUFillSwitch(&VerifyS[2],"VERIFY_RETRY","Readback & Retry",ISS_OFF);
+    IUFillSwitchVector(&VerifySP,VerifyS,3,getDeviceName(),"WRITE_VERIFY","Write Verify",DIAGNOSTICS_TAB,IP_RW,ISR_1OFMANY,0,IPS_IDLE);
+
+    IUFillNumber(&RetryN[0],"RETRY_COUNT","Retries","%0.0f",1,10,1,3);
+    IUFillNumber(&RetryN[1],"RETRY_BACKOFF","Backoff (ms)","%0.0f",0,100,1,1);
+    IUFillNumberVector(&RetryNP,RetryN,2,getDeviceName(),"WRITE_RETRY","Write Retry",DIAGNOSTICS_TAB,IP_RW,0,IPS_IDLE);
+
+    IUFillNumber(&WriteStatsN[0],"WRITES","Writes","%0.0f",0,0,0,0);
+    IUFillNumber(&WriteStatsN[1],"RETRIES","Retries","%0.0f",0,0,0,0);
+    IUFillNumber(&WriteStatsN[2],"ERRORS","Errors","%0.0f",0,0,0,0);
+    IUFillNumberVector(&WriteStatsNP,WriteStatsN,3,getDeviceName(),"WRITE_STATS","Write Counters",DIAGNOSTICS_TAB,IP_RO,0,IPS_IDLE);
+
+    IUFillSwitch(&WriteStatsResetS[0],"RESET","Reset",ISS_OFF);
+    IUFillSwitchVector(&WriteStatsResetSP,WriteStatsResetS,1,getDeviceName(),"WRITE_STATS_RESET","Counters",DIAGNOSTICS_TAB,IP_RW,ISR_ATMOST1,0,IPS_IDLE);
+
+    IUFillNumber(&StallBudgetN[0],"STALL_BUDGET_MS","Budget (ms)","%0.0f",1,10000,10,50);
+    IUFillNumberVector(&StallBudgetNP,StallBudgetN,1,getDeviceName(),"STALL_BUDGET","Stall Budget",DIAGNOSTICS_TAB,IP_RW,0,IPS_IDLE);
+
+    IUFillNumber(&StallStatsN[0],"LAG_MAX","Timer lag max (ms)","%0.2f",0,0,0,0);
+    IUFillNumber(&StallStatsN[1],"LAG_P99","Timer lag p99 (ms)","%0.2f",0,0,0,0);
+    IUFillNumber(&StallStatsN[2],"TIMERHIT_MAX","TimerHit max (ms)","%0.2f",0,0,0,0);
+    IUFillNumber(&StallStatsN[3],"TIMERHIT_P99","TimerHit p99 (ms)","%0.2f",0,0,0,0);
+    IUFillNumber(&StallStatsN[4],"SWITCH_MAX","Switch max (ms)","%0.2f",0,0,0,0);
+    IUFillNumber(&StallStatsN[5],"SWITCH_P99","Switch p99 (ms)","%0.2f",0,0,0,0);
+    IUFillNumber(&StallStatsN[6],"CONNECT","Connect (ms)","%0.2f",0,0,0,0);
+    IUFillNumber(&StallStatsN[7],"OVERRUNS","Overruns","%0.0f",0,0,0,0);
+    IUFillNumberVector(&StallStatsNP,StallStatsN,8,getDeviceName(),"STALL_STATS","Event Loop",DIAGNOSTICS_TAB,IP_RO,0,IPS_IDLE);
+
+    IUFillText(&StallLastT[0],"LAST_STALL","Last Stall","");
+    IUFillTextVector(&StallLastTP,StallLastT,1,getDeviceName(),"STALL_LAST","Event Loop",DIAGNOSTICS_TAB,IP_RO,0,IPS_IDLE);
+
+    IUFillSwitch(&StallResetS[0],"RESET","Reset",ISS_OFF);
+    IUFillSwitchVector(&StallResetSP,StallResetS,1,getDeviceName(),"STALL_RESET","Event Loop",DIAGNOSTICS_TAB,IP_RW,ISR_ATMOST1,0,IPS_IDLE);
+
+    IUFillSwitch(&EventExportS[0],"EXPORT_BINARY","Binary",ISS_OFF);
+    IUFillSwitch(&EventExportS[1],"EXPORT_CSV","CSV",ISS_OFF);
+    IUFillSwitchVector(&EventExportSP,EventExportS,2,getDeviceName(),"EVENT_EXPORT","Export Events",DIAGNOSTICS_TAB,IP_RW,ISR_ATMOST1,0,IPS_IDLE);
+
+    IUFillBLOB(&EventLogB[0],"EVENTS","Events","");
+    IUFillBLOBVector(&EventLogBP,EventLogB,1,getDeviceName(),"EVENT_LOG","Event Log",DIAGNOSTICS_TAB,IP_RO,60,IPS_IDLE);
+
+	// triggers
+    IUFillNumber(&PulseN[0],"RELAY","Relay","%0.0f",1,RELAY_COUNT,1,1);
+    IUFillNumber(&PulseN[1],"WIDTH","Width (ms)","%0.1f",0.1,60000,10,100);
+    IUFillNumberVector(&PulseNP,PulseN,2,getDeviceName(),"RELAY_PULSE","Pulse",TRIGGER_TAB,IP_RW,0,IPS_IDLE);
+
+    IUFillNumber(&SequenceN[0],"RELAY","Relay","%0.0f",1,RELAY_COUNT,1,1);
+    IUFillNumber(&SequenceN[1],"COUNT","Count","%0.0f",1,9999,1,10);
+    IUFillNumber(&SequenceN[2],"EXPOSURE","Exposure (sec)","%0.3f",0.001,3600,1,30);
+    IUFillNumber(&SequenceN[3],"GAP","Gap (sec)","%0.3f",0.001,3600,1,5);
+    IUFillNumberVector(&SequenceNP,SequenceN,4,getDeviceName(),"RELAY_SEQUENCE","Sequence",TRIGGER_TAB,IP_RW,0,IPS_IDLE);
+
+    IUFillSwitch(&SequenceAbortS[0],"ABORT","Abort",ISS_OFF);
+    IUFillSwitchVector(&SequenceAbortSP,SequenceAbortS,1,getDeviceName(),"RELAY_SEQUENCE_ABORT","Sequence",TRIGGER_TAB,IP_RW,ISR_ATMOST1,0,IPS_IDLE);
+
 	// main
     IUFillSwitch(&SwitchS[0], "ALL_ON", "All On", ISS_OFF);
     IUFillSwitch(&SwitchS[1], "ALL_OFF", "All Off", ISS_OFF);
@@ -302,6 +548,8 @@ bool IndiPiFaceRelay::initProperties()
     IUFillSwitch(&Relay8S[0], "REL8BTN", "On/Off", ISS_OFF);
     IUFillSwitchVector(&Relay8SP, Relay8S, 1, getDeviceName(), "RELAY8", "Relay 8", MAIN_CONTROL_TAB, IP_RW, ISR_1OFMANY, 0, IPS_IDLE);
 
+    addSimulationControl();
+
     return true;
 }
 bool IndiPiFaceRelay::updateProperties()
@@ -314,6 +562,12 @@ bool IndiPiFaceRelay::updateProperties()
 		defineText(&SysTimeTP);
 		defineText(&SysInfoTP);
 		defineText(&NetInfoTP);
+		UpdateNetInfo();
+		defineNumber(&RefreshNP);
+		defineSwitch(&BusyStateSP);
+		defineText(&MetricsTP);
+		StartMetrics();
+		defineNumber(&SpiClockNP);
 		defineSwitch(&SwitchSP);
 		defineSwitch(&Relay1SP);
 		defineSwitch(&Relay2SP);
@@ -323,6 +577,25 @@ bool IndiPiFaceRelay::updateProperties()
 		defineSwitch(&Relay6SP);
 		defineSwitch(&Relay7SP);
 		defineSwitch(&Relay8SP);
+		defineNumber(&PwmDutyNP);
+		defineNumber(&PwmPeriodNP);
+		defineLight(&InputLP);
+		defineSwitch(&InputCaptureSP);
+		if (isSimulation())
+			defineSwitch(&SimInputSP);
+		defineNumber(&PulseNP);
+		defineNumber(&SequenceNP);
+		defineSwitch(&SequenceAbortSP);
+		defineSwitch(&VerifySP);
+		defineNumber(&RetryNP);
+		defineNumber(&WriteStatsNP);
+		defineSwitch(&WriteStatsResetSP);
+		defineNumber(&StallBudgetNP);
+		defineNumber(&StallStatsNP);
+		defineText(&StallLastTP);
+		defineSwitch(&StallResetSP);
+		defineSwitch(&EventExportSP);
+		defineBLOB(&EventLogBP);
 		LoadStates();
     }
     else
@@ -331,6 +604,10 @@ bool IndiPiFaceRelay::updateProperties()
 		deleteProperty(SysTimeTP.name);
 		deleteProperty(SysInfoTP.name);
 		deleteProperty(NetInfoTP.name);
+		deleteProperty(RefreshNP.name);
+		deleteProperty(BusyStateSP.name);
+		deleteProperty(MetricsTP.name);
+		deleteProperty(SpiClockNP.name);
 		deleteProperty(SwitchSP.name);
 		deleteProperty(Relay1SP.name);
 		deleteProperty(Relay2SP.name);
@@ -340,6 +617,24 @@ bool IndiPiFaceRelay::updateProperties()
 		deleteProperty(Relay6SP.name);
 		deleteProperty(Relay7SP.name);
 		deleteProperty(Relay8SP.name);
+		deleteProperty(PwmDutyNP.name);
+		deleteProperty(PwmPeriodNP.name);
+		deleteProperty(InputLP.name);
+		deleteProperty(InputCaptureSP.name);
+		deleteProperty(SimInputSP.name);
+		deleteProperty(PulseNP.name);
+		deleteProperty(SequenceNP.name);
+		deleteProperty(SequenceAbortSP.name);
+		deleteProperty(VerifySP.name);
+		deleteProperty(RetryNP.name);
+		deleteProperty(WriteStatsNP.name);
+		deleteProperty(WriteStatsResetSP.name);
+		deleteProperty(StallBudgetNP.name);
+		deleteProperty(StallStatsNP.name);
+		deleteProperty(StallLastTP.name);
+		deleteProperty(StallResetSP.name);
+		deleteProperty(EventExportSP.name);
+		deleteProperty(EventLogBP.name);
     }
     return true;
 }
@@ -352,13 +647,164 @@ void IndiPiFaceRelay::ISGetProperties(const char *dev)
 }
 bool IndiPiFaceRelay::ISNewNumber (const char *dev, const char *name, double values[], char *names[], int n)
 {
+	// first we check if it's for our device
+    if (!strcmp(dev, getDeviceName()))
+    {
+		// handle refresh intervals
+		if (!strcmp(name, RefreshNP.name))
+		{
+			IUUpdateNumber(&RefreshNP, values, names, n);
+			sysworker.SetIntervals((int) RefreshN[1].value, (int) RefreshN[2].value);
+			next_time = 0;
+			RefreshNP.s = IPS_OK;
+			IDSetNumber(&RefreshNP, NULL);
+			return true;
+		}
+
+		// handle spi clock, applies to the next transfer
+		if (!strcmp(name, SpiClockNP.name))
+		{
+			IUUpdateNumber(&SpiClockNP, values, names, n);
+			bus.SetSpeed((uint32_t) (SpiClockN[0].value * 1000000));
+			SpiClockN[0].value = bus.Speed() / 1e6;
+			SpiClockNP.s = IPS_OK;
+			IDSetNumber(&SpiClockNP, NULL);
+			return true;
+		}
+
+		// handle stall budget
+		if (!strcmp(name, StallBudgetNP.name))
+		{
+			IUUpdateNumber(&StallBudgetNP, values, names, n);
+			stall.SetBudget((long long) (StallBudgetN[0].value * 1000000));
+			StallBudgetNP.s = IPS_OK;
+			IDSetNumber(&StallBudgetNP, NULL);
+			return true;
+		}
+
+		// handle write retry policy
+		if (!strcmp(name, RetryNP.name))
+		{
+			IUUpdateNumber(&RetryNP, values, names, n);
+			RetryNP.s = IPS_OK;
+			IDSetNumber(&RetryNP, NULL);
+			return true;
+		}
+
+		// handle single pulse
+		if (!strcmp(name, PulseNP.name))
+		{
+			IUUpdateNumber(&PulseNP, values, names, n);
+			int relay = (int) PulseN[0].value - 1;
+			StartPulse(relay, 1, (long long) (PulseN[1].value * 1000000), 0);
+			PulseNP.s = IPS_BUSY;
+			IDSetNumber(&PulseNP, "PiFace Relay Relay %d: pulse %0.1f ms", relay + 1, PulseN[1].value);
+			return true;
+		}
+
+		// handle intervalometer sequence
+		if (!strcmp(name, SequenceNP.name))
+		{
+			IUUpdateNumber(&SequenceNP, values, names, n);
+			int relay = (int) SequenceN[0].value - 1;
+			StartPulse(relay, (int) SequenceN[1].value, (long long) (SequenceN[2].value * 1e9), (long long) (SequenceN[3].value * 1e9));
+			SequenceNP.s = IPS_BUSY;
+			IDSetNumber(&SequenceNP, "PiFace Relay Relay %d: sequence of %0.0f x %0.3f sec", relay + 1, SequenceN[1].value, SequenceN[2].value);
+			return true;
+		}
+
+		// handle duty cycle and period
+		if (!strcmp(name, PwmDutyNP.name) || !strcmp(name, PwmPeriodNP.name))
+		{
+			double duty[RELAY_COUNT], period[RELAY_COUNT];
+			for (int i = 0; i < RELAY_COUNT; i++)
+			{
+				duty[i] = PwmDutyN[i].value;
+				period[i] = PwmPeriodN[i].value;
+			}
+
+			INumberVectorProperty *nvp = !strcmp(name, PwmDutyNP.name) ? &PwmDutyNP : &PwmPeriodNP;
+			IUUpdateNumber(nvp, values, names, n);
+
+			// restart only relays with new settings, or cycling stopped by a
+			// disconnect
+			for (int i = 0; i < RELAY_COUNT; i++)
+			{
+				bool stopped = PwmDutyN[i].value > 0 && PwmDutyN[i].value < 100 && !pwm_wheel.Scheduled(&pwm_timer[i]);
+				if (stopped || duty[i] != PwmDutyN[i].value || (PwmDutyN[i].value > 0 && period[i] != PwmPeriodN[i].value))
+				{
+					StartPwm(i);
+					if (PwmDutyN[i].value > 0)
+						IDMessage(getDeviceName(), "PiFace Relay Relay %d: duty cycle %0.0f%% of %0.1f sec", i + 1, PwmDutyN[i].value, PwmPeriodN[i].value);
+				}
+			}
+
+			nvp->s = IPS_OK;
+			IDSetNumber(nvp, NULL);
+			return true;
+		}
+	}
 	return INDI::DefaultDevice::ISNewNumber(dev,name,values,names,n);
 }
 bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *states, char *names[], int n)
+{
+	// every request is timed against the stall budget, per property
+	long long start = MonotonicNs();
+	bool rc = HandleSwitch(dev, name, states, names, n);
+	if (dev != NULL && !strcmp(dev, getDeviceName()))
+		EndCallback(stall.Find("switch", name), start);
+
+	return rc;
+}
+bool IndiPiFaceRelay::HandleSwitch (const char *dev, const char *name, ISState *states, char *names[], int n)
 {
 	// first we check if it's for our device
     if (!strcmp(dev, getDeviceName()))
     {
+		// handle stall statistics reset
+		if (!strcmp(name, StallResetSP.name))
+		{
+			stall.Reset();
+			IUSaveText(&StallLastT[0], "");
+			IDSetText(&StallLastTP, NULL);
+			PublishStalls();
+			StallResetS[0].s = ISS_OFF;
+			StallResetSP.s = IPS_IDLE;
+			IDSetSwitch(&StallResetSP, NULL);
+			return true;
+		}
+
+		// handle write verification
+		if (!strcmp(name, VerifySP.name))
+		{
+			IUUpdateSwitch(&VerifySP, states, names, n);
+			VerifySP.s = IPS_OK;
+			IDSetSwitch(&VerifySP, NULL);
+			return true;
+		}
+
+		// handle counter reset
+		if (!strcmp(name, WriteStatsResetSP.name))
+		{
+			write_count = retry_count = error_count = 0;
+			PublishWriteStats();
+			WriteStatsResetS[0].s = ISS_OFF;
+			WriteStatsResetSP.s = IPS_IDLE;
+			IDSetSwitch(&WriteStatsResetSP, NULL);
+			return true;
+		}
+
+		// handle event export
+		if (!strcmp(name, EventExportSP.name))
+		{
+			IUUpdateSwitch(&EventExportSP, states, names, n);
+			ExportEvents(EventExportS[1].s == ISS_ON ? PiFaceEventRing::EXPORT_CSV : PiFaceEventRing::EXPORT_BINARY);
+			IUResetSwitch(&EventExportSP);
+			EventExportSP.s = IPS_IDLE;
+			IDSetSwitch(&EventExportSP, NULL);
+			return true;
+		}
+
 		// handle switch 0
 		if (!strcmp(name, SwitchSP.name))
 		{
@@ -402,6 +848,7 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
 
 			if ( SwitchS[0].s == ISS_ON && SwitchSP.s == IPS_ALERT )
 			{
+				StopAllPwm();
 				SwitchSP.s = IPS_IDLE;
 				IDSetSwitch(&SwitchSP, NULL);
 				Relays(0,5);
@@ -413,6 +860,7 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
 
 			if ( SwitchS[1].s == ISS_ON && SwitchSP.s == IPS_ALERT )
 			{
+				StopAllPwm();
 				SwitchSP.s = IPS_IDLE;
 				IDSetSwitch(&SwitchSP, NULL);
 				Relays(0,0);
@@ -442,6 +890,99 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
 
 		}
 
+		// handle busy state
+		if (!strcmp(name, BusyStateSP.name))
+		{
+			IUUpdateSwitch(&BusyStateSP, states, names, n);
+			BusyStateSP.s = IPS_OK;
+			IDSetSwitch(&BusyStateSP, NULL);
+			return true;
+		}
+
+		// handle input capture
+		if (!strcmp(name, InputCaptureSP.name))
+		{
+			IUUpdateSwitch(&InputCaptureSP, states, names, n);
+			if (InputCaptureS[0].s == ISS_ON)
+				StartInputs();
+			else
+				inputs.Stop();
+			InputCaptureSP.s = inputs.IsStarted() == (InputCaptureS[0].s == ISS_ON) ? IPS_OK : IPS_ALERT;
+			IDSetSwitch(&InputCaptureSP, NULL);
+			return true;
+		}
+
+		// inject input edges in simulation, on means switch closed
+		if (!strcmp(name, SimInputSP.name))
+		{
+			IUUpdateSwitch(&SimInputSP, states, names, n);
+			uint8_t levels = INPUT_MASK;
+			for (int i = 0; i < INPUT_COUNT; i++)
+				if (SimInputS[i].s == ISS_ON)
+					levels &= ~(1 << (i + INPUT_SHIFT));
+			bus.SimSetInputs(INPUT_CHIP, INPUT_PORT, levels);
+			SimInputSP.s = IPS_OK;
+			IDSetSwitch(&SimInputSP, NULL);
+			return true;
+		}
+
+		// handle sequence abort
+		if (!strcmp(name, SequenceAbortSP.name))
+		{
+			for (int i = 0; i < RELAY_COUNT; i++)
+				StopPulse(i);
+			FlushPorts();
+			ArmPulseTimer();
+			PulseNP.s = IPS_IDLE;
+			IDSetNumber(&PulseNP, NULL);
+			SequenceNP.s = IPS_IDLE;
+			IDSetNumber(&SequenceNP, NULL);
+			SequenceAbortS[0].s = ISS_OFF;
+			SequenceAbortSP.s = IPS_OK;
+			IDSetSwitch(&SequenceAbortSP, "PiFace Relay sequences aborted");
+			return true;
+		}
+
+		// config load only collects relay states, RestoreRelays applies them,
+		// restored duty cycles and sequences keep running
+		if (restoring)
+		{
+			for (int i = 0; i < RELAY_COUNT; i++)
+			{
+				if (!strcmp(name, RelaySP[i]->name))
+				{
+					if (!pwm_wheel.Scheduled(&pwm_timer[i]) && pulse[i].deadline == 0)
+						IUUpdateSwitch(RelaySP[i], states, names, n);
+					return true;
+				}
+			}
+		}
+
+		// manual switching ends duty cycling and sequences
+		for (int i = 0; i < RELAY_COUNT; i++)
+		{
+			if (!strcmp(name, RelaySP[i]->name) && pulse[i].deadline != 0)
+			{
+				StopPulse(i);
+				FlushPorts();
+				ArmPulseTimer();
+			}
+
+			if (!strcmp(name, RelaySP[i]->name) && PwmDutyN[i].value > 0)
+			{
+				PwmDutyN[i].value = 0;
+				StopPwm(i);
+				IDSetNumber(&PwmDutyNP, NULL);
+			}
+		}
+
+		// relay states are part of the config
+		for (int i = 0; i < RELAY_COUNT; i++)
+		{
+			if (!strcmp(name, RelaySP[i]->name))
+				persist.MarkDirty();
+		}
+
 		// handle relays
 		if (!strcmp(name, Relay1SP.name))
 		{
@@ -458,7 +999,7 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
                                         Relay1S[0].s = ISS_OFF;
 				} else
 				{
-					Relay1S[0].s = RelayState(0,1) ? RelayState(0,1) : ISS_OFF;
+					Relay1S[0].s = RelayState(0,1);
 					IDMessage(getDeviceName(), "PiFace Relay Relay 1: %s", Relay1S[0].s == ISS_ON ? "ON" : "OFF" );
 					Relay1SP.s = IPS_IDLE;
 					if(Relay1S[0].s == ISS_ON)
@@ -483,7 +1024,7 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
                                         Relay2S[0].s = ISS_OFF;
                                 } else
 				{
-					Relay2S[0].s = RelayState(0,2) ? RelayState(0,2) : ISS_OFF;
+					Relay2S[0].s = RelayState(0,2);
 					IDMessage(getDeviceName(), "PiFace Relay Relay 2: %s", Relay2S[0].s == ISS_ON ? "ON" : "OFF" );
 					Relay2SP.s = IPS_IDLE;
 					if(Relay2S[0].s == ISS_ON)
@@ -509,7 +1050,7 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
                                         IDSetSwitch(&Relay3SP, NULL);
                                 } else
 				{
-					Relay3S[0].s = RelayState(0,3) ? RelayState(0,3) : ISS_OFF;
+					Relay3S[0].s = RelayState(0,3);
 					IDMessage(getDeviceName(), "PiFace Relay Relay 3: %s", Relay3S[0].s == ISS_ON ? "ON" : "OFF" );
 					Relay3SP.s = IPS_IDLE;
 					if(Relay3S[0].s == ISS_ON)
@@ -535,7 +1076,7 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
                                         IDSetSwitch(&Relay4SP, NULL);
                                 } else
 				{
-					Relay4S[0].s = RelayState(0,4) ? RelayState(0,4) : ISS_OFF;
+					Relay4S[0].s = RelayState(0,4);
 					IDMessage(getDeviceName(), "PiFace Relay Relay 4: %s", Relay4S[0].s == ISS_ON ? "ON" : "OFF" );
 					Relay4SP.s = IPS_IDLE;
 					if(Relay4S[0].s == ISS_ON)
@@ -561,7 +1102,7 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
                                         IDSetSwitch(&Relay5SP, NULL);
                                 } else
 				{
-					Relay5S[0].s = RelayState(1,1) ? RelayState(1,1) : ISS_OFF;
+					Relay5S[0].s = RelayState(1,1);
 					IDMessage(getDeviceName(), "PiFace Relay Relay 5: %s", Relay5S[0].s == ISS_ON ? "ON" : "OFF" );
 					Relay5SP.s = IPS_IDLE;
 					if(Relay5S[0].s == ISS_ON)
@@ -587,7 +1128,7 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
                                         IDSetSwitch(&Relay6SP, NULL);
                                 } else
 				{
-					Relay6S[0].s = RelayState(1,2) ? RelayState(1,2) : ISS_OFF;
+					Relay6S[0].s = RelayState(1,2);
 					IDMessage(getDeviceName(), "PiFace Relay Relay 6: %s", Relay6S[0].s == ISS_ON ? "ON" : "OFF" );
 					Relay6SP.s = IPS_IDLE;
 					if(Relay6S[0].s == ISS_ON)
@@ -613,7 +1154,7 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
                                         IDSetSwitch(&Relay7SP, NULL);
                                 } else
 				{
-					Relay7S[0].s = RelayState(1,3) ? RelayState(1,3) : ISS_OFF;
+					Relay7S[0].s = RelayState(1,3);
 					IDMessage(getDeviceName(), "PiFace Relay Relay 7: %s", Relay7S[0].s == ISS_ON ? "ON" : "OFF" );
 					Relay7SP.s = IPS_IDLE;
 					if(Relay7S[0].s == ISS_ON)
@@ -639,7 +1180,7 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
                                         IDSetSwitch(&Relay8SP, NULL);
                                 } else
 				{
-					Relay8S[0].s = RelayState(1,4) ? RelayState(1,4) : ISS_OFF;
+					Relay8S[0].s = RelayState(1,4);
 					IDMessage(getDeviceName(), "PiFace Relay Relay 8: %s", Relay8S[0].s == ISS_ON ? "ON" : "OFF" );
 					Relay8SP.s = IPS_IDLE;
 					if(Relay8S[0].s == ISS_ON)
@@ -654,6 +1195,20 @@ bool IndiPiFaceRelay::ISNewSwitch (const char *dev, const char *name, ISState *s
 }
 bool IndiPiFaceRelay::ISNewText (const char *dev, const char *name, char *texts[], char *names[], int n)
 {
+	// first we check if it's for our device
+    if (!strcmp(dev, getDeviceName()))
+    {
+		// handle metrics endpoint
+		if (!strcmp(name, MetricsTP.name))
+		{
+			IUUpdateText(&MetricsTP, texts, names, n);
+			if (isConnected())
+				StartMetrics();
+			else
+				IDSetText(&MetricsTP, NULL);
+			return true;
+		}
+	}
 	return INDI::DefaultDevice::ISNewText (dev, name, texts, names, n);
 }
 bool IndiPiFaceRelay::ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int n)
@@ -666,6 +1221,16 @@ bool IndiPiFaceRelay::ISSnoopDevice(XMLEle *root)
 }
 bool IndiPiFaceRelay::saveConfigItems(FILE *fp)
 {
+	IUSaveConfigNumber(fp, &RefreshNP);
+	IUSaveConfigSwitch(fp, &BusyStateSP);
+	IUSaveConfigText(fp, &MetricsTP);
+	IUSaveConfigNumber(fp, &SpiClockNP);
+	IUSaveConfigSwitch(fp, &InputCaptureSP);
+	IUSaveConfigNumber(fp, &PwmDutyNP);
+	IUSaveConfigNumber(fp, &PwmPeriodNP);
+	IUSaveConfigSwitch(fp, &VerifySP);
+	IUSaveConfigNumber(fp, &RetryNP);
+	IUSaveConfigNumber(fp, &StallBudgetNP);
 	IUSaveConfigSwitch(fp, &Relay1SP);
 	IUSaveConfigSwitch(fp, &Relay2SP);
 	IUSaveConfigSwitch(fp, &Relay3SP);
@@ -685,8 +1250,8 @@ int IndiPiFaceRelay::Relays(int chip, int index)
     int value;
     uint8_t payload_in, payload_out;
 
-    //read states
-	payload_in = mcp23s17_read_reg(GPIOA, chip, mcp23s17_fd);
+    // states from the output latch image, no read
+	payload_in = bus.Latch(GPIOA, chip);
 
 	switch(index)
 	{
@@ -722,18 +1287,200 @@ int IndiPiFaceRelay::Relays(int chip, int index)
 	}
 
         // Write to GPIO Port A
-        mcp23s17_write_reg(payload_out, GPIOA, chip, mcp23s17_fd);
+	return WritePort(chip, payload_out) ? 0 : 1;
+}
+bool IndiPiFaceRelay::WritePort(int chip, uint8_t value, bool wait_retry)
+{
+	int policy = IUFindOnSwitchIndex(&VerifySP);
+	int attempts = policy == VERIFY_RETRY ? 1 + (int) RetryN[0].value : 1;
+	int backoff = wait_retry ? (int) RetryN[1].value : 0;
+	int budget = RETRY_BUDGET_US;
 
-	// Check if successfuly written to port
-	payload_in = mcp23s17_read_reg(GPIOA, chip, mcp23s17_fd);
+	write_stats_dirty = true;
+	toggle_count += __builtin_popcount((port_image[chip] ^ value) & RELAY_MASK);
 
-	if (payload_in == payload_out)
+	for (int i = 0; i < attempts; i++)
 	{
-		return 0;
-	} else
+		if (i > 0)
+		{
+			// doubling backoff before the next attempt, capped by the budget
+			retry_count++;
+			events.Record(PiFaceEventRing::EVENT_WRITE_RETRY, chip, i);
+			int wait = std::min((backoff << (i - 1)) * 1000, budget);
+			if (wait > 0)
+			{
+				usleep(wait);
+				budget -= wait;
+			}
+		}
+
+		write_count++;
+		bus.WriteBits(value, RELAY_MASK, GPIOA, chip);
+		events.Record(PiFaceEventRing::EVENT_RELAY_WRITE, chip, value & RELAY_MASK);
+
+		// trust the write
+		if (policy == VERIFY_NONE)
+		{
+			port_image[chip] = value;
+			return true;
+		}
+
+		// Check if successfuly written to port
+		port_image[chip] = bus.ReadReg(GPIOA, chip);
+		if ((port_image[chip] & RELAY_MASK) == (value & RELAY_MASK))
+			return true;
+	}
+
+	error_count++;
+	events.Record(PiFaceEventRing::EVENT_SPI_ERROR, chip, port_image[chip]);
+	IDMessage(getDeviceName(), "PiFace Relay write to chip %d failed, wrote 0x%02x read 0x%02x", chip, value, port_image[chip]);
+	return false;
+}
+void IndiPiFaceRelay::ExportEvents(int format)
+{
+	int size = 0;
+	char *buffer = events.Export(format, &size);
+	if (buffer == NULL)
+	{
+		EventLogBP.s = IPS_ALERT;
+		IDSetBLOB(&EventLogBP, "PiFace Relay event export failed");
+		return;
+	}
+
+	EventLogB[0].blob = buffer;
+	EventLogB[0].bloblen = size;
+	EventLogB[0].size = size;
+	strcpy(EventLogB[0].format, format == PiFaceEventRing::EXPORT_CSV ? ".csv" : ".bin");
+	EventLogBP.s = IPS_OK;
+	IDSetBLOB(&EventLogBP, NULL);
+
+	EventLogB[0].blob = NULL;
+	free(buffer);
+}
+void IndiPiFaceRelay::StartMetrics()
+{
+	metrics.Stop();
+	MetricsTP.s = IPS_IDLE;
+
+	if (MetricsT[0].text != NULL && MetricsT[0].text[0] != 0)
 	{
-		return 1;
+		if (metrics.Start(MetricsT[0].text, getDeviceName()))
+		{
+			UpdateMetrics();
+			MetricsTP.s = IPS_OK;
+		}
+		else
+		{
+			MetricsTP.s = IPS_ALERT;
+			IDMessage(getDeviceName(), "PiFace Relay metrics endpoint %s is not available.", MetricsT[0].text);
+		}
 	}
+
+	IDSetText(&MetricsTP, NULL);
+}
+void IndiPiFaceRelay::UpdateMetrics()
+{
+	metrics.Begin();
+	metrics.Counter("piface_spi_reads_total", "SPI register reads", bus.Reads());
+	metrics.Counter("piface_spi_writes_total", "SPI register writes", bus.Writes());
+	metrics.Counter("piface_relay_writes_total", "Relay port writes", write_count);
+	metrics.Counter("piface_relay_write_retries_total", "Relay port write retries", retry_count);
+	metrics.Counter("piface_relay_write_errors_total", "Relay port writes failing verification", error_count);
+	metrics.Counter("piface_relay_toggles_total", "Relay output changes", toggle_count);
+
+	for (int i = 0; i < RELAY_COUNT; i++)
+	{
+		char labels[16];
+		snprintf(labels, sizeof(labels), "relay=\"%d\"", i + 1);
+		metrics.Gauge("piface_relay_on", "Relay output state", RelaySP[i]->sp[0].s == ISS_ON, labels);
+	}
+
+	metrics.Gauge("piface_timerhit_seconds", "Last TimerHit run time", timerhit_ns / 1e9);
+	metrics.Gauge("piface_timerhit_max_seconds", "Longest TimerHit run time", timerhit_max_ns / 1e9);
+	metrics.Counter("piface_callback_overruns_total", "Event loop callbacks over the stall budget", stall.Overruns());
+
+	// system info as collected by the worker
+	if (SysInfoT[2].text != NULL && SysInfoT[2].text[0] != 0)
+		metrics.Gauge("piface_system_load1", "System load average over 1 minute", atof(SysInfoT[2].text));
+	if (SysInfoT[3].text != NULL && SysInfoT[3].text[0] != 0)
+		metrics.Gauge("piface_system_free_memory_bytes", "Free system memory", atof(SysInfoT[3].text) * 1024);
+	if (SysInfoT[4].text != NULL && SysInfoT[4].text[0] != 0)
+		metrics.Gauge("piface_system_temperature_celsius", "System temperature", atof(SysInfoT[4].text));
+
+	// per callback, last so a full snapshot only loses these
+	for (int i = 0; i < stall.Count(); i++)
+	{
+		char labels[64];
+		snprintf(labels, sizeof(labels), "callback=\"%s\"", stall.Name(i));
+		metrics.Gauge("piface_callback_max_seconds", "Longest recent event loop callback run time", stall.Max(i) / 1e9, labels);
+	}
+	for (int i = 0; i < stall.Count(); i++)
+	{
+		char labels[64];
+		snprintf(labels, sizeof(labels), "callback=\"%s\"", stall.Name(i));
+		metrics.Gauge("piface_callback_p99_seconds", "99th percentile of recent event loop callback run times", stall.P99(i) / 1e9, labels);
+	}
+
+	metrics.Commit();
+}
+void IndiPiFaceRelay::EndCallback(int section, long long start)
+{
+	// timers may fire a little early, that is no lag
+	long long ns = MonotonicNs() - start;
+	if (ns < 0)
+		ns = 0;
+	if (!stall.Record(section, ns))
+		return;
+
+	events.Record(PiFaceEventRing::EVENT_STALL, section, ns / 1000 < 0x7fffffff ? (int32_t) (ns / 1000) : 0x7fffffff);
+
+	char text[64];
+	snprintf(text, sizeof(text), "%s %.1f ms", stall.Name(section), ns / 1e6);
+	IUSaveText(&StallLastT[0], text);
+	stall_dirty = true;
+
+	// a stalled loop must not also flood the client
+	time_t now = time(NULL);
+	if (now - stall_message_time >= STALL_MESSAGE_INTERVAL)
+	{
+		stall_message_time = now;
+		IDMessage(getDeviceName(), "PiFace Relay %s took %.1f ms, budget %.0f ms", stall.Name(section), ns / 1e6, StallBudgetN[0].value);
+	}
+}
+void IndiPiFaceRelay::PublishStalls()
+{
+	long long max, p99;
+
+	stall.Worst("lag", &max, &p99);
+	StallStatsN[0].value = max / 1e6;
+	StallStatsN[1].value = p99 / 1e6;
+	stall.Worst("timerhit", &max, &p99);
+	StallStatsN[2].value = max / 1e6;
+	StallStatsN[3].value = p99 / 1e6;
+	stall.Worst("switch", &max, &p99);
+	StallStatsN[4].value = max / 1e6;
+	StallStatsN[5].value = p99 / 1e6;
+	StallStatsN[6].value = stall.Last(stall_connect) / 1e6;
+	StallStatsN[7].value = stall.Overruns();
+	StallStatsNP.s = stall.Overruns() > 0 ? IPS_ALERT : IPS_OK;
+	IDSetNumber(&StallStatsNP, NULL);
+
+	if (stall_dirty)
+	{
+		stall_dirty = false;
+		StallLastTP.s = IPS_ALERT;
+		IDSetText(&StallLastTP, NULL);
+	}
+}
+void IndiPiFaceRelay::PublishWriteStats()
+{
+	write_stats_dirty = false;
+
+	WriteStatsN[0].value = write_count;
+	WriteStatsN[1].value = retry_count;
+	WriteStatsN[2].value = error_count;
+	WriteStatsNP.s = error_count > 0 ? IPS_ALERT : IPS_OK;
+	IDSetNumber(&WriteStatsNP, NULL);
 }
 ISState IndiPiFaceRelay::RelayState(int chip, int index)
 {
@@ -742,8 +1489,8 @@ ISState IndiPiFaceRelay::RelayState(int chip, int index)
 
 	ISState state;
 
-	// read states
-	uint8_t relays = mcp23s17_read_reg(GPIOA, chip, mcp23s17_fd);
+	// states from the output latch image, no read
+	uint8_t relays = bus.Latch(GPIOA, chip);
 
 	if(CHECK_BIT(relays,index-1) == 1)
 	{
@@ -757,52 +1504,413 @@ ISState IndiPiFaceRelay::RelayState(int chip, int index)
 }
 void IndiPiFaceRelay::LoadStates()
 {
-	// load states
-	Relay1S[0].s = RelayState(0,1);
-	Relay1SP.s = IPS_IDLE;
-	if(Relay1S[0].s == ISS_ON)
-		Relay1SP.s = IPS_OK;
-	IDSetSwitch(&Relay1SP, NULL);
-
-	Relay2S[0].s = RelayState(0,2);
-	Relay2SP.s = IPS_IDLE;
-	if(Relay2S[0].s == ISS_ON)
-		Relay2SP.s = IPS_OK;
-	IDSetSwitch(&Relay2SP, NULL);
-
-	Relay3S[0].s = RelayState(0,3);
-	Relay3SP.s = IPS_IDLE;
-	if(Relay3S[0].s == ISS_ON)
-		Relay3SP.s = IPS_OK;
-	IDSetSwitch(&Relay3SP, NULL);
-
-	Relay4S[0].s = RelayState(0,4);
-	Relay4SP.s = IPS_IDLE;
-	if(Relay4S[0].s == ISS_ON)
-		Relay4SP.s = IPS_OK;
-	IDSetSwitch(&Relay4SP, NULL);
-
-	Relay5S[0].s = RelayState(1,1);
-	Relay5SP.s = IPS_IDLE;
-	if(Relay5S[0].s == ISS_ON)
-		Relay5SP.s = IPS_OK;
-	IDSetSwitch(&Relay5SP, NULL);
-
-	Relay6S[0].s = RelayState(1,2);
-	Relay6SP.s = IPS_IDLE;
-	if(Relay6S[0].s == ISS_ON)
-		Relay6SP.s = IPS_OK;
-	IDSetSwitch(&Relay6SP, NULL);
-
-	Relay7S[0].s = RelayState(1,3);
-	Relay7SP.s = IPS_IDLE;
-	if(Relay7S[0].s == ISS_ON)
-		Relay7SP.s = IPS_OK;
-	IDSetSwitch(&Relay7SP, NULL);
-
-	Relay8S[0].s = RelayState(1,4);
-	Relay8SP.s = IPS_IDLE;
-	if(Relay8S[0].s == ISS_ON)
-		Relay8SP.s = IPS_OK;
-	IDSetSwitch(&Relay8SP, NULL);
+	// one read per chip
+	port_image[0] = bus.ReadReg(GPIOA, 0);
+	port_image[1] = bus.ReadReg(GPIOA, 1);
+
+	for (int i = 0; i < RELAY_COUNT; i++)
+		RelaySP[i]->sp[0].s = CHECK_BIT(port_image[i / 4], i % 4) ? ISS_ON : ISS_OFF;
+
+	PublishRelays();
+}
+unsigned long IndiPiFaceRelay::SpiReads()
+{
+	return bus.Reads();
+}
+unsigned long IndiPiFaceRelay::SpiWrites()
+{
+	return bus.Writes();
+}
+bool IndiPiFaceRelay::loadConfig(bool silent, const char *property)
+{
+	// batch relay states from config into a single write per chip
+	restoring = property == NULL || !strncmp(property, "RELAY", 5);
+	bool rc = INDI::DefaultDevice::loadConfig(silent, property);
+	if (restoring)
+	{
+		restoring = false;
+		if (isConnected())
+			RestoreRelays();
+	}
+
+	return rc;
+}
+bool IndiPiFaceRelay::WriteConfig(FILE *fp, void *p)
+{
+	IndiPiFaceRelay *relay = static_cast<IndiPiFaceRelay *>(p);
+
+	IUSaveConfigTag(fp, 0, relay->getDeviceName(), 1);
+	relay->saveConfigItems(fp);
+	IUSaveConfigTag(fp, 1, relay->getDeviceName(), 1);
+
+	return true;
+}
+bool IndiPiFaceRelay::saveConfig(bool silent, const char *property)
+{
+	if (!persist.IsOpen())
+		return INDI::DefaultDevice::saveConfig(silent, property);
+
+	// full saves use the atomic writer, single properties wait for it
+	bool rc = persist.Sync();
+	if (property != NULL)
+		return INDI::DefaultDevice::saveConfig(silent, property);
+
+	if (!rc)
+	{
+		IDMessage(getDeviceName(), "PiFace Relay could not save configuration to %s.", persist.Path());
+		return false;
+	}
+	IUSaveDefaultConfig(NULL, NULL, getDeviceName());
+
+	if (!silent)
+		IDMessage(getDeviceName(), "PiFace Relay configuration saved.");
+	return true;
+}
+void IndiPiFaceRelay::RestoreRelays()
+{
+	uint8_t image[2] = { port_image[0], port_image[1] };
+
+	// desired image, relays driven by duty cycle or pulses keep their bits
+	for (int i = 0; i < RELAY_COUNT; i++)
+	{
+		if (pwm_wheel.Scheduled(&pwm_timer[i]) || pulse[i].deadline != 0)
+			continue;
+
+		if (RelaySP[i]->sp[0].s == ISS_ON)
+			image[i / 4] |= (1 << (i % 4));
+		else
+			image[i / 4] &= ~(1 << (i % 4));
+	}
+
+	// unchanged chips are not written, relays already in place do not flicker
+	for (int chip = 0; chip < 2; chip++)
+	{
+		if ((image[chip] ^ port_image[chip]) & RELAY_MASK)
+			WritePort(chip, image[chip]);
+	}
+
+	for (int i = 0; i < RELAY_COUNT; i++)
+	{
+		if (pwm_wheel.Scheduled(&pwm_timer[i]) || pulse[i].deadline != 0)
+			continue;
+		RelaySP[i]->sp[0].s = CHECK_BIT(port_image[i / 4], i % 4) ? ISS_ON : ISS_OFF;
+	}
+
+	PublishRelays();
+}
+void IndiPiFaceRelay::PublishRelays()
+{
+	for (int i = 0; i < RELAY_COUNT; i++)
+	{
+		if (RelaySP[i]->s == IPS_BUSY)
+			continue;
+
+		RelaySP[i]->s = RelaySP[i]->sp[0].s == ISS_ON ? IPS_OK : IPS_IDLE;
+		IDSetSwitch(RelaySP[i], NULL);
+	}
+}
+
+void IndiPiFaceRelay::StartInputs()
+{
+	if (!bus.IsOpen() || inputs.IsStarted())
+		return;
+
+	// simulated switches start open, pulled up
+	bus.SimSetInputs(INPUT_CHIP, INPUT_PORT, INPUT_MASK);
+
+	if (!inputs.Start(&bus, INPUT_CHIP, INPUT_PORT, INPUT_MASK, InputsChanged, this))
+	{
+		IDMessage(getDeviceName(), "PiFace Relay input interrupt line is not available.");
+		return;
+	}
+
+	UpdateInputs(inputs.Levels());
+}
+void IndiPiFaceRelay::InputsChanged(uint8_t changed, uint8_t levels, void *p)
+{
+	INDI_UNUSED(changed);
+	static_cast<IndiPiFaceRelay *>(p)->UpdateInputs(levels);
+}
+void IndiPiFaceRelay::UpdateInputs(uint8_t levels)
+{
+	// active low, closed switch pulls the pin down
+	for (int i = 0; i < INPUT_COUNT; i++)
+		InputL[i].s = (levels & (1 << (i + INPUT_SHIFT))) ? IPS_IDLE : IPS_OK;
+
+	InputLP.s = IPS_OK;
+	IDSetLight(&InputLP, NULL);
+}
+unsigned long IndiPiFaceRelay::PwmTicks(int relay, bool on)
+{
+	unsigned long period = (unsigned long) (PwmPeriodN[relay].value * 1000 / PWM_TICK_MS);
+	unsigned long high = (unsigned long) (period * PwmDutyN[relay].value / 100);
+
+	// never shorter than one tick
+	if (high < 1)
+		high = 1;
+	if (high >= period)
+		high = period > 1 ? period - 1 : 1;
+
+	return on ? high : (period > high ? period - high : 1);
+}
+void IndiPiFaceRelay::SetRelayBit(int relay, bool on)
+{
+	int chip = relay / 4;
+
+	if (on)
+		port_image[chip] |= (1 << (relay % 4));
+	else
+		port_image[chip] &= ~(1 << (relay % 4));
+
+	port_dirty |= (1 << chip);
+}
+void IndiPiFaceRelay::StartPwm(int relay)
+{
+	double duty = PwmDutyN[relay].value;
+
+	// seed port images from hardware on first use
+	if (pwm_wheel.Pending() == 0 && duty > 0)
+	{
+		SeedPorts();
+		pwm_wheel.Reset(MonotonicTicks());
+	}
+
+	if (duty <= 0 || duty >= 100)
+	{
+		// fixed level, no cycling
+		StopPwm(relay);
+		if (duty >= 100)
+		{
+			SetRelayBit(relay, true);
+			PwmTick();
+			RelaySP[relay]->sp[0].s = ISS_ON;
+			RelaySP[relay]->s = IPS_OK;
+			IDSetSwitch(RelaySP[relay], NULL);
+		}
+		return;
+	}
+
+	// start with the on phase
+	StopPulse(relay);
+	pwm_on[relay] = true;
+	SetRelayBit(relay, true);
+	pwm_wheel.Schedule(&pwm_timer[relay], pwm_wheel.Now() + PwmTicks(relay, true));
+
+	RelaySP[relay]->sp[0].s = ISS_ON;
+	RelaySP[relay]->s = IPS_BUSY;
+	IDSetSwitch(RelaySP[relay], NULL);
+
+	PwmTick();
+}
+void IndiPiFaceRelay::StopPwm(int relay)
+{
+	bool active = pwm_wheel.Scheduled(&pwm_timer[relay]);
+
+	pwm_wheel.Cancel(&pwm_timer[relay]);
+	pwm_on[relay] = false;
+
+	if (active)
+	{
+		SetRelayBit(relay, false);
+		PwmTick();
+		RelaySP[relay]->sp[0].s = ISS_OFF;
+		RelaySP[relay]->s = IPS_IDLE;
+		IDSetSwitch(RelaySP[relay], NULL);
+	}
+}
+void IndiPiFaceRelay::StopAllPwm()
+{
+	for (int i = 0; i < RELAY_COUNT; i++)
+		StopPwm(i);
+
+	if (pwm_timer_id != -1)
+	{
+		IERmTimer(pwm_timer_id);
+		pwm_timer_id = -1;
+	}
+}
+void IndiPiFaceRelay::PwmTimerCallback(void *p)
+{
+	IndiPiFaceRelay *relay = static_cast<IndiPiFaceRelay *>(p);
+	relay->pwm_timer_id = -1;
+	relay->PwmTick();
+}
+void IndiPiFaceRelay::PwmExpired(PiFaceTimer *timer, void *p)
+{
+	static_cast<IndiPiFaceRelay *>(p)->PwmTransition(timer->id);
+}
+void IndiPiFaceRelay::PwmTransition(int relay)
+{
+	pwm_on[relay] = !pwm_on[relay];
+	SetRelayBit(relay, pwm_on[relay]);
+
+	// next edge relative to this one, late ticks do not stretch the period
+	PiFaceTimer *timer = &pwm_timer[relay];
+	pwm_wheel.Schedule(timer, timer->expires + PwmTicks(relay, pwm_on[relay]));
+}
+void IndiPiFaceRelay::PwmTick()
+{
+	if (pwm_wheel.Pending() > 0)
+		pwm_wheel.Advance(MonotonicTicks(), PwmExpired, this);
+
+	// one write per chip for all due transitions
+	FlushPorts();
+
+	if (pwm_wheel.Pending() > 0 && pwm_timer_id == -1)
+		pwm_timer_id = IEAddTimer(PWM_TICK_MS, PwmTimerCallback, this);
+}
+void IndiPiFaceRelay::SeedPorts()
+{
+	// port images are only trusted while an engine drives the outputs
+	if (pwm_wheel.Pending() > 0 || PulseActive())
+		return;
+
+	port_image[0] = bus.Latch(GPIOA, 0);
+	port_image[1] = bus.Latch(GPIOA, 1);
+}
+void IndiPiFaceRelay::FlushPorts()
+{
+	// pulse and duty cycle edges retry without backoff, a sleep here would
+	// delay every other scheduled edge
+	for (int chip = 0; chip < 2; chip++)
+	{
+		if (port_dirty & (1 << chip))
+			WritePort(chip, port_image[chip], false);
+	}
+	port_dirty = 0;
+}
+bool IndiPiFaceRelay::PulseActive()
+{
+	for (int i = 0; i < RELAY_COUNT; i++)
+		if (pulse[i].deadline != 0)
+			return true;
+	return false;
+}
+void IndiPiFaceRelay::StartPulse(int relay, int count, long long on_ns, long long off_ns)
+{
+	if (relay < 0 || relay >= RELAY_COUNT || count < 1 || pulse_fd == -1)
+		return;
+
+	// pulses take over from duty cycling
+	if (PwmDutyN[relay].value > 0)
+	{
+		PwmDutyN[relay].value = 0;
+		StopPwm(relay);
+		IDSetNumber(&PwmDutyNP, NULL);
+	}
+
+	SeedPorts();
+
+	pulse[relay].remaining = count;
+	pulse[relay].on = true;
+	pulse[relay].on_ns = on_ns;
+	pulse[relay].off_ns = off_ns;
+
+	// first edge now, all later edges are absolute
+	SetRelayBit(relay, true);
+	FlushPorts();
+	pulse[relay].deadline = MonotonicNs() + on_ns;
+	ArmPulseTimer();
+
+	RelaySP[relay]->sp[0].s = ISS_ON;
+	RelaySP[relay]->s = IPS_BUSY;
+	IDSetSwitch(RelaySP[relay], NULL);
+}
+void IndiPiFaceRelay::StopPulse(int relay)
+{
+	if (pulse[relay].deadline == 0)
+		return;
+
+	pulse[relay].deadline = 0;
+	pulse[relay].remaining = 0;
+	SetRelayBit(relay, false);
+
+	RelaySP[relay]->sp[0].s = ISS_OFF;
+	RelaySP[relay]->s = IPS_IDLE;
+	IDSetSwitch(RelaySP[relay], NULL);
+}
+void IndiPiFaceRelay::ArmPulseTimer()
+{
+	long long next = 0;
+
+	for (int i = 0; i < RELAY_COUNT; i++)
+		if (pulse[i].deadline != 0 && (next == 0 || pulse[i].deadline < next))
+			next = pulse[i].deadline;
+
+	// zero disarms
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = next / 1000000000LL;
+	its.it_value.tv_nsec = next % 1000000000LL;
+	timerfd_settime(pulse_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+void IndiPiFaceRelay::PulseCallback(int fd, void *p)
+{
+	uint64_t expirations;
+	if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	static_cast<IndiPiFaceRelay *>(p)->PulseEvent();
+}
+void IndiPiFaceRelay::PulseEvent()
+{
+	long long now = MonotonicNs();
+	bool finished[RELAY_COUNT];
+
+	for (int i = 0; i < RELAY_COUNT; i++)
+	{
+		finished[i] = false;
+
+		// catch up with every edge that is due
+		while (pulse[i].deadline != 0 && pulse[i].deadline <= now)
+		{
+			if (pulse[i].on)
+			{
+				pulse[i].on = false;
+				SetRelayBit(i, false);
+				if (--pulse[i].remaining == 0)
+				{
+					pulse[i].deadline = 0;
+					finished[i] = true;
+					break;
+				}
+				pulse[i].deadline += pulse[i].off_ns;
+			}
+			else
+			{
+				pulse[i].on = true;
+				SetRelayBit(i, true);
+				pulse[i].deadline += pulse[i].on_ns;
+			}
+		}
+	}
+
+	// all edges of this wakeup in one write per chip
+	FlushPorts();
+	ArmPulseTimer();
+
+	for (int i = 0; i < RELAY_COUNT; i++)
+	{
+		if (!finished[i])
+			continue;
+
+		RelaySP[i]->sp[0].s = ISS_OFF;
+		RelaySP[i]->s = IPS_IDLE;
+		IDSetSwitch(RelaySP[i], NULL);
+	}
+
+	// report completion
+	if (!PulseActive())
+	{
+		if (PulseNP.s == IPS_BUSY)
+		{
+			PulseNP.s = IPS_OK;
+			IDSetNumber(&PulseNP, NULL);
+		}
+		if (SequenceNP.s == IPS_BUSY)
+		{
+			SequenceNP.s = IPS_OK;
+			IDSetNumber(&SequenceNP, "PiFace Relay sequence completed");
+		}
+	}
 }
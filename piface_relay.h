@@ -22,14 +22,84 @@
 #include <string>
 #include <iostream>
 #include <stdio.h>
+#include <time.h>
 
 #include <defaultdevice.h>
 
+#include "piface_sysworker.h"
+#include "piface_netlink.h"
+#include "piface_timerwheel.h"
+#include "piface_mcp23s17.h"
+#include "piface_inputs.h"
+#include "piface_eventring.h"
+#include "piface_metrics.h"
+#include "piface_persist.h"
+#include "piface_stall.h"
+
+#define RELAY_COUNT 8
+
+// relays on the lower nibble of port A, upper nibble belongs to the motors
+#define RELAY_MASK 0x0f
+
 class IndiPiFaceRelay : public INDI::DefaultDevice
 {
 protected:
 private:
 	int counter;
+	time_t next_time;
+	PiFaceSysWorker sysworker;
+	int sysworker_cb;
+	static void SysWorkerCallback(int fd, void *p);
+	void UpdateSysInfo();
+	PiFaceNetLink netlink;
+	int netlink_cb;
+	static void NetLinkCallback(int fd, void *p);
+	void UpdateNetInfo();
+	void PublishNetInfo(bool changed);
+	bool SaveTextIfChanged(IText *tp, const char *text);
+	PiFaceTimerWheel pwm_wheel;
+	PiFaceTimer pwm_timer[RELAY_COUNT];
+	bool pwm_on[RELAY_COUNT];
+	uint8_t port_image[2];
+	int port_dirty;
+	int pwm_timer_id;
+	static void PwmTimerCallback(void *p);
+	static void PwmExpired(PiFaceTimer *timer, void *p);
+	void PwmTick();
+	void PwmTransition(int relay);
+	void StartPwm(int relay);
+	void StopPwm(int relay);
+	void StopAllPwm();
+	void SetRelayBit(int relay, bool on);
+	unsigned long PwmTicks(int relay, bool on);
+	ISwitchVectorProperty *RelaySP[RELAY_COUNT];
+	struct RelayPulse
+	{
+		int remaining;
+		bool on;
+		long long on_ns;
+		long long off_ns;
+		long long deadline;
+	} pulse[RELAY_COUNT];
+	int pulse_fd;
+	int pulse_cb;
+	static void PulseCallback(int fd, void *p);
+	void PulseEvent();
+	void StartPulse(int relay, int count, long long on_ns, long long off_ns);
+	void StopPulse(int relay);
+	bool PulseActive();
+	void ArmPulseTimer();
+	void SeedPorts();
+	void FlushPorts();
+	bool WritePort(int chip, uint8_t value, bool wait_retry = true);
+	void PublishWriteStats();
+	unsigned long write_count;
+	unsigned long retry_count;
+	unsigned long error_count;
+	bool write_stats_dirty;
+	bool restoring;
+	void RestoreRelays();
+	void PublishRelays();
 	IText PortT[2];
 	ITextVectorProperty PortTP;
 	IText SysTimeT[2];
@@ -38,6 +108,71 @@ private:
 	ITextVectorProperty SysInfoTP;
 	IText NetInfoT[3];
 	ITextVectorProperty NetInfoTP;
+	INumber RefreshN[3];
+	INumberVectorProperty RefreshNP;
+	ISwitch BusyStateS[2];
+	ISwitchVectorProperty BusyStateSP;
+	INumber PwmDutyN[RELAY_COUNT];
+	INumberVectorProperty PwmDutyNP;
+	INumber PwmPeriodN[RELAY_COUNT];
+	INumberVectorProperty PwmPeriodNP;
+	INumber PulseN[2];
+	INumberVectorProperty PulseNP;
+	INumber SequenceN[4];
+	INumberVectorProperty SequenceNP;
+	ISwitch SequenceAbortS[1];
+	ISwitchVectorProperty SequenceAbortSP;
+	ILight InputL[INPUT_COUNT];
+	ILightVectorProperty InputLP;
+	ISwitch InputCaptureS[2];
+	ISwitchVectorProperty InputCaptureSP;
+	ISwitch SimInputS[INPUT_COUNT];
+	ISwitchVectorProperty SimInputSP;
+	ISwitch VerifyS[3];
+	ISwitchVectorProperty VerifySP;
+	INumber RetryN[2];
+	INumberVectorProperty RetryNP;
+	INumber SpiClockN[1];
+	INumberVectorProperty SpiClockNP;
+	INumber WriteStatsN[3];
+	INumberVectorProperty WriteStatsNP;
+	ISwitch WriteStatsResetS[1];
+	ISwitchVectorProperty WriteStatsResetSP;
+	ISwitch EventExportS[2];
+	ISwitchVectorProperty EventExportSP;
+	IBLOB EventLogB[1];
+	IBLOBVectorProperty EventLogBP;
+	PiFaceEventRing events;
+	void ExportEvents(int format);
+	IText MetricsT[1];
+	ITextVectorProperty MetricsTP;
+	PiFaceMetrics metrics;
+	unsigned long toggle_count;
+	long long timerhit_ns;
+	long long timerhit_max_ns;
+	void StartMetrics();
+	void UpdateMetrics();
+	INumber StallBudgetN[1];
+	INumberVectorProperty StallBudgetNP;
+	INumber StallStatsN[8];
+	INumberVectorProperty StallStatsNP;
+	IText StallLastT[1];
+	ITextVectorProperty StallLastTP;
+	ISwitch StallResetS[1];
+	ISwitchVectorProperty StallResetSP;
+	PiFaceStallMonitor stall;
+	int stall_timerhit;
+	int stall_systime;
+	int stall_stats;
+	int stall_metrics;
+	int stall_lag;
+	int stall_connect;
+	long long timer_due;
+	time_t stall_message_time;
+	bool stall_dirty;
+	void EndCallback(int section, long long start);
+	void PublishStalls();
+	bool HandleSwitch(const char *dev, const char *name, ISState *states, char *names[], int n);
 	ISwitch SwitchS[4];
 	ISwitchVectorProperty SwitchSP;
 	ISwitch Relay1S[1];
@@ -56,7 +191,18 @@ private:
 	ISwitchVectorProperty Relay7SP;
 	ISwitch Relay8S[1];
 	ISwitchVectorProperty Relay8SP;
+	PiFacePersist persist;
+	static bool WriteConfig(FILE *fp, void *p);
+	PiFaceMcp23s17 bus;
+	friend class PiFaceTests;
 public:
+	enum
+	{
+		VERIFY_NONE,
+		VERIFY_ONCE,
+		VERIFY_RETRY
+	};
+
     IndiPiFaceRelay();
 	virtual ~IndiPiFaceRelay();
 
@@ -74,10 +220,17 @@ public:
 	virtual bool ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int n);
 	virtual bool ISSnoopDevice(XMLEle *root);
 	virtual bool saveConfigItems(FILE *fp);
+	virtual bool loadConfig(bool silent = false, const char *property = NULL);
+	virtual bool saveConfig(bool silent = false, const char *property = NULL);
 	virtual int Relays(int chip, int index);
 	virtual ISState RelayState(int chip, int index);
 	virtual void LoadStates();
-	int mcp23s17_fd;
+	unsigned long SpiReads();
+	unsigned long SpiWrites();
+	PiFaceInputs inputs;
+	static void InputsChanged(uint8_t changed, uint8_t levels, void *p);
+	void StartInputs();
+	void UpdateInputs(uint8_t levels);
 };
 
 #endif
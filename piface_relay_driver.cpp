@@ -0,0 +1,79 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// indi_piface_relay entry points, the driver itself is in piface_relay.cpp.
+
+#include <memory>
+
+#include "piface_relay.h"
+#include "piface_recorder.h"
+
+// We declare a pointer to IndiPiFaceRelay
+std::unique_ptr<IndiPiFaceRelay> indiPiFaceRelay(new IndiPiFaceRelay);
+
+void ISPoll(void *p);
+void ISInit()
+{
+   static int isInit = 0;
+
+   if (isInit == 1)
+       return;
+
+    isInit = 1;
+    if(indiPiFaceRelay.get() == 0) indiPiFaceRelay.reset(new IndiPiFaceRelay());
+
+}
+void ISGetProperties(const char *dev)
+{
+        ISInit();
+        indiPiFaceRelay->ISGetProperties(dev);
+}
+void ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int num)
+{
+        PiFaceRecorder::Switch(dev, name, states, names, num);
+        ISInit();
+        indiPiFaceRelay->ISNewSwitch(dev, name, states, names, num);
+}
+void ISNewText(	const char *dev, const char *name, char *texts[], char *names[], int num)
+{
+        PiFaceRecorder::Text(dev, name, texts, names, num);
+        ISInit();
+        indiPiFaceRelay->ISNewText(dev, name, texts, names, num);
+}
+void ISNewNumber(const char *dev, const char *name, double values[], char *names[], int num)
+{
+        PiFaceRecorder::Number(dev, name, values, names, num);
+        ISInit();
+        indiPiFaceRelay->ISNewNumber(dev, name, values, names, num);
+}
+void ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int num)
+{
+  INDI_UNUSED(dev);
+  INDI_UNUSED(name);
+  INDI_UNUSED(sizes);
+  INDI_UNUSED(blobsizes);
+  INDI_UNUSED(blobs);
+  INDI_UNUSED(formats);
+  INDI_UNUSED(names);
+  INDI_UNUSED(num);
+}
+void ISSnoopDevice (XMLEle *root)
+{
+    ISInit();
+    indiPiFaceRelay->ISSnoopDevice(root);
+}
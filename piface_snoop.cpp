@@ -0,0 +1,59 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "piface_snoop.h"
+
+bool PiFaceSnoop::Match(XMLEle *root, const char *device, const char *property)
+{
+	const char *tag = tagXMLEle(root);
+
+	if (strcmp(tag, "setNumberVector") && strcmp(tag, "defNumberVector"))
+		return false;
+
+	return !strcmp(findXMLAttValu(root, "device"), device) && !strcmp(findXMLAttValu(root, "name"), property);
+}
+IPState PiFaceSnoop::State(XMLEle *root)
+{
+	const char *state = findXMLAttValu(root, "state");
+
+	if (!strcmp(state, "Busy"))
+		return IPS_BUSY;
+	if (!strcmp(state, "Alert"))
+		return IPS_ALERT;
+	if (!strcmp(state, "Idle"))
+		return IPS_IDLE;
+
+	// set messages may leave the state out
+	return IPS_OK;
+}
+bool PiFaceSnoop::Number(XMLEle *root, const char *element, double *value)
+{
+	for (XMLEle *ep = nextXMLEle(root, 1); ep != NULL; ep = nextXMLEle(root, 0))
+	{
+		if (!strcmp(findXMLAttValu(ep, "name"), element))
+		{
+			*value = atof(pcdataXMLEle(ep));
+			return true;
+		}
+	}
+
+	return false;
+}
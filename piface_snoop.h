@@ -0,0 +1,36 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACESNOOP_H
+#define PIFACESNOOP_H
+
+#include <indiapi.h>
+#include <lilxml.h>
+
+// Helpers for number vectors snooped from other drivers.
+// Only def and set messages of the named device and property match, so
+// the focusers can test every snooped message against each source.
+class PiFaceSnoop
+{
+public:
+	static bool Match(XMLEle *root, const char *device, const char *property);
+	static IPState State(XMLEle *root);
+	static bool Number(XMLEle *root, const char *element, double *value);
+};
+
+#endif
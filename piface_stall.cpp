@@ -0,0 +1,165 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "piface_stall.h"
+
+PiFaceStallMonitor::PiFaceStallMonitor()
+{
+	section_count = 0;
+	budget_ns = 50000000LL;
+	overruns = 0;
+}
+int PiFaceStallMonitor::Find(const char *category, const char *name)
+{
+	char key[STALL_NAME];
+	if (name != NULL)
+		snprintf(key, sizeof(key), "%s:%s", category, name);
+	else
+		snprintf(key, sizeof(key), "%s", category);
+
+	for (int i = 0; i < section_count; i++)
+		if (!strcmp(sections[i].name, key))
+			return i;
+
+	// full table drops new names, known sections keep working
+	if (section_count >= STALL_SECTIONS)
+		return -1;
+
+	Section *s = &sections[section_count];
+	memcpy(s->name, key, sizeof(key));
+	s->count = 0;
+	s->next = 0;
+	s->last = 0;
+	s->runs = 0;
+	s->overruns = 0;
+
+	return section_count++;
+}
+void PiFaceStallMonitor::SetBudget(long long ns)
+{
+	budget_ns = ns;
+}
+long long PiFaceStallMonitor::Budget()
+{
+	return budget_ns;
+}
+bool PiFaceStallMonitor::Record(int section, long long ns)
+{
+	if (section < 0 || section >= section_count)
+		return false;
+
+	Section *s = &sections[section];
+	s->samples[s->next] = ns;
+	s->next = (s->next + 1) % STALL_WINDOW;
+	if (s->count < STALL_WINDOW)
+		s->count++;
+	s->last = ns;
+	s->runs++;
+
+	if (budget_ns <= 0 || ns <= budget_ns)
+		return false;
+
+	s->overruns++;
+	overruns++;
+	return true;
+}
+void PiFaceStallMonitor::Reset()
+{
+	// names stay, callers cache section numbers
+	for (int i = 0; i < section_count; i++)
+	{
+		sections[i].count = 0;
+		sections[i].next = 0;
+		sections[i].last = 0;
+		sections[i].runs = 0;
+		sections[i].overruns = 0;
+	}
+	overruns = 0;
+}
+int PiFaceStallMonitor::Count()
+{
+	return section_count;
+}
+const char *PiFaceStallMonitor::Name(int section)
+{
+	return section >= 0 && section < section_count ? sections[section].name : "";
+}
+long long PiFaceStallMonitor::Last(int section)
+{
+	return section >= 0 && section < section_count ? sections[section].last : 0;
+}
+long long PiFaceStallMonitor::Max(int section)
+{
+	if (section < 0 || section >= section_count)
+		return 0;
+
+	Section *s = &sections[section];
+	long long max = 0;
+	for (int i = 0; i < s->count; i++)
+		max = std::max(max, s->samples[i]);
+
+	return max;
+}
+long long PiFaceStallMonitor::P99(int section)
+{
+	if (section < 0 || section >= section_count || sections[section].count == 0)
+		return 0;
+
+	Section *s = &sections[section];
+	long long sorted[STALL_WINDOW];
+	memcpy(sorted, s->samples, s->count * sizeof(long long));
+
+	// nearest rank
+	int rank = (s->count * 99 + 99) / 100 - 1;
+	std::nth_element(sorted, sorted + rank, sorted + s->count);
+
+	return sorted[rank];
+}
+unsigned long PiFaceStallMonitor::Runs(int section)
+{
+	return section >= 0 && section < section_count ? sections[section].runs : 0;
+}
+unsigned long PiFaceStallMonitor::Overruns(int section)
+{
+	return section >= 0 && section < section_count ? sections[section].overruns : 0;
+}
+unsigned long PiFaceStallMonitor::Overruns()
+{
+	return overruns;
+}
+void PiFaceStallMonitor::Worst(const char *category, long long *max, long long *p99)
+{
+	size_t len = strlen(category);
+
+	*max = 0;
+	*p99 = 0;
+	for (int i = 0; i < section_count; i++)
+	{
+		// the category itself and its named sections
+		const char *name = sections[i].name;
+		if (strncmp(name, category, len) || (name[len] != 0 && name[len] != ':'))
+			continue;
+
+		*max = std::max(*max, Max(i));
+		*p99 = std::max(*p99, P99(i));
+	}
+}
@@ -0,0 +1,69 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACESTALL_H
+#define PIFACESTALL_H
+
+// samples kept per callback for the rolling statistics
+#define STALL_WINDOW 128
+#define STALL_SECTIONS 48
+#define STALL_NAME 32
+
+// Event loop stall monitor.
+// Callbacks on the INDI event loop are timed into named sections, each
+// keeping its last STALL_WINDOW run times, so max and p99 follow recent
+// behaviour instead of the worst moment since start. Any run over the
+// budget is counted as an overrun and reported to the caller.
+class PiFaceStallMonitor
+{
+private:
+	struct Section
+	{
+		char name[STALL_NAME];
+		long long samples[STALL_WINDOW];
+		int count;
+		int next;
+		long long last;
+		unsigned long runs;
+		unsigned long overruns;
+	} sections[STALL_SECTIONS];
+	int section_count;
+	long long budget_ns;
+	unsigned long overruns;
+public:
+	PiFaceStallMonitor();
+
+	int Find(const char *category, const char *name = 0);
+	void SetBudget(long long ns);
+	long long Budget();
+
+	bool Record(int section, long long ns);
+	void Reset();
+
+	int Count();
+	const char *Name(int section);
+	long long Last(int section);
+	long long Max(int section);
+	long long P99(int section);
+	unsigned long Runs(int section);
+	unsigned long Overruns(int section);
+	unsigned long Overruns();
+	void Worst(const char *category, long long *max, long long *p99);
+};
+
+#endif
@@ -0,0 +1,225 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+#include "piface_sysinfo.h"
+
+#define THERMAL_ZONE "/sys/class/thermal/thermal_zone0/temp"
+
+// skip blanks in place
+static const char *SkipBlanks(const char *p)
+{
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
+
+// copy up to end of line, dropping trailing blanks
+static void CopyLine(char *text, size_t len, const char *p)
+{
+	size_t i = 0;
+	while (p[i] != '\0' && p[i] != '\n' && i < len - 1)
+	{
+		text[i] = p[i];
+		i++;
+	}
+	while (i > 0 && (text[i-1] == ' ' || text[i-1] == '\t'))
+		i--;
+	text[i] = '\0';
+}
+
+// parse unsigned integer part of a decimal number
+static unsigned long ParseULong(const char *p, const char **end)
+{
+	unsigned long value = 0;
+	while (*p >= '0' && *p <= '9')
+	{
+		value = value * 10 + (*p - '0');
+		p++;
+	}
+	if (end)
+		*end = p;
+	return value;
+}
+
+PiFaceSysInfo::PiFaceSysInfo()
+{
+	uptime_fd = -1;
+	loadavg_fd = -1;
+	meminfo_fd = -1;
+	thermal_fd = -1;
+	hardware[0] = '\0';
+}
+PiFaceSysInfo::~PiFaceSysInfo()
+{
+	Close();
+}
+bool PiFaceSysInfo::Open()
+{
+	Close();
+
+	uptime_fd = open("/proc/uptime", O_RDONLY | O_CLOEXEC);
+	loadavg_fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+	meminfo_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+	thermal_fd = open(THERMAL_ZONE, O_RDONLY | O_CLOEXEC);
+
+	// hardware does not change, read it once
+	LoadHardware();
+
+	return uptime_fd != -1 && loadavg_fd != -1 && meminfo_fd != -1;
+}
+void PiFaceSysInfo::Close()
+{
+	if (uptime_fd != -1)
+		close(uptime_fd);
+	if (loadavg_fd != -1)
+		close(loadavg_fd);
+	if (meminfo_fd != -1)
+		close(meminfo_fd);
+	if (thermal_fd != -1)
+		close(thermal_fd);
+
+	uptime_fd = -1;
+	loadavg_fd = -1;
+	meminfo_fd = -1;
+	thermal_fd = -1;
+}
+int PiFaceSysInfo::ReadFile(int fd)
+{
+	if (fd == -1)
+		return -1;
+
+	// procfs and sysfs regenerate contents when read from offset 0
+	ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+	if (n < 0)
+		return -1;
+
+	buffer[n] = '\0';
+	return n;
+}
+void PiFaceSysInfo::LoadHardware()
+{
+	char line[256];
+
+	hardware[0] = '\0';
+
+	FILE *fp = fopen("/proc/cpuinfo", "r");
+	if (fp == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		// prefer Hardware, newer kernels only provide Model
+		bool is_hardware = !strncmp(line, "Hardware", 8);
+		if (!is_hardware && (strncmp(line, "Model", 5) || hardware[0] != '\0'))
+			continue;
+
+		const char *p = strchr(line, ':');
+		if (p == NULL)
+			continue;
+
+		CopyLine(hardware, sizeof(hardware), SkipBlanks(p + 1));
+
+		if (is_hardware)
+			break;
+	}
+	fclose(fp);
+}
+const char * PiFaceSysInfo::Hardware()
+{
+	return hardware;
+}
+bool PiFaceSysInfo::Uptime(char *text, size_t len)
+{
+	if (ReadFile(uptime_fd) <= 0)
+		return false;
+
+	unsigned long seconds = ParseULong(buffer, NULL);
+	unsigned long days = seconds / 86400;
+	unsigned long hours = (seconds % 86400) / 3600;
+	unsigned long minutes = (seconds % 3600) / 60;
+
+	// first field of uptime as published before, days only once past a day
+	if (days > 0)
+		snprintf(text, len, "%lu day%s", days, days == 1 ? "" : "s");
+	else if (hours > 0)
+		snprintf(text, len, "%lu:%02lu", hours, minutes);
+	else
+		snprintf(text, len, "%lu min", minutes);
+
+	return true;
+}
+bool PiFaceSysInfo::Load(char *text, size_t len)
+{
+	if (ReadFile(loadavg_fd) <= 0)
+		return false;
+
+	// first three fields joined with '/'
+	size_t i = 0;
+	int field = 0;
+	const char *p = buffer;
+	while (*p != '\0' && field < 3 && i < len - 1)
+	{
+		if (*p == ' ')
+		{
+			if (++field < 3)
+				text[i++] = '/';
+		}
+		else
+		{
+			text[i++] = *p;
+		}
+		p++;
+	}
+	text[i] = '\0';
+
+	return true;
+}
+bool PiFaceSysInfo::FreeMem(char *text, size_t len)
+{
+	if (ReadFile(meminfo_fd) <= 0)
+		return false;
+
+	const char *p = strstr(buffer, "MemFree:");
+	if (p == NULL)
+		return false;
+
+	CopyLine(text, len, SkipBlanks(p + 8));
+	return true;
+}
+bool PiFaceSysInfo::Temperature(char *text, size_t len)
+{
+	if (ReadFile(thermal_fd) <= 0)
+		return false;
+
+	// millidegrees Celsius
+	const char *p = buffer;
+	bool negative = (*p == '-');
+	if (negative)
+		p++;
+
+	unsigned long millis = ParseULong(p, NULL);
+	snprintf(text, len, "%s%lu.%lu'C", negative ? "-" : "", millis / 1000, (millis % 1000) / 100);
+
+	return true;
+}
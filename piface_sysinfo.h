@@ -0,0 +1,52 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACESYSINFO_H
+#define PIFACESYSINFO_H
+
+#include <stddef.h>
+
+// System info collector reading /proc and /sys directly.
+// Files are kept open and re-read with pread, values are parsed in place
+// into caller supplied buffers so nothing is allocated or forked per update.
+class PiFaceSysInfo
+{
+private:
+	int uptime_fd;
+	int loadavg_fd;
+	int meminfo_fd;
+	int thermal_fd;
+	char hardware[64];
+	char buffer[2048];
+	int ReadFile(int fd);
+	void LoadHardware();
+public:
+	PiFaceSysInfo();
+	~PiFaceSysInfo();
+
+	bool Open();
+	void Close();
+
+	const char *Hardware();
+	bool Uptime(char *text, size_t len);
+	bool Load(char *text, size_t len);
+	bool FreeMem(char *text, size_t len);
+	bool Temperature(char *text, size_t len);
+};
+
+#endif
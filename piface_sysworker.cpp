@@ -0,0 +1,330 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "piface_sysworker.h"
+
+// monotonic clock in milliseconds
+static long long NowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+PiFaceSysWorker::PiFaceSysWorker()
+{
+	memset(&snapshot, 0, sizeof(snapshot));
+	updated = 0;
+	sys_interval = 10;
+	net_interval = 60;
+	net_refresh = false;
+	notify_fd[0] = notify_fd[1] = -1;
+	wake_fd[0] = wake_fd[1] = -1;
+	sched_fd[0] = sched_fd[1] = -1;
+}
+PiFaceSysWorker::~PiFaceSysWorker()
+{
+	Stop();
+}
+bool PiFaceSysWorker::Start(int sys_seconds, int net_seconds)
+{
+	Stop();
+
+	sys_interval = sys_seconds;
+	net_interval = net_seconds;
+
+	if (pipe2(notify_fd, O_NONBLOCK | O_CLOEXEC) == -1 ||
+		pipe2(wake_fd, O_NONBLOCK | O_CLOEXEC) == -1 ||
+		pipe2(sched_fd, O_NONBLOCK | O_CLOEXEC) == -1)
+	{
+		Stop();
+		return false;
+	}
+
+	sysinfo.Open();
+	worker = std::thread(&PiFaceSysWorker::Run, this);
+
+	return true;
+}
+void PiFaceSysWorker::Stop()
+{
+	if (worker.joinable())
+	{
+		// wake up worker and any running probe
+		char c = 1;
+		if (write(wake_fd[1], &c, 1) == -1)
+			perror("PiFaceSysWorker wake");
+		worker.join();
+	}
+
+	sysinfo.Close();
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (notify_fd[i] != -1)
+			close(notify_fd[i]);
+		if (wake_fd[i] != -1)
+			close(wake_fd[i]);
+		if (sched_fd[i] != -1)
+			close(sched_fd[i]);
+		notify_fd[i] = wake_fd[i] = sched_fd[i] = -1;
+	}
+	updated = 0;
+}
+void PiFaceSysWorker::SetIntervals(int sys_seconds, int net_seconds)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		sys_interval = sys_seconds;
+		net_interval = net_seconds;
+	}
+
+	// reschedule a sleeping worker
+	char c = 1;
+	if (sched_fd[1] != -1 && write(sched_fd[1], &c, 1) == -1)
+		return;
+}
+void PiFaceSysWorker::RefreshNetInfo()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		net_refresh = true;
+	}
+
+	// wake up a sleeping worker
+	char c = 1;
+	if (sched_fd[1] != -1 && write(sched_fd[1], &c, 1) == -1)
+		return;
+}
+int PiFaceSysWorker::NotifyFd()
+{
+	return notify_fd[0];
+}
+int PiFaceSysWorker::Fetch(PiFaceSysSnapshot *copy)
+{
+	// drain notifications
+	char buffer[16];
+	while (read(notify_fd[0], buffer, sizeof(buffer)) > 0)
+		;
+
+	std::lock_guard<std::mutex> guard(lock);
+	int what = updated;
+	memcpy(copy, &snapshot, sizeof(snapshot));
+	updated = 0;
+
+	return what;
+}
+void PiFaceSysWorker::Notify(int what)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		updated |= what;
+	}
+
+	// wake up the event loop, a full pipe already has a pending wakeup
+	char c = 1;
+	if (write(notify_fd[1], &c, 1) == -1)
+		return;
+}
+bool PiFaceSysWorker::Sleep(int timeout)
+{
+	struct pollfd pfd[2];
+	pfd[0].fd = wake_fd[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sched_fd[0];
+	pfd[1].events = POLLIN;
+
+	if (poll(pfd, 2, timeout) > 0)
+	{
+		// false if woken up for stop
+		if (pfd[0].revents)
+			return false;
+
+		// intervals changed, drain and reschedule
+		char buffer[16];
+		while (read(sched_fd[0], buffer, sizeof(buffer)) > 0)
+			;
+	}
+	return true;
+}
+void PiFaceSysWorker::Run()
+{
+	long long last_sys = 0;
+	long long last_net = 0;
+	bool first = true;
+
+	while (true)
+	{
+		int sys_ms, net_ms;
+		bool refresh;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			sys_ms = sys_interval * 1000;
+			net_ms = net_interval * 1000;
+			refresh = net_refresh;
+			net_refresh = false;
+		}
+
+		long long now = NowMs();
+
+		if (first || now - last_sys >= sys_ms)
+		{
+			CollectSysInfo();
+			last_sys = now;
+		}
+
+		if (first || refresh || now - last_net >= net_ms)
+		{
+			CollectNetInfo();
+			last_net = NowMs();
+		}
+		first = false;
+
+		long long next_sys = last_sys + sys_ms;
+		long long next_net = last_net + net_ms;
+		long long next = next_sys < next_net ? next_sys : next_net;
+		long long timeout = next - NowMs();
+		if (!Sleep(timeout > 0 ? (int) timeout : 0))
+			break;
+	}
+}
+void PiFaceSysWorker::CollectSysInfo()
+{
+	PiFaceSysSnapshot info;
+
+	strncpy(info.hardware, sysinfo.Hardware(), sizeof(info.hardware) - 1);
+	info.hardware[sizeof(info.hardware) - 1] = '\0';
+	if (!sysinfo.Uptime(info.uptime, sizeof(info.uptime)))
+		info.uptime[0] = '\0';
+	if (!sysinfo.Load(info.load, sizeof(info.load)))
+		info.load[0] = '\0';
+	if (!sysinfo.FreeMem(info.freemem, sizeof(info.freemem)))
+		info.freemem[0] = '\0';
+	if (!sysinfo.Temperature(info.temperature, sizeof(info.temperature)))
+		info.temperature[0] = '\0';
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		memcpy(snapshot.hardware, info.hardware, sizeof(info.hardware));
+		memcpy(snapshot.uptime, info.uptime, sizeof(info.uptime));
+		memcpy(snapshot.load, info.load, sizeof(info.load));
+		memcpy(snapshot.freemem, info.freemem, sizeof(info.freemem));
+		memcpy(snapshot.temperature, info.temperature, sizeof(info.temperature));
+	}
+	Notify(SYSINFO_UPDATED);
+}
+void PiFaceSysWorker::CollectNetInfo()
+{
+	PiFaceSysSnapshot info;
+	static const char *const dig[] = { "dig", "+short", "+time=2", "+tries=1", "myip.opendns.com", "@resolver1.opendns.com", NULL };
+
+	// a failed or timed out probe is published as empty
+	if (!RunProbe(dig, info.publicip, sizeof(info.publicip), PROBE_TIMEOUT_PUBLIC))
+		info.publicip[0] = '\0';
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		memcpy(snapshot.publicip, info.publicip, sizeof(info.publicip));
+	}
+	Notify(NETINFO_UPDATED);
+}
+bool PiFaceSysWorker::RunProbe(const char *const argv[], char *text, size_t len, int timeout)
+{
+	int out[2];
+	if (pipe2(out, O_CLOEXEC) == -1)
+		return false;
+
+	pid_t pid = fork();
+	if (pid == -1)
+	{
+		close(out[0]);
+		close(out[1]);
+		return false;
+	}
+
+	if (pid == 0)
+	{
+		// child
+		dup2(out[1], STDOUT_FILENO);
+		int devnull = open("/dev/null", O_WRONLY);
+		if (devnull != -1)
+			dup2(devnull, STDERR_FILENO);
+		// no shell in between, a timeout kills the probe itself
+		execvp(argv[0], const_cast<char *const *>(argv));
+		_exit(127);
+	}
+
+	close(out[1]);
+
+	size_t n = 0;
+	bool done = false;
+	long long deadline = NowMs() + timeout;
+
+	while (!done)
+	{
+		long long left = deadline - NowMs();
+		if (left <= 0)
+			break;
+
+		struct pollfd pfd[2];
+		pfd[0].fd = out[0];
+		pfd[0].events = POLLIN;
+		pfd[1].fd = wake_fd[0];
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, 2, (int) left) <= 0)
+			break;
+
+		if (pfd[1].revents)
+			break;
+
+		char buffer[128];
+		ssize_t r = read(out[0], buffer, sizeof(buffer));
+		if (r <= 0)
+		{
+			done = true;
+			break;
+		}
+
+		// keep first line only
+		for (ssize_t i = 0; i < r && n < len - 1; i++)
+			text[n++] = buffer[i];
+	}
+	close(out[0]);
+
+	if (!done)
+		kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	text[n] = '\0';
+	char *eol = strchr(text, '\n');
+	if (eol)
+		*eol = '\0';
+
+	return done;
+}
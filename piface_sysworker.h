@@ -0,0 +1,83 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACESYSWORKER_H
+#define PIFACESYSWORKER_H
+
+#include <stddef.h>
+#include <thread>
+#include <mutex>
+
+#include "piface_sysinfo.h"
+
+// probe timeout in milliseconds
+#define PROBE_TIMEOUT_PUBLIC 5000
+
+struct PiFaceSysSnapshot
+{
+	char hardware[64];
+	char uptime[32];
+	char load[32];
+	char freemem[32];
+	char temperature[16];
+	char publicip[64];
+};
+
+// Background collector for system and network info.
+// Results are kept in a snapshot and announced on NotifyFd(), which the
+// driver registers with the INDI event loop, so slow probes never block it.
+class PiFaceSysWorker
+{
+private:
+	std::thread worker;
+	std::mutex lock;
+	PiFaceSysSnapshot snapshot;
+	PiFaceSysInfo sysinfo;
+	int updated;
+	int sys_interval;
+	int net_interval;
+	bool net_refresh;
+	int notify_fd[2];
+	int wake_fd[2];
+	int sched_fd[2];
+	void Run();
+	void CollectSysInfo();
+	void CollectNetInfo();
+	void Notify(int what);
+	bool Sleep(int timeout);
+	bool RunProbe(const char *const argv[], char *text, size_t len, int timeout);
+public:
+	enum
+	{
+		SYSINFO_UPDATED = 1,
+		NETINFO_UPDATED = 2
+	};
+
+	PiFaceSysWorker();
+	~PiFaceSysWorker();
+
+	bool Start(int sys_seconds, int net_seconds);
+	void Stop();
+	void SetIntervals(int sys_seconds, int net_seconds);
+	void RefreshNetInfo();
+
+	int NotifyFd();
+	int Fetch(PiFaceSysSnapshot *copy);
+};
+
+#endif
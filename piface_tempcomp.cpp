@@ -0,0 +1,93 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <math.h>
+
+#include "piface_tempcomp.h"
+
+PiFaceTempComp::PiFaceTempComp()
+{
+	coefficient = 0;
+	threshold = 1;
+	reference = 0;
+	temperature = 0;
+	applied = 0;
+	queued = 0;
+	valid = false;
+}
+void PiFaceTempComp::Configure(double steps_per_degree, int threshold_steps)
+{
+	coefficient = steps_per_degree;
+	threshold = threshold_steps > 0 ? threshold_steps : 1;
+}
+void PiFaceTempComp::Reset()
+{
+	// focus is good at the current temperature
+	reference = temperature;
+	applied = 0;
+	queued = 0;
+}
+int PiFaceTempComp::Update(double celsius)
+{
+	temperature = celsius;
+
+	// first reading becomes the reference
+	if (!valid)
+	{
+		valid = true;
+		Reset();
+		return 0;
+	}
+
+	double pending = Pending();
+	if (fabs(pending) < threshold)
+		return 0;
+
+	return (int) (pending < 0 ? pending - 0.5 : pending + 0.5);
+}
+void PiFaceTempComp::Applied(int steps)
+{
+	applied += steps;
+}
+void PiFaceTempComp::Queued(int steps)
+{
+	queued += steps;
+}
+int PiFaceTempComp::Dequeue()
+{
+	// the caller applies them if the move ran
+	int steps = queued;
+	queued = 0;
+	return steps;
+}
+bool PiFaceTempComp::Valid()
+{
+	return valid;
+}
+double PiFaceTempComp::Temperature()
+{
+	return temperature;
+}
+double PiFaceTempComp::Reference()
+{
+	return reference;
+}
+double PiFaceTempComp::Pending()
+{
+	return coefficient * (temperature - reference) - applied - queued;
+}
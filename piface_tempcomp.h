@@ -0,0 +1,56 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACETEMPCOMP_H
+#define PIFACETEMPCOMP_H
+
+// Temperature compensation with hysteresis.
+// The correction follows steps per degree from the reference temperature,
+// but is only handed out once the part not yet applied reaches the
+// threshold, so a slow drift becomes a few larger moves instead of many
+// single steps that each pay backlash and settle time. Steps of a move
+// that waits for the camera readout or for the motor are held as queued
+// and only count as applied once the move has run.
+class PiFaceTempComp
+{
+private:
+	double coefficient;
+	int threshold;
+	double reference;
+	double temperature;
+	double applied;
+	int queued;
+	bool valid;
+public:
+	PiFaceTempComp();
+
+	void Configure(double steps_per_degree, int threshold_steps);
+	void Reset();
+
+	int Update(double celsius);
+	void Applied(int steps);
+	void Queued(int steps);
+	int Dequeue();
+
+	bool Valid();
+	double Temperature();
+	double Reference();
+	double Pending();
+};
+
+#endif
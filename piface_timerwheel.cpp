@@ -0,0 +1,171 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stddef.h>
+
+#include "piface_timerwheel.h"
+
+// ticks covered by levels up to and including level
+#define WHEEL_SPAN(level) (1UL << (WHEEL_L0_BITS + (level) * WHEEL_LN_BITS))
+
+PiFaceTimerWheel::PiFaceTimerWheel()
+{
+	Reset(0);
+}
+void PiFaceTimerWheel::InitList(PiFaceTimer *head)
+{
+	head->next = head;
+	head->prev = head;
+}
+void PiFaceTimerWheel::InitTimer(PiFaceTimer *timer, int id)
+{
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->expires = 0;
+	timer->id = id;
+}
+void PiFaceTimerWheel::Unlink(PiFaceTimer *timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+void PiFaceTimerWheel::Reset(unsigned long now)
+{
+	current = now;
+	pending = 0;
+
+	for (int i = 0; i < WHEEL_L0_SIZE; i++)
+		InitList(&l0[i]);
+	for (int level = 0; level < WHEEL_LEVELS - 1; level++)
+		for (int i = 0; i < WHEEL_LN_SIZE; i++)
+			InitList(&ln[level][i]);
+}
+void PiFaceTimerWheel::Insert(PiFaceTimer *timer)
+{
+	unsigned long delta = timer->expires - current;
+	PiFaceTimer *head;
+
+	if ((long) delta < 0)
+	{
+		// already due, fire on next tick
+		timer->expires = current;
+		head = &l0[current & (WHEEL_L0_SIZE - 1)];
+	}
+	else if (delta < WHEEL_SPAN(0))
+	{
+		head = &l0[timer->expires & (WHEEL_L0_SIZE - 1)];
+	}
+	else
+	{
+		// clamp to the wheel range
+		if (delta >= WHEEL_SPAN(WHEEL_LEVELS - 1))
+			timer->expires = current + WHEEL_SPAN(WHEEL_LEVELS - 1) - 1;
+
+		int level = 1;
+		while (level < WHEEL_LEVELS - 1 && delta >= WHEEL_SPAN(level))
+			level++;
+
+		int shift = WHEEL_L0_BITS + (level - 1) * WHEEL_LN_BITS;
+		head = &ln[level - 1][(timer->expires >> shift) & (WHEEL_LN_SIZE - 1)];
+	}
+
+	// append
+	timer->next = head;
+	timer->prev = head->prev;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+void PiFaceTimerWheel::Schedule(PiFaceTimer *timer, unsigned long expires)
+{
+	if (Scheduled(timer))
+		Unlink(timer);
+	else
+		pending++;
+
+	timer->expires = expires;
+	Insert(timer);
+}
+void PiFaceTimerWheel::Cancel(PiFaceTimer *timer)
+{
+	if (!Scheduled(timer))
+		return;
+
+	Unlink(timer);
+	pending--;
+}
+bool PiFaceTimerWheel::Scheduled(PiFaceTimer *timer)
+{
+	return timer->next != NULL;
+}
+int PiFaceTimerWheel::Pending()
+{
+	return pending;
+}
+unsigned long PiFaceTimerWheel::Now()
+{
+	return current;
+}
+void PiFaceTimerWheel::Cascade(int level)
+{
+	int shift = WHEEL_L0_BITS + (level - 1) * WHEEL_LN_BITS;
+	PiFaceTimer *head = &ln[level - 1][(current >> shift) & (WHEEL_LN_SIZE - 1)];
+
+	// move the whole slot one level down
+	PiFaceTimer *timer = head->next;
+	InitList(head);
+	while (timer != head)
+	{
+		PiFaceTimer *next = timer->next;
+		Insert(timer);
+		timer = next;
+	}
+}
+void PiFaceTimerWheel::Advance(unsigned long now, Expired *fp, void *p)
+{
+	while ((long) (now - current) >= 0)
+	{
+		int index = current & (WHEEL_L0_SIZE - 1);
+
+		// refill first level when it wraps
+		if (index == 0)
+		{
+			for (int level = 1; level < WHEEL_LEVELS; level++)
+			{
+				Cascade(level);
+				int shift = WHEEL_L0_BITS + (level - 1) * WHEEL_LN_BITS;
+				if (((current >> shift) & (WHEEL_LN_SIZE - 1)) != 0)
+					break;
+			}
+		}
+
+		PiFaceTimer *head = &l0[index];
+		while (head->next != head)
+		{
+			PiFaceTimer *timer = head->next;
+			Unlink(timer);
+			pending--;
+
+			// callback may schedule the timer again
+			fp(timer, p);
+		}
+
+		current++;
+	}
+}
@@ -0,0 +1,69 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACETIMERWHEEL_H
+#define PIFACETIMERWHEEL_H
+
+// wheel geometry, 256 ticks on the first level and 64 slots above it
+#define WHEEL_L0_BITS 8
+#define WHEEL_LN_BITS 6
+#define WHEEL_L0_SIZE (1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SIZE (1 << WHEEL_LN_BITS)
+#define WHEEL_LEVELS 3
+
+// Timer entry, owned by the caller and linked into the wheel in place.
+struct PiFaceTimer
+{
+	PiFaceTimer *next;
+	PiFaceTimer *prev;
+	unsigned long expires;
+	int id;
+};
+
+// Hierarchical timer wheel with O(1) insert and cancel.
+// Timers beyond the first level are cascaded down as time advances, so
+// the cost of a tick does not depend on the number of pending timers.
+class PiFaceTimerWheel
+{
+private:
+	unsigned long current;
+	int pending;
+	PiFaceTimer l0[WHEEL_L0_SIZE];
+	PiFaceTimer ln[WHEEL_LEVELS - 1][WHEEL_LN_SIZE];
+	static void InitList(PiFaceTimer *head);
+	static void Unlink(PiFaceTimer *timer);
+	void Insert(PiFaceTimer *timer);
+	void Cascade(int level);
+public:
+	typedef void (Expired)(PiFaceTimer *timer, void *p);
+
+	PiFaceTimerWheel();
+
+	void Reset(unsigned long now);
+	void Schedule(PiFaceTimer *timer, unsigned long expires);
+	void Cancel(PiFaceTimer *timer);
+	bool Scheduled(PiFaceTimer *timer);
+	int Pending();
+	unsigned long Now();
+
+	void Advance(unsigned long now, Expired *fp, void *p);
+
+	static void InitTimer(PiFaceTimer *timer, int id);
+};
+
+#endif
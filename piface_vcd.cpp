@@ -0,0 +1,188 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "piface_vcd.h"
+
+// signal names by chip, port and bit, as wired on the PiFace boards
+static const char *signal_names[VCD_CHIPS][2][8] =
+{
+	{
+		{ "relay1", "relay2", "relay3", "relay4", "focuser2_coil1", "focuser2_coil2", "focuser2_coil3", "focuser2_coil4" },
+		{ "focuser1_coil1", "focuser1_coil2", "focuser1_coil3", "focuser1_coil4", "input1", "input2", "input3", "input4" }
+	},
+	{
+		{ "relay5", "relay6", "relay7", "relay8", "gpa4", "gpa5", "gpa6", "gpa7" },
+		{ "gpb0", "gpb1", "gpb2", "gpb3", "gpb4", "gpb5", "gpb6", "gpb7" }
+	}
+};
+
+// per port: vector, write event, eight bits
+#define VCD_PORT_SIGNALS 10
+
+static FILE *vcd_fp = NULL;
+static bool vcd_checked = false;
+static long long vcd_start = 0;
+static long long vcd_last = -1;
+static uint8_t vcd_pins[VCD_CHIPS][2];
+
+static long long MonotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// identifier codes are printable characters from '!'
+static char Id(int hw, int port, int signal)
+{
+	return (char) ('!' + (hw * 2 + port) * VCD_PORT_SIGNALS + signal);
+}
+
+bool PiFaceVcd::Open()
+{
+	// environment is looked up once
+	if (!vcd_checked)
+	{
+		vcd_checked = true;
+		const char *path = getenv(VCD_ENV);
+		if (path != NULL && path[0] != 0)
+		{
+			// drivers started by one indiserver share the environment
+			char name[1024];
+			const char *pid = strstr(path, "%d");
+			if (pid != NULL)
+				snprintf(name, sizeof(name), "%.*s%d%s", (int) (pid - path), path, (int) getpid(), pid + 2);
+			else
+				snprintf(name, sizeof(name), "%s", path);
+			Start(name);
+		}
+	}
+
+	return vcd_fp != NULL;
+}
+bool PiFaceVcd::Start(const char *path)
+{
+	Stop();
+
+	vcd_fp = fopen(path, "w");
+	if (vcd_fp == NULL)
+		return false;
+
+	vcd_checked = true;
+	vcd_start = MonotonicNs();
+	vcd_last = -1;
+	memset(vcd_pins, 0, sizeof(vcd_pins));
+	Header();
+
+	return true;
+}
+void PiFaceVcd::Stop()
+{
+	if (vcd_fp != NULL)
+		fclose(vcd_fp);
+	vcd_fp = NULL;
+}
+bool PiFaceVcd::IsStarted()
+{
+	return vcd_fp != NULL;
+}
+void PiFaceVcd::Header()
+{
+	time_t now = time(NULL);
+	char date[32];
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+	fprintf(vcd_fp, "$date %s $end\n", date);
+	fprintf(vcd_fp, "$version indi-piface simulated MCP23S17 $end\n");
+	fprintf(vcd_fp, "$timescale 1ns $end\n");
+	fprintf(vcd_fp, "$scope module piface $end\n");
+	for (int hw = 0; hw < VCD_CHIPS; hw++)
+	{
+		fprintf(vcd_fp, "$scope module chip%d $end\n", hw);
+		for (int port = 0; port < 2; port++)
+		{
+			char p = port ? 'b' : 'a';
+			fprintf(vcd_fp, "$var wire 8 %c gpio%c [7:0] $end\n", Id(hw, port, 0), p);
+			fprintf(vcd_fp, "$var event 1 %c gpio%c_write $end\n", Id(hw, port, 1), p);
+			for (int bit = 0; bit < 8; bit++)
+				fprintf(vcd_fp, "$var wire 1 %c %s $end\n", Id(hw, port, 2 + bit), signal_names[hw][port][bit]);
+		}
+		fprintf(vcd_fp, "$upscope $end\n");
+	}
+	fprintf(vcd_fp, "$upscope $end\n");
+	fprintf(vcd_fp, "$enddefinitions $end\n");
+
+	// power-on pins are inputs, read low without a board attached
+	fprintf(vcd_fp, "#0\n$dumpvars\n");
+	for (int hw = 0; hw < VCD_CHIPS; hw++)
+	{
+		for (int port = 0; port < 2; port++)
+		{
+			fprintf(vcd_fp, "b0 %c\n", Id(hw, port, 0));
+			for (int bit = 0; bit < 8; bit++)
+				fprintf(vcd_fp, "0%c\n", Id(hw, port, 2 + bit));
+		}
+	}
+	fprintf(vcd_fp, "$end\n");
+	vcd_last = 0;
+}
+void PiFaceVcd::Stamp()
+{
+	// changes in the same nanosecond share one timestamp
+	long long t = MonotonicNs() - vcd_start;
+	if (t > vcd_last)
+	{
+		fprintf(vcd_fp, "#%lld\n", t);
+		vcd_last = t;
+	}
+}
+void PiFaceVcd::Pins(uint8_t hw, int port, uint8_t levels, uint8_t changed, bool write)
+{
+	if (hw >= VCD_CHIPS || port < 0 || port > 1 || !Open())
+		return;
+
+	// only the bits this bus instance drove
+	uint8_t previous = vcd_pins[hw][port];
+	uint8_t pins = (previous & ~changed) | (levels & changed);
+	if (pins == previous && !write)
+		return;
+
+	Stamp();
+	if (write)
+		fprintf(vcd_fp, "1%c\n", Id(hw, port, 1));
+	if (pins == previous)
+		return;
+
+	char vector[9];
+	for (int bit = 0; bit < 8; bit++)
+		vector[bit] = pins & (0x80 >> bit) ? '1' : '0';
+	vector[8] = 0;
+	fprintf(vcd_fp, "b%s %c\n", vector, Id(hw, port, 0));
+
+	for (int bit = 0; bit < 8; bit++)
+		if ((pins ^ previous) & (1 << bit))
+			fprintf(vcd_fp, "%c%c\n", pins & (1 << bit) ? '1' : '0', Id(hw, port, 2 + bit));
+
+	vcd_pins[hw][port] = pins;
+}
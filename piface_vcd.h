@@ -0,0 +1,51 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef PIFACEVCD_H
+#define PIFACEVCD_H
+
+#include <stdint.h>
+
+// environment variable naming the waveform file, %d becomes the pid
+#define VCD_ENV "PIFACE_VCD"
+
+// chips on the PiFace Relay Plus board
+#define VCD_CHIPS 2
+
+// Value Change Dump of the simulated MCP23S17 pins.
+// The simulated backend reports the pin levels of GPIOA/GPIOB after every
+// write, with a nanosecond CLOCK_MONOTONIC timestamp. Each bus instance
+// only drives the bits it changed, so devices sharing a port in one
+// process merge into one waveform. Relays, coils and inputs are named
+// signals next to the raw port vectors and a write event per port, and
+// the file opens in GTKWave or any other VCD viewer.
+class PiFaceVcd
+{
+private:
+	static bool Open();
+	static void Header();
+	static void Stamp();
+public:
+	static bool Start(const char *path);
+	static void Stop();
+	static bool IsStarted();
+
+	static void Pins(uint8_t hw, int port, uint8_t levels, uint8_t changed, bool write);
+};
+
+#endif
@@ -0,0 +1,720 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// Unit tests of the driver core on the simulated MCP23S17.
+//
+//   piface_tests [name...]
+//
+// Every failed CHECK is reported with its line and makes the program exit
+// non-zero, so ctest marks the run as failed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <memory>
+#include <eventloop.h>
+#include <lilxml.h>
+
+#include "piface_mcp23s17.h"
+#include "piface_inputs.h"
+#include "piface_timerwheel.h"
+#include "piface_eventring.h"
+#include "piface_autofocus.h"
+#include "piface_tempcomp.h"
+#include "piface_stall.h"
+#include "piface_relay.h"
+#include "piface_focuser.h"
+#include "piface_recorder.h"
+#include "piface_vcd.h"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) \
+		{ \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			failures++; \
+		} \
+	} while (0)
+
+static void WheelExpired(PiFaceTimer *timer, void *p)
+{
+	PiFaceTimerWheel *wheel = static_cast<PiFaceTimerWheel *>(p);
+
+	// fires on its own tick, also after a cascade from the upper levels
+	CHECK(wheel->Now() == timer->expires);
+	timer->id += 100;
+}
+
+static void TestTimerWheel()
+{
+	PiFaceTimerWheel wheel;
+	PiFaceTimer timers[4];
+	const unsigned long expires[4] = { 5, 300, 70000, 80000 };
+
+	wheel.Reset(0);
+	for (int i = 0; i < 4; i++)
+	{
+		PiFaceTimerWheel::InitTimer(&timers[i], i);
+		wheel.Schedule(&timers[i], expires[i]);
+	}
+	CHECK(wheel.Pending() == 4);
+
+	wheel.Advance(4, WheelExpired, &wheel);
+	CHECK(timers[0].id == 0);
+
+	wheel.Advance(5, WheelExpired, &wheel);
+	CHECK(timers[0].id == 100);
+	CHECK(!wheel.Scheduled(&timers[0]));
+
+	// cancelled timer never fires
+	wheel.Cancel(&timers[3]);
+	wheel.Advance(90000, WheelExpired, &wheel);
+	CHECK(timers[1].id == 101);
+	CHECK(timers[2].id == 102);
+	CHECK(timers[3].id == 3);
+	CHECK(wheel.Pending() == 0);
+}
+
+static void TestEventRing()
+{
+	static PiFaceEventRing ring;
+	static PiFaceEvent events[EVENT_RING_SIZE];
+
+	ring.Record(PiFaceEventRing::EVENT_MOVE_START, 1, 10);
+	ring.Record(PiFaceEventRing::EVENT_MOVE_END, 1, 20);
+	CHECK(ring.Snapshot(events, EVENT_RING_SIZE) == 2);
+	CHECK(events[0].type == PiFaceEventRing::EVENT_MOVE_START && events[0].value == 10);
+	CHECK(events[1].type == PiFaceEventRing::EVENT_MOVE_END && events[1].value == 20);
+	CHECK(events[0].time <= events[1].time);
+
+	// oldest entries are overwritten
+	for (int i = 0; i < EVENT_RING_SIZE + 5; i++)
+		ring.Record(PiFaceEventRing::EVENT_STEP_BATCH, 0, i);
+	CHECK(ring.Snapshot(events, EVENT_RING_SIZE) == EVENT_RING_SIZE);
+	CHECK(events[0].value == 5);
+	CHECK(events[EVENT_RING_SIZE - 1].value == EVENT_RING_SIZE + 4);
+
+	int size = 0;
+	char *csv = ring.Export(PiFaceEventRing::EXPORT_CSV, &size);
+	CHECK(csv != NULL && !strncmp(csv, "time_ns,event,id,value\n", 23));
+	free(csv);
+
+	ring.Clear();
+	CHECK(ring.Snapshot(events, EVENT_RING_SIZE) == 0);
+}
+
+static void TestAutofocus()
+{
+	PiFaceAutofocus autofocus;
+
+	// seven samples around 1000, sweep shifted to fit the travel
+	CHECK(!autofocus.Start(1000, 2, 50, 1, 0, 0, 5000));
+	CHECK(autofocus.Start(100, 7, 50, 1, 0, 0, 5000));
+	CHECK(autofocus.Target() == 0);
+
+	CHECK(autofocus.Start(1000, 7, 50, 1, 0, 0, 5000));
+	CHECK(autofocus.Target() == 850);
+
+	// parabola with its vertex at 1020
+	while (!autofocus.Done())
+	{
+		double u = (autofocus.Target() - 1020) / 100.0;
+		autofocus.Sample(2.0 + u * u);
+	}
+
+	int best = 0;
+	double value = 0, minimum = 0;
+	CHECK(autofocus.Fit(&best, &value, &minimum));
+	CHECK(abs(best - 1020) <= 1);
+	CHECK(fabs(value - 2.0) < 0.01);
+	CHECK(fabs(minimum - 2.04) < 0.001);
+}
+
+static void TestTempComp()
+{
+	PiFaceTempComp tempcomp;
+	tempcomp.Configure(-10, 5);
+
+	// first reading is the reference, below the threshold nothing moves
+	CHECK(tempcomp.Update(10.0) == 0);
+	CHECK(tempcomp.Update(10.3) == 0);
+	CHECK(tempcomp.Update(11.0) == -10);
+
+	// queued for the readout, not handed out again
+	tempcomp.Queued(-10);
+	CHECK(tempcomp.Update(11.0) == 0);
+
+	// dropped move is pending again
+	CHECK(tempcomp.Dequeue() == -10);
+	CHECK(tempcomp.Update(11.0) == -10);
+
+	// applied once moved
+	tempcomp.Applied(-10);
+	CHECK(tempcomp.Update(11.0) == 0);
+	CHECK(fabs(tempcomp.Pending()) < 1e-9);
+
+	tempcomp.Queued(-3);
+	tempcomp.Reset();
+	CHECK(tempcomp.Dequeue() == 0);
+	CHECK(tempcomp.Reference() == 11.0);
+}
+
+static void TestStall()
+{
+	PiFaceStallMonitor stall;
+	int a = stall.Find("switch", "RELAY1");
+	int b = stall.Find("switch", "RELAY2");
+	CHECK(a >= 0 && b >= 0 && a != b);
+	CHECK(stall.Find("switch", "RELAY1") == a);
+
+	stall.SetBudget(1000);
+	for (int i = 1; i <= 100; i++)
+		CHECK(stall.Record(a, i * 10) == (i > 100));
+	CHECK(stall.Record(b, 5000));
+
+	CHECK(stall.Max(a) == 1000);
+	CHECK(stall.P99(a) == 990);
+	CHECK(stall.Overruns(b) == 1 && stall.Overruns() == 1);
+
+	long long max = 0, p99 = 0;
+	stall.Worst("switch", &max, &p99);
+	CHECK(max == 5000);
+}
+
+static void TestMcp23s17()
+{
+	PiFaceMcp23s17 bus;
+	CHECK(bus.Open(0, 0, true));
+
+	// each owner writes only its bits
+	bus.WriteBits(0x08, IOCON_BUS_MASK, IOCON, 0);
+	bus.WriteBits(INT_MIRROR_ON | ODR_ON, IOCON_INT_MASK, IOCON, 0);
+	bus.WriteBits(SEQOP_ON | HAEN_ON, IOCON_BUS_MASK, IOCON, 0);
+	CHECK(bus.ReadReg(IOCON, 0) == (INT_MIRROR_ON | ODR_ON | HAEN_ON));
+
+	// relay and motor nibbles of one port
+	bus.WriteBits(0x00, 0xff, IODIRA, 0);
+	bus.WriteBits(0x05, 0x0f, GPIOA, 0);
+	bus.WriteBits(0xa0, 0xf0, GPIOA, 0);
+	bus.WriteBits(0x03, 0x0f, GPIOA, 0);
+	CHECK(bus.ReadReg(OLATA, 0) == 0xa3);
+
+	// latches come from the image without a read
+	unsigned long reads = bus.Reads();
+	CHECK(bus.Latch(GPIOA, 0) == 0xa3);
+	bus.WriteBits(0x00, 0xf0, GPIOA, 0);
+	CHECK(bus.Reads() == reads);
+	CHECK(bus.ReadReg(GPIOA, 0) == 0x03);
+
+	// sequential transfer across registers
+	uint8_t regs[2] = { 0x11, 0x22 };
+	CHECK(bus.WriteRegs(regs, 2, OLATA, 1));
+	CHECK(bus.Latch(GPIOB, 1) == 0x22);
+	CHECK(bus.ReadRegs(regs, 2, OLATA, 1) && regs[0] == 0x11 && regs[1] == 0x22);
+	CHECK(!bus.ReadRegs(regs, 4, OLATA, 0));
+}
+
+static void InputsChanged(uint8_t changed, uint8_t levels, void *p)
+{
+	uint8_t *last = static_cast<uint8_t *>(p);
+	CHECK(changed != 0);
+	*last = levels;
+}
+
+static void TestInputs()
+{
+	PiFaceMcp23s17 bus;
+	CHECK(bus.Open(0, 0, true));
+	bus.WriteBits(HAEN_ON, IOCON_BUS_MASK, IOCON, 0);
+	bus.SimSetInputs(INPUT_CHIP, INPUT_PORT, INPUT_MASK);
+
+	// interrupt bits of other pins survive a start and stop
+	bus.WriteReg(0x03, GPINTENA + INPUT_PORT, INPUT_CHIP);
+	uint8_t last = 0;
+	PiFaceInputs inputs;
+	CHECK(inputs.Start(&bus, INPUT_CHIP, INPUT_PORT, 0x30, InputsChanged, &last));
+	CHECK(bus.ReadReg(GPINTENA + INPUT_PORT, INPUT_CHIP) == 0x33);
+	CHECK(bus.ReadReg(IOCON, INPUT_CHIP) == (HAEN_ON | INT_MIRROR_ON | ODR_ON | INTPOL_LOW));
+	CHECK(inputs.Levels() == 0x30);
+	inputs.Stop();
+	CHECK(!inputs.IsStarted());
+	CHECK(bus.ReadReg(GPINTENA + INPUT_PORT, INPUT_CHIP) == 0x03);
+}
+
+// driver internals the checks look at, a friend of the driver classes
+class PiFaceTests
+{
+public:
+	static PiFaceMcp23s17 &Bus(IndiPiFaceRelay *relay) { return relay->bus; }
+	static bool PwmScheduled(IndiPiFaceRelay *relay, int i) { return relay->pwm_wheel.Scheduled(&relay->pwm_timer[i]); }
+	static PiFaceMcp23s17 &Bus(IndiPiFaceFocuser1 *focuser) { return focuser->bus; }
+	static PiFaceRealtime &Realtime(IndiPiFaceFocuser1 *focuser) { return focuser->realtime; }
+};
+
+// config loads dispatch through the entry points of piface_driver.cpp
+extern std::unique_ptr<IndiPiFaceRelay> indiPiFaceRelay;
+extern std::unique_ptr<IndiPiFaceFocuser1> indiPiFaceFocuser1;
+
+static void SwitchRelay(IndiPiFaceRelay *relay, const char *name, const char *element)
+{
+	ISState states[1] = { ISS_ON };
+	char *names[1] = { const_cast<char *>(element) };
+	relay->ISNewSwitch(relay->getDeviceName(), name, states, names, 1);
+}
+
+static void NumberRelay(IndiPiFaceRelay *relay, const char *name, const char *element, double value)
+{
+	double values[1] = { value };
+	char *names[1] = { const_cast<char *>(element) };
+	relay->ISNewNumber(relay->getDeviceName(), name, values, names, 1);
+}
+
+static void TestRelay()
+{
+	IndiPiFaceRelay relay;
+	relay.ISGetProperties(NULL);
+	relay.setSimulation(true);
+
+	SwitchRelay(&relay, "CONNECTION", "CONNECT");
+	CHECK(relay.isConnected());
+	if (!relay.isConnected())
+		return;
+
+	PiFaceMcp23s17 &bus = PiFaceTests::Bus(&relay);
+
+	// a click toggles one relay from the latch image, the only read is
+	// the default readback of the write
+	unsigned long reads = relay.SpiReads();
+	SwitchRelay(&relay, "RELAY1", "REL1BTN");
+	CHECK(relay.SpiReads() - reads == 1);
+	CHECK((bus.ReadReg(OLATA, 0) & RELAY_MASK) == 0x01);
+	CHECK(relay.getSwitch("RELAY1")->sp[0].s == ISS_ON);
+	CHECK(relay.getSwitch("RELAY1")->s == IPS_OK);
+
+	SwitchRelay(&relay, "RELAY6", "REL6BTN");
+	CHECK((bus.ReadReg(OLATA, 1) & RELAY_MASK) == 0x02);
+
+	SwitchRelay(&relay, "RELAY1", "REL1BTN");
+	CHECK((bus.ReadReg(OLATA, 0) & RELAY_MASK) == 0x00);
+	CHECK(relay.getSwitch("RELAY1")->sp[0].s == ISS_OFF);
+
+	// motor nibble is left alone
+	bus.WriteBits(0x50, 0xf0, GPIOA, 0);
+	SwitchRelay(&relay, "RELAY3", "REL3BTN");
+	CHECK(bus.ReadReg(OLATA, 0) == 0x54);
+
+	// periodic refresh runs against the simulated board
+	relay.TimerHit();
+	relay.TimerHit();
+	CHECK(relay.isConnected());
+
+	SwitchRelay(&relay, "CONNECTION", "DISCONNECT");
+	CHECK(!relay.isConnected());
+}
+
+static void TestRestore()
+{
+	IndiPiFaceRelay *relay = indiPiFaceRelay.get();
+	relay->ISGetProperties(NULL);
+	relay->setSimulation(true);
+
+	SwitchRelay(relay, "CONNECTION", "CONNECT");
+	CHECK(relay->isConnected());
+	if (!relay->isConnected())
+		return;
+
+	// a dew heater on relay 2 and a plain relay on chip 1
+	NumberRelay(relay, "RELAY_DUTY", "RELAY2_DUTY", 40);
+	SwitchRelay(relay, "RELAY6", "REL6BTN");
+	CHECK(PiFaceTests::PwmScheduled(relay, 1));
+	CHECK(relay->saveConfig(true));
+
+	SwitchRelay(relay, "CONNECTION", "DISCONNECT");
+	CHECK(!PiFaceTests::PwmScheduled(relay, 1));
+	SwitchRelay(relay, "CONNECTION", "CONNECT");
+	CHECK(relay->isConnected());
+	if (!relay->isConnected())
+		return;
+
+	// one verified write per chip, duty cycling is not stopped by the
+	// saved relay states that follow it in the config
+	unsigned long reads = relay->SpiReads();
+	unsigned long writes = relay->SpiWrites();
+	relay->loadConfig(true);
+	CHECK(relay->SpiWrites() - writes <= 2);
+	CHECK(relay->SpiReads() - reads <= 2);
+
+	CHECK(relay->getNumber("RELAY_DUTY")->np[1].value == 40);
+	CHECK(PiFaceTests::PwmScheduled(relay, 1));
+	CHECK(relay->getSwitch("RELAY6")->sp[0].s == ISS_ON);
+	PiFaceMcp23s17 &bus = PiFaceTests::Bus(relay);
+	CHECK((bus.ReadReg(OLATA, 0) & RELAY_MASK) == 0x02);
+	CHECK((bus.ReadReg(OLATA, 1) & RELAY_MASK) == 0x02);
+
+	// the next save keeps the duty cycle
+	CHECK(relay->saveConfig(true));
+	relay->loadConfig(true);
+	CHECK(relay->getNumber("RELAY_DUTY")->np[1].value == 40);
+
+	SwitchRelay(relay, "CONNECTION", "DISCONNECT");
+}
+
+static void SwitchFocuser(IndiPiFaceFocuser1 *focuser, const char *name, const char *element)
+{
+	ISState states[1] = { ISS_ON };
+	char *names[1] = { const_cast<char *>(element) };
+	focuser->ISNewSwitch(focuser->getDeviceName(), name, states, names, 1);
+}
+
+static void NumberFocuser(IndiPiFaceFocuser1 *focuser, const char *name, const char *element, double value)
+{
+	double values[1] = { value };
+	char *names[1] = { const_cast<char *>(element) };
+	focuser->ISNewNumber(focuser->getDeviceName(), name, values, names, 1);
+}
+
+// hands a message of another driver to the focuser as indiserver would
+static void SnoopFocuser(IndiPiFaceFocuser1 *focuser, const char *xml)
+{
+	char errmsg[MAXRBUF];
+	LilXML *lp = newLilXML();
+	XMLEle *root = NULL;
+	for (const char *c = xml; *c != '\0' && root == NULL; c++)
+		root = readXMLEle(lp, *c, errmsg);
+	CHECK(root != NULL);
+	if (root != NULL)
+	{
+		focuser->ISSnoopDevice(root);
+		delXMLEle(root);
+	}
+	delLilXML(lp);
+}
+
+static void LoopTimeout(void *p)
+{
+	*static_cast<int *>(p) = 1;
+}
+
+// runs driver timers and callbacks, moves finish on the event loop
+static void RunLoop(int ms)
+{
+	int done = 0;
+	IEAddTimer(ms, LoopTimeout, &done);
+	IEDeferLoop(0, &done);
+}
+
+static bool WaitFocuser(IndiPiFaceFocuser1 *focuser)
+{
+	INumberVectorProperty *position = focuser->getNumber("ABS_FOCUS_POSITION");
+	for (int ms = 0; position->s == IPS_BUSY && ms < 10000; ms += 10)
+		RunLoop(10);
+	return position->s != IPS_BUSY;
+}
+
+static int FocuserPosition(IndiPiFaceFocuser1 *focuser)
+{
+	return (int) focuser->getNumber("ABS_FOCUS_POSITION")->np[0].value;
+}
+
+// GPIOB lower nibble is released after every move
+static bool FocuserCoasting(IndiPiFaceFocuser1 *focuser)
+{
+	return (PiFaceTests::Bus(focuser).ReadReg(OLATB, 0) & 0x0f) == 0x00;
+}
+
+static IndiPiFaceFocuser1 *ConnectFocuser(int position)
+{
+	IndiPiFaceFocuser1 *focuser = indiPiFaceFocuser1.get();
+	focuser->ISGetProperties(NULL);
+	focuser->setSimulation(true);
+
+	SwitchFocuser(focuser, "CONNECTION", "CONNECT");
+	CHECK(focuser->isConnected());
+	if (!focuser->isConnected())
+		return NULL;
+
+	// shortest step delay, every case starts from a known position
+	NumberFocuser(focuser, "MOTOR_CONFIG", "MOTOR_DELAY", 1);
+	NumberFocuser(focuser, "ABS_FOCUS_POSITION", "FOCUS_ABSOLUTE_POSITION", position);
+	CHECK(WaitFocuser(focuser));
+	CHECK(FocuserPosition(focuser) == position);
+	return focuser;
+}
+
+static void TestFocuser()
+{
+	IndiPiFaceFocuser1 *focuser = ConnectFocuser(0);
+	if (focuser == NULL)
+		return;
+
+	// the request returns at once, the loop publishes the end of the move
+	unsigned long writes = focuser->SpiWrites();
+	NumberFocuser(focuser, "ABS_FOCUS_POSITION", "FOCUS_ABSOLUTE_POSITION", 300);
+	CHECK(focuser->getNumber("ABS_FOCUS_POSITION")->s == IPS_BUSY);
+	CHECK(WaitFocuser(focuser));
+	CHECK(focuser->getNumber("ABS_FOCUS_POSITION")->s == IPS_OK);
+	CHECK(FocuserPosition(focuser) == 300);
+	CHECK(focuser->SpiWrites() - writes >= 300);
+	CHECK(FocuserCoasting(focuser));
+
+	// relative moves during a move chain from where it ends
+	NumberFocuser(focuser, "ABS_FOCUS_POSITION", "FOCUS_ABSOLUTE_POSITION", 400);
+	SwitchFocuser(focuser, "FOCUS_MOTION", "FOCUS_OUTWARD");
+	NumberFocuser(focuser, "REL_FOCUS_POSITION", "FOCUS_RELATIVE_POSITION", 100);
+	SwitchFocuser(focuser, "FOCUS_MOTION", "FOCUS_INWARD");
+	NumberFocuser(focuser, "REL_FOCUS_POSITION", "FOCUS_RELATIVE_POSITION", 30);
+	CHECK(WaitFocuser(focuser));
+	CHECK(FocuserPosition(focuser) == 470);
+	CHECK(FocuserCoasting(focuser));
+
+	// abort stops the motion thread within a step
+	NumberFocuser(focuser, "ABS_FOCUS_POSITION", "FOCUS_ABSOLUTE_POSITION", 5000);
+	RunLoop(50);
+	SwitchFocuser(focuser, "FOCUS_ABORT_MOTION", "ABORT");
+	CHECK(WaitFocuser(focuser));
+	CHECK(focuser->getNumber("ABS_FOCUS_POSITION")->s == IPS_IDLE);
+	CHECK(FocuserPosition(focuser) > 470 && FocuserPosition(focuser) < 5000);
+	CHECK(FocuserCoasting(focuser));
+
+	SwitchFocuser(focuser, "CONNECTION", "DISCONNECT");
+	CHECK(!focuser->isConnected());
+}
+
+static void TestDeferral()
+{
+	IndiPiFaceFocuser1 *focuser = ConnectFocuser(0);
+	if (focuser == NULL)
+		return;
+
+	SwitchFocuser(focuser, "MOVE_DEFERRAL", "DEFER_ENABLE");
+	SnoopFocuser(focuser, "<setNumberVector device='CCD Simulator' name='CCD_EXPOSURE' state='Busy'>"
+		"<oneNumber name='CCD_EXPOSURE_VALUE'>5</oneNumber></setNumberVector>");
+
+	// held during the exposure, relative requests add up on the queued target
+	unsigned long writes = focuser->SpiWrites();
+	NumberFocuser(focuser, "ABS_FOCUS_POSITION", "FOCUS_ABSOLUTE_POSITION", 200);
+	SwitchFocuser(focuser, "FOCUS_MOTION", "FOCUS_OUTWARD");
+	NumberFocuser(focuser, "REL_FOCUS_POSITION", "FOCUS_RELATIVE_POSITION", 50);
+	NumberFocuser(focuser, "REL_FOCUS_POSITION", "FOCUS_RELATIVE_POSITION", 25);
+	RunLoop(50);
+	CHECK(focuser->getNumber("ABS_FOCUS_POSITION")->s == IPS_BUSY);
+	CHECK(FocuserPosition(focuser) == 0);
+	CHECK(focuser->SpiWrites() == writes);
+
+	// one move in the readout gap
+	SnoopFocuser(focuser, "<setNumberVector device='CCD Simulator' name='CCD_EXPOSURE' state='Ok'>"
+		"<oneNumber name='CCD_EXPOSURE_VALUE'>0</oneNumber></setNumberVector>");
+	CHECK(WaitFocuser(focuser));
+	CHECK(FocuserPosition(focuser) == 275);
+	CHECK(FocuserCoasting(focuser));
+
+	SwitchFocuser(focuser, "MOVE_DEFERRAL", "DEFER_DISABLE");
+	SwitchFocuser(focuser, "CONNECTION", "DISCONNECT");
+}
+
+static void SnoopSlot(IndiPiFaceFocuser1 *focuser, int slot)
+{
+	char xml[256];
+	snprintf(xml, sizeof(xml), "<setNumberVector device='Filter Simulator' name='FILTER_SLOT' state='Ok'>"
+		"<oneNumber name='FILTER_SLOT_VALUE'>%d</oneNumber></setNumberVector>", slot);
+	SnoopFocuser(focuser, xml);
+}
+
+static void TestOffsets()
+{
+	IndiPiFaceFocuser1 *focuser = ConnectFocuser(500);
+	if (focuser == NULL)
+		return;
+
+	NumberFocuser(focuser, "FILTER_OFFSETS", "OFFSET_1", 0);
+	NumberFocuser(focuser, "FILTER_OFFSETS", "OFFSET_2", 30);
+	SwitchFocuser(focuser, "FILTER_OFFSET_MODE", "FILTER_OFFSET_ENABLE");
+
+	// the first report only tells where the wheel is
+	SnoopSlot(focuser, 1);
+	CHECK(focuser->getNumber("ABS_FOCUS_POSITION")->s != IPS_BUSY);
+
+	SnoopSlot(focuser, 2);
+	CHECK(WaitFocuser(focuser));
+	CHECK(FocuserPosition(focuser) == 530);
+
+	// an offset during a move adds to its target
+	NumberFocuser(focuser, "ABS_FOCUS_POSITION", "FOCUS_ABSOLUTE_POSITION", 600);
+	SnoopSlot(focuser, 1);
+	CHECK(WaitFocuser(focuser));
+	CHECK(FocuserPosition(focuser) == 570);
+	CHECK(FocuserCoasting(focuser));
+
+	SwitchFocuser(focuser, "FILTER_OFFSET_MODE", "FILTER_OFFSET_DISABLE");
+	SwitchFocuser(focuser, "CONNECTION", "DISCONNECT");
+}
+
+static void SnoopTemperature(IndiPiFaceFocuser1 *focuser, double celsius)
+{
+	char xml[256];
+	snprintf(xml, sizeof(xml), "<setNumberVector device='Weather Simulator' name='WEATHER_PARAMETERS' state='Ok'>"
+		"<oneNumber name='WEATHER_TEMPERATURE'>%0.2f</oneNumber></setNumberVector>", celsius);
+	SnoopFocuser(focuser, xml);
+}
+
+static void TestCompensation()
+{
+	IndiPiFaceFocuser1 *focuser = ConnectFocuser(500);
+	if (focuser == NULL)
+		return;
+
+	NumberFocuser(focuser, "TEMP_COMP_CONFIG", "TC_COEFFICIENT", -10);
+	NumberFocuser(focuser, "TEMP_COMP_CONFIG", "TC_THRESHOLD", 5);
+	SwitchFocuser(focuser, "TEMP_COMPENSATION", "TC_ENABLE");
+	SnoopTemperature(focuser, 10.0);
+	SwitchFocuser(focuser, "TEMP_COMP_RESET", "TC_RESET");
+
+	// steps of a running move are not handed out again
+	SnoopTemperature(focuser, 11.0);
+	CHECK(focuser->getNumber("ABS_FOCUS_POSITION")->s == IPS_BUSY);
+	SnoopTemperature(focuser, 11.0);
+	CHECK(WaitFocuser(focuser));
+	CHECK(FocuserPosition(focuser) == 490);
+
+	// applied once moved
+	SnoopTemperature(focuser, 11.0);
+	CHECK(focuser->getNumber("ABS_FOCUS_POSITION")->s != IPS_BUSY);
+	CHECK(FocuserPosition(focuser) == 490);
+	CHECK(FocuserCoasting(focuser));
+
+	SwitchFocuser(focuser, "TEMP_COMPENSATION", "TC_DISABLE");
+	SwitchFocuser(focuser, "CONNECTION", "DISCONNECT");
+}
+
+static void TestHoming()
+{
+	IndiPiFaceFocuser1 *focuser = ConnectFocuser(100);
+	if (focuser == NULL)
+		return;
+
+	// limit switch on input 1, active low
+	PiFaceMcp23s17 &bus = PiFaceTests::Bus(focuser);
+	const uint8_t limit = 1 << INPUT_SHIFT;
+	NumberFocuser(focuser, "HOME_CONFIG", "HOME_INPUT", 1);
+	NumberFocuser(focuser, "HOME_CONFIG", "HOME_FAST_DELAY", 1);
+	NumberFocuser(focuser, "HOME_CONFIG", "HOME_SLOW_DELAY", 1);
+	NumberFocuser(focuser, "HOME_CONFIG", "HOME_BACKOFF", 50);
+	bus.SimSetInputs(INPUT_CHIP, INPUT_PORT, INPUT_MASK);
+
+	SwitchFocuser(focuser, "FOCUS_HOME", "FOCUS_HOME");
+	CHECK(focuser->getSwitch("FOCUS_HOME")->s == IPS_BUSY);
+	RunLoop(20);
+
+	// fast approach hits the switch, release, back off and approach slowly
+	bus.SimSetInputs(INPUT_CHIP, INPUT_PORT, INPUT_MASK & ~limit);
+	RunLoop(20);
+	bus.SimSetInputs(INPUT_CHIP, INPUT_PORT, INPUT_MASK);
+	RunLoop(40);
+	CHECK(focuser->getSwitch("FOCUS_HOME")->s == IPS_BUSY);
+	bus.SimSetInputs(INPUT_CHIP, INPUT_PORT, INPUT_MASK & ~limit);
+
+	CHECK(WaitFocuser(focuser));
+	CHECK(focuser->getSwitch("FOCUS_HOME")->s == IPS_OK);
+	CHECK(FocuserPosition(focuser) == 0);
+	CHECK(FocuserCoasting(focuser));
+
+	bus.SimSetInputs(INPUT_CHIP, INPUT_PORT, INPUT_MASK);
+	SwitchFocuser(focuser, "CONNECTION", "DISCONNECT");
+}
+
+static void TestInline()
+{
+	IndiPiFaceFocuser1 *focuser = ConnectFocuser(0);
+	if (focuser == NULL)
+		return;
+
+	// without the motion thread the steps run on the caller and the move
+	// still completes on the event loop
+	PiFaceTests::Realtime(focuser).Release();
+	unsigned long writes = focuser->SpiWrites();
+	NumberFocuser(focuser, "ABS_FOCUS_POSITION", "FOCUS_ABSOLUTE_POSITION", 150);
+	CHECK(focuser->SpiWrites() - writes >= 150);
+	CHECK(focuser->getNumber("ABS_FOCUS_POSITION")->s == IPS_BUSY);
+	CHECK(WaitFocuser(focuser));
+	CHECK(focuser->getNumber("ABS_FOCUS_POSITION")->s == IPS_OK);
+	CHECK(FocuserPosition(focuser) == 150);
+	CHECK(FocuserCoasting(focuser));
+
+	SwitchFocuser(focuser, "CONNECTION", "DISCONNECT");
+}
+
+static struct
+{
+	const char *name;
+	void (*run)();
+} tests[] =
+{
+	{ "timerwheel", TestTimerWheel },
+	{ "eventring", TestEventRing },
+	{ "autofocus", TestAutofocus },
+	{ "tempcomp", TestTempComp },
+	{ "stall", TestStall },
+	{ "mcp23s17", TestMcp23s17 },
+	{ "inputs", TestInputs },
+	{ "relay", TestRelay },
+	{ "restore", TestRestore },
+	{ "focuser", TestFocuser },
+	{ "deferral", TestDeferral },
+	{ "offsets", TestOffsets },
+	{ "compensation", TestCompensation },
+	{ "homing", TestHoming },
+	{ "inline", TestInline },
+};
+
+int main(int argc, char *argv[])
+{
+	// driver config and state files stay out of the user's home
+	char home[] = "/tmp/piface_tests.XXXXXX";
+	if (mkdtemp(home) != NULL)
+		setenv("HOME", home, 1);
+	unsetenv(RECORDER_ENV);
+	unsetenv(VCD_ENV);
+
+	int run = 0;
+	for (size_t t = 0; t < sizeof(tests) / sizeof(tests[0]); t++)
+	{
+		bool selected = argc < 2;
+		for (int i = 1; i < argc; i++)
+			if (!strcmp(argv[i], tests[t].name))
+				selected = true;
+		if (!selected)
+			continue;
+
+		int before = failures;
+		tests[t].run();
+		fprintf(stderr, "%-10s %s\n", tests[t].name, failures == before ? "ok" : "FAILED");
+		run++;
+	}
+
+	if (run == 0)
+	{
+		fprintf(stderr, "usage: piface_tests [timerwheel|eventring|autofocus|tempcomp|stall|mcp23s17|inputs|relay|restore|"
+			"focuser|deferral|offsets|compensation|homing|inline...]\n");
+		return 2;
+	}
+
+	return failures == 0 ? 0 : 1;
+}
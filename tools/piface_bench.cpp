@@ -0,0 +1,272 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// Micro-benchmarks of the driver hot paths on the simulated MCP23S17.
+//
+//   piface_bench [-n iterations] [name...]
+//
+// Each benchmark prints its run time per operation and the SPI
+// transactions it issued, so changes to the register path show up as
+// both time and traffic.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "piface_mcp23s17.h"
+#include "piface_timerwheel.h"
+#include "piface_sysinfo.h"
+#include "piface_eventring.h"
+#include "piface_relay.h"
+
+static const int step_sequence[8] = {0xa, 0x2, 0x6, 0x4, 0x5, 0x1, 0x9, 0x8};
+
+static long long MonotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void Report(const char *name, long iterations, long long ns)
+{
+	printf("%-10s %10ld ops %10.1f ns/op\n", name, iterations, (double) ns / iterations);
+}
+
+// half step on the Focuser 1 nibble, as IndiPiFaceFocuser1::Step
+static void BenchStep(long iterations)
+{
+	PiFaceMcp23s17 bus;
+	bus.Open(0, 0, true);
+	bus.WriteBits(0x00, 0x0f, IODIRB, 0);
+	unsigned long base = bus.Reads() + bus.Writes();
+
+	long long start = MonotonicNs();
+	for (long i = 0; i < iterations; i++)
+		bus.WriteBits((step_sequence[i & 7] & 0xf) ^ 0xf, 0x0f, GPIOB, 0);
+	long long ns = MonotonicNs() - start;
+
+	printf("%-10s %10ld ops %10.1f ns/op %6.2f spi/op\n", "step", iterations, (double) ns / iterations, (double) (bus.Reads() + bus.Writes() - base) / iterations);
+}
+
+// verified relay write, as IndiPiFaceRelay::WritePort with readback
+static void BenchRelay(long iterations)
+{
+	PiFaceMcp23s17 bus;
+	bus.Open(0, 0, true);
+	bus.WriteBits(0x00, 0x0f, IODIRA, 0);
+	unsigned long base = bus.Reads() + bus.Writes();
+
+	int errors = 0;
+	long long start = MonotonicNs();
+	for (long i = 0; i < iterations; i++)
+	{
+		uint8_t value = i & 0x0f;
+		bus.WriteBits(value, 0x0f, GPIOA, 0);
+		if ((bus.ReadReg(GPIOA, 0) & 0x0f) != value)
+			errors++;
+	}
+	long long ns = MonotonicNs() - start;
+
+	printf("%-10s %10ld ops %10.1f ns/op %6.2f spi/op %d errors\n", "relay", iterations, (double) ns / iterations, (double) (bus.Reads() + bus.Writes() - base) / iterations, errors);
+}
+
+// both input ports in one sequential transfer, as against two ReadReg
+static void BenchSeq(long iterations)
+{
+	PiFaceMcp23s17 bus;
+	bus.Open(0, 0, true);
+	unsigned long base = bus.Reads() + bus.Writes();
+
+	uint8_t ports[2];
+	long long start = MonotonicNs();
+	for (long i = 0; i < iterations; i++)
+		bus.ReadRegs(ports, 2, GPIOA, i & 1);
+	long long ns = MonotonicNs() - start;
+
+	printf("%-10s %10ld ops %10.1f ns/op %6.2f spi/op\n", "seq", iterations, (double) ns / iterations, (double) (bus.Reads() + bus.Writes() - base) / iterations);
+}
+
+static void PwmExpired(PiFaceTimer *timer, void *p)
+{
+	PiFaceTimerWheel *wheel = static_cast<PiFaceTimerWheel *>(p);
+	wheel->Schedule(timer, timer->expires + 50 + timer->id * 7);
+}
+
+// eight duty cycled relays on the timer wheel, one tick per op
+static void BenchPwm(long iterations)
+{
+	PiFaceTimerWheel wheel;
+	PiFaceTimer timers[8];
+
+	wheel.Reset(0);
+	for (int i = 0; i < 8; i++)
+	{
+		PiFaceTimerWheel::InitTimer(&timers[i], i);
+		wheel.Schedule(&timers[i], 1 + i);
+	}
+
+	long long start = MonotonicNs();
+	for (long i = 1; i <= iterations; i++)
+		wheel.Advance(i, PwmExpired, &wheel);
+	long long ns = MonotonicNs() - start;
+
+	Report("pwm", iterations, ns);
+}
+
+// system info refresh of the TimerHit worker
+static void BenchSysInfo(long iterations)
+{
+	PiFaceSysInfo sysinfo;
+	char text[64];
+
+	if (!sysinfo.Open())
+	{
+		printf("%-10s unavailable\n", "sysinfo");
+		return;
+	}
+
+	long long start = MonotonicNs();
+	for (long i = 0; i < iterations; i++)
+	{
+		sysinfo.Uptime(text, sizeof(text));
+		sysinfo.Load(text, sizeof(text));
+		sysinfo.FreeMem(text, sizeof(text));
+		sysinfo.Temperature(text, sizeof(text));
+	}
+	long long ns = MonotonicNs() - start;
+
+	Report("sysinfo", iterations, ns);
+}
+
+static void SwitchRelay(IndiPiFaceRelay *relay, const char *name, const char *element)
+{
+	ISState states[1] = { ISS_ON };
+	char *names[1] = { const_cast<char *>(element) };
+	relay->ISNewSwitch(relay->getDeviceName(), name, states, names, 1);
+}
+
+// simulated relay driver, connected the way a client does
+static bool ConnectRelay(IndiPiFaceRelay *relay, const char *name)
+{
+	relay->ISGetProperties(NULL);
+	relay->setSimulation(true);
+	SwitchRelay(relay, "CONNECTION", "CONNECT");
+	if (!relay->isConnected())
+		printf("%-10s unavailable\n", name);
+	return relay->isConnected();
+}
+
+// client click through IndiPiFaceRelay::ISNewSwitch down to the latch
+static void BenchToggle(long iterations)
+{
+	IndiPiFaceRelay relay;
+	if (!ConnectRelay(&relay, "toggle"))
+		return;
+	unsigned long base = relay.SpiReads() + relay.SpiWrites();
+
+	long long start = MonotonicNs();
+	for (long i = 0; i < iterations; i++)
+		SwitchRelay(&relay, "RELAY1", "REL1BTN");
+	long long ns = MonotonicNs() - start;
+
+	printf("%-10s %10ld ops %10.1f ns/op %6.2f spi/op\n", "toggle", iterations, (double) ns / iterations, (double) (relay.SpiReads() + relay.SpiWrites() - base) / iterations);
+	SwitchRelay(&relay, "CONNECTION", "DISCONNECT");
+}
+
+// periodic refresh of IndiPiFaceRelay::TimerHit
+static void BenchTimerHit(long iterations)
+{
+	IndiPiFaceRelay relay;
+	if (!ConnectRelay(&relay, "timerhit"))
+		return;
+	unsigned long base = relay.SpiReads() + relay.SpiWrites();
+
+	long long start = MonotonicNs();
+	for (long i = 0; i < iterations; i++)
+		relay.TimerHit();
+	long long ns = MonotonicNs() - start;
+
+	printf("%-10s %10ld ops %10.1f ns/op %6.2f spi/op\n", "timerhit", iterations, (double) ns / iterations, (double) (relay.SpiReads() + relay.SpiWrites() - base) / iterations);
+	SwitchRelay(&relay, "CONNECTION", "DISCONNECT");
+}
+
+static PiFaceEventRing ring;
+
+// event recording on the hot path
+static void BenchEvents(long iterations)
+{
+	long long start = MonotonicNs();
+	for (long i = 0; i < iterations; i++)
+		ring.Record(PiFaceEventRing::EVENT_RELAY_WRITE, 0, i);
+	long long ns = MonotonicNs() - start;
+
+	Report("events", iterations, ns);
+}
+
+static struct
+{
+	const char *name;
+	void (*run)(long iterations);
+	long scale;
+} benchmarks[] =
+{
+	{ "step", BenchStep, 1 },
+	{ "relay", BenchRelay, 1 },
+	{ "seq", BenchSeq, 1 },
+	{ "pwm", BenchPwm, 1 },
+	{ "sysinfo", BenchSysInfo, 100 },
+	{ "events", BenchEvents, 1 },
+	{ "toggle", BenchToggle, 10 },
+	{ "timerhit", BenchTimerHit, 100 },
+};
+
+int main(int argc, char *argv[])
+{
+	long iterations = 1000000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		if (opt == 'n')
+			iterations = atol(optarg);
+		else
+		{
+			fprintf(stderr, "usage: piface_bench [-n iterations] [step|relay|seq|pwm|sysinfo|events|toggle|timerhit...]\n");
+			return 2;
+		}
+	}
+	if (iterations < 1)
+		iterations = 1;
+
+	for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++)
+	{
+		bool selected = optind >= argc;
+		for (int i = optind; i < argc; i++)
+			if (!strcmp(argv[i], benchmarks[b].name))
+				selected = true;
+
+		// slow paths run fewer iterations
+		if (selected)
+			benchmarks[b].run(iterations / benchmarks[b].scale > 0 ? iterations / benchmarks[b].scale : 1);
+	}
+
+	return 0;
+}
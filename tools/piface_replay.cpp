@@ -0,0 +1,271 @@
+/*******************************************************************************
+  Copyright(c) 2016 Radek Kaczorek  <rkaczorek AT gmail DOT com>
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// Replays a PIFACE_RECORD command stream against the drivers running on the
+// simulated MCP23S17 and reports request latency, SPI totals and the final
+// device state.
+//
+//   piface_replay [-s speed] [-w settle_ms] [-v waveform.vcd]
+//                 [-l max_p99_ms] [-t max_spi_per_command] recording
+//
+// speed 1 keeps the recorded timing, 10 runs ten times faster and 0 sends
+// the commands back to back. The event loop keeps running between commands
+// so duty cycles, pulses and timers behave as in the recorded session.
+// With -v the pin levels of the simulated board are written as a VCD.
+// -l and -t set budgets for the p99 request latency and the SPI
+// transactions of all devices per replayed command; the exit status is 1
+// when one is exceeded, so the replay can run as a regression test.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <eventloop.h>
+
+#include "piface_relay.h"
+#include "piface_focuser.h"
+#include "piface_recorder.h"
+#include "piface_vcd.h"
+
+#define MAX_ELEMENTS 32
+
+extern std::unique_ptr<IndiPiFaceRelay> indiPiFaceRelay;
+extern std::unique_ptr<IndiPiFaceFocuser1> indiPiFaceFocuser1;
+extern std::unique_ptr<IndiPiFaceFocuser2> indiPiFaceFocuser2;
+
+static long long MonotonicNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// run the event loop for ms milliseconds
+static void RunLoop(int ms)
+{
+	int never = 0;
+	IEDeferLoop(ms > 0 ? ms : 0, &never);
+}
+
+static void EnableSimulation(const char *dev)
+{
+	ISState states[1] = { ISS_ON };
+	char enable[] = "ENABLE";
+	char *names[1] = { enable };
+	ISNewSwitch(dev, "SIMULATION", states, names, 1);
+}
+
+static void Usage()
+{
+	fprintf(stderr, "usage: piface_replay [-s speed] [-w settle_ms] [-v waveform.vcd] [-l max_p99_ms] [-t max_spi_per_command] recording\n");
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	double speed = 1;
+	int settle = 1000;
+	const char *waveform = NULL;
+	double max_p99 = -1;
+	double max_spi = -1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:w:v:l:t:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'w':
+			settle = atoi(optarg);
+			break;
+		case 'v':
+			waveform = optarg;
+			break;
+		case 'l':
+			max_p99 = atof(optarg);
+			break;
+		case 't':
+			max_spi = atof(optarg);
+			break;
+		default:
+			Usage();
+		}
+	}
+	if (optind >= argc)
+		Usage();
+
+	FILE *fp = fopen(argv[optind], "r");
+	if (fp == NULL)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+
+	// waveform starts before the drivers touch the simulated board
+	if (waveform != NULL && !PiFaceVcd::Start(waveform))
+	{
+		perror(waveform);
+		return 1;
+	}
+
+	// never record the replay, driver XML goes nowhere
+	unsetenv(RECORDER_ENV);
+	FILE *report = fdopen(dup(1), "w");
+	if (freopen("/dev/null", "w", stdout) == NULL)
+		return 1;
+
+	ISGetProperties(NULL);
+	EnableSimulation(indiPiFaceRelay->getDeviceName());
+	EnableSimulation(indiPiFaceFocuser1->getDeviceName());
+	EnableSimulation(indiPiFaceFocuser2->getDeviceName());
+
+	std::vector<double> latency;
+	long long start = MonotonicNs();
+	long long first = -1;
+	char line[4096];
+	int skipped = 0;
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		line[strcspn(line, "\r\n")] = 0;
+
+		// time, type, device, property, elements
+		char *fields[4 + MAX_ELEMENTS];
+		int count = 0;
+		for (char *field = strtok(line, "\t"); field != NULL && count < 4 + MAX_ELEMENTS; field = strtok(NULL, "\t"))
+			fields[count++] = field;
+		if (count < 5 || !strcmp(fields[3], "SIMULATION"))
+		{
+			skipped++;
+			continue;
+		}
+
+		// keep the recorded pacing
+		long long t = atoll(fields[0]);
+		if (first < 0)
+			first = t;
+		if (speed > 0)
+			RunLoop((int) (((t - first) / speed - (MonotonicNs() - start)) / 1000000));
+
+		int n = count - 4;
+		char *names[MAX_ELEMENTS];
+		char *texts[MAX_ELEMENTS];
+		double values[MAX_ELEMENTS];
+		ISState states[MAX_ELEMENTS];
+		for (int i = 0; i < n; i++)
+		{
+			char *value = strchr(fields[4 + i], '=');
+			if (value == NULL)
+				value = fields[4 + i] + strlen(fields[4 + i]);
+			else
+				*value++ = 0;
+			names[i] = fields[4 + i];
+			texts[i] = value;
+			values[i] = atof(value);
+			states[i] = !strcmp(value, "On") ? ISS_ON : ISS_OFF;
+		}
+
+		long long begin = MonotonicNs();
+		if (!strcmp(fields[1], "switch"))
+			ISNewSwitch(fields[2], fields[3], states, names, n);
+		else if (!strcmp(fields[1], "number"))
+			ISNewNumber(fields[2], fields[3], values, names, n);
+		else if (!strcmp(fields[1], "text"))
+			ISNewText(fields[2], fields[3], texts, names, n);
+		else
+		{
+			skipped++;
+			continue;
+		}
+		latency.push_back((MonotonicNs() - begin) / 1e6);
+
+		// let callbacks queued by the request run
+		RunLoop(0);
+	}
+	fclose(fp);
+
+	RunLoop(settle);
+	double elapsed = (MonotonicNs() - start) / 1e9;
+
+	// report
+	fprintf(report, "commands: %d replayed, %d skipped, %.3f s\n", (int) latency.size(), skipped, elapsed);
+	double p99 = 0;
+	if (!latency.empty())
+	{
+		std::vector<double> sorted(latency);
+		std::sort(sorted.begin(), sorted.end());
+		double sum = 0;
+		for (size_t i = 0; i < sorted.size(); i++)
+			sum += sorted[i];
+		p99 = sorted[(sorted.size() * 99) / 100];
+		fprintf(report, "latency ms: mean %.3f p50 %.3f p99 %.3f max %.3f\n",
+			sum / sorted.size(), sorted[sorted.size() / 2], p99, sorted.back());
+	}
+
+	fprintf(report, "spi %s: %lu reads, %lu writes\n", indiPiFaceRelay->getDeviceName(), indiPiFaceRelay->SpiReads(), indiPiFaceRelay->SpiWrites());
+	fprintf(report, "spi %s: %lu reads, %lu writes\n", indiPiFaceFocuser1->getDeviceName(), indiPiFaceFocuser1->SpiReads(), indiPiFaceFocuser1->SpiWrites());
+	fprintf(report, "spi %s: %lu reads, %lu writes\n", indiPiFaceFocuser2->getDeviceName(), indiPiFaceFocuser2->SpiReads(), indiPiFaceFocuser2->SpiWrites());
+
+	fprintf(report, "state %s:", indiPiFaceRelay->getDeviceName());
+	for (int i = 0; i < RELAY_COUNT; i++)
+	{
+		char name[16];
+		snprintf(name, sizeof(name), "RELAY%d", i + 1);
+		ISwitchVectorProperty *svp = indiPiFaceRelay->getSwitch(name);
+		fprintf(report, " %s=%s", name, svp && svp->sp[0].s == ISS_ON ? "On" : "Off");
+	}
+	fprintf(report, "\n");
+
+	INumberVectorProperty *nvp = indiPiFaceFocuser1->getNumber("ABS_FOCUS_POSITION");
+	fprintf(report, "state %s: position %.0f\n", indiPiFaceFocuser1->getDeviceName(), nvp ? nvp->np[0].value : 0);
+	nvp = indiPiFaceFocuser2->getNumber("ABS_FOCUS_POSITION");
+	fprintf(report, "state %s: position %.0f\n", indiPiFaceFocuser2->getDeviceName(), nvp ? nvp->np[0].value : 0);
+
+	// budgets, a recording without commands fails them too
+	int failed = 0;
+	unsigned long spi = indiPiFaceRelay->SpiReads() + indiPiFaceRelay->SpiWrites()
+		+ indiPiFaceFocuser1->SpiReads() + indiPiFaceFocuser1->SpiWrites()
+		+ indiPiFaceFocuser2->SpiReads() + indiPiFaceFocuser2->SpiWrites();
+	double spi_per_command = latency.empty() ? 0 : (double) spi / latency.size();
+	if ((max_p99 >= 0 || max_spi >= 0) && latency.empty())
+	{
+		fprintf(report, "budget exceeded: no commands replayed\n");
+		failed = 1;
+	}
+	if (max_p99 >= 0 && p99 > max_p99)
+	{
+		fprintf(report, "budget exceeded: latency p99 %.3f ms > %.3f ms\n", p99, max_p99);
+		failed = 1;
+	}
+	if (max_spi >= 0 && spi_per_command > max_spi)
+	{
+		fprintf(report, "budget exceeded: %.2f spi/command > %.2f\n", spi_per_command, max_spi);
+		failed = 1;
+	}
+
+	fclose(report);
+	PiFaceVcd::Stop();
+	return failed;
+}